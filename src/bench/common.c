@@ -0,0 +1,70 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "common.h"
+#include <nimble-client/client.h>
+#include <nimble-client/incoming_api.h>
+#include <nimble-steps-serialize/out_serialize.h>
+#include <time.h>
+
+/// Wall clock time for measuring how long the client code takes
+/// @return monotonic nanoseconds
+uint64_t nimbleBenchNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/// Clock function for a NimbleClientClock that reads a MonotonicTimeMs owned by the bench, so the simulated
+/// time does not depend on how fast the machine is
+/// @param self pointer to the MonotonicTimeMs
+/// @return the simulated time
+MonotonicTimeMs nimbleBenchVirtualClockNow(void* self)
+{
+    const MonotonicTimeMs* now = (const MonotonicTimeMs*) self;
+
+    return *now;
+}
+
+/// Writes a predicted step for the first local participant, if there is room for it
+/// @param client synced nimble client
+/// @return negative on error
+int nimbleBenchWritePredictedStep(NimbleClient* client)
+{
+    if (!nbsStepsAllowedToAdd(&client->outSteps)) {
+        return 0;
+    }
+
+    uint8_t payload[4] = {0xca, 0xfe, 0xba, 0xbe};
+    NimbleStepsOutSerializeLocalParticipants data;
+    data.participants[0].participantId = client->localParticipantLookup[0].participantId;
+    data.participants[0].payload = payload;
+    data.participants[0].payloadCount = sizeof(payload);
+    data.participantCount = 1;
+
+    uint8_t stepBuf[64];
+    ssize_t octetLength = nbsStepsOutSerializeCombinedStep(&data, stepBuf, sizeof(stepBuf));
+    if (octetLength < 0) {
+        return (int) octetLength;
+    }
+
+    return nbsStepsWrite(&client->outSteps, client->outSteps.expectedWriteId, stepBuf, (size_t) octetLength);
+}
+
+/// Reads all the authoritative steps that the client has received
+/// @param client nimble client
+/// @return number of steps read
+size_t nimbleBenchReadAuthoritativeSteps(NimbleClient* client)
+{
+    uint8_t readPayload[512];
+    StepId readStepId;
+    size_t count = 0;
+
+    while (nimbleClientReadStep(client, readPayload, sizeof(readPayload), &readStepId) > 0) {
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,22 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_BENCH_COMMON_H
+#define NIMBLE_CLIENT_BENCH_COMMON_H
+
+#include <monotonic-time/monotonic_time.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct NimbleClient;
+
+#define BENCH_TICK_DURATION_MS (16)
+#define BENCH_MAX_TICKS_TO_SYNC (10000)
+
+uint64_t nimbleBenchNowNs(void);
+MonotonicTimeMs nimbleBenchVirtualClockNow(void* self);
+int nimbleBenchWritePredictedStep(struct NimbleClient* client);
+size_t nimbleBenchReadAuthoritativeSteps(struct NimbleClient* client);
+
+#endif
@@ -0,0 +1,371 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "impaired_transport.h"
+#include <clog/clog.h>
+#include <string.h>
+
+static uint64_t randomNext(NimbleImpairedTransport* self)
+{
+    // xorshift64*
+    uint64_t x = self->randomState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    self->randomState = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static float randomFloat(NimbleImpairedTransport* self)
+{
+    return (float) (randomNext(self) >> 40) / (float) (1U << 24);
+}
+
+static bool randomChance(NimbleImpairedTransport* self, float probability)
+{
+    if (probability <= 0.f) {
+        return false;
+    }
+
+    return randomFloat(self) < probability;
+}
+
+static MonotonicTimeMs sampleJitter(NimbleImpairedTransport* self, const NimbleImpairedLinkSettings* settings)
+{
+    float jitter = (float) settings->jitterMs;
+
+    switch (settings->jitterDistribution) {
+        case NimbleImpairedJitterDistributionNone:
+            return 0;
+        case NimbleImpairedJitterDistributionUniform:
+            return (MonotonicTimeMs) (randomFloat(self) * jitter);
+        case NimbleImpairedJitterDistributionNormal: {
+            // Irwin-Hall approximation, bell shaped around jitter / 2
+            float sum = randomFloat(self) + randomFloat(self) + randomFloat(self) + randomFloat(self);
+            return (MonotonicTimeMs) (sum * 0.25f * jitter);
+        }
+        case NimbleImpairedJitterDistributionSpiky:
+            // Mostly a small jitter, but every now and then a spike well above the configured jitter
+            if (randomChance(self, 0.05f)) {
+                return (MonotonicTimeMs) ((0.5f + randomFloat(self) * 1.5f) * jitter);
+            }
+            return (MonotonicTimeMs) (randomFloat(self) * jitter * 0.25f);
+    }
+
+    return 0;
+}
+
+/// Samples the one-way delay of a datagram, without any loss, duplication or reordering
+/// @param self impaired transport, only its random generator is used
+/// @param settings link settings
+/// @return delay in milliseconds
+MonotonicTimeMs nimbleImpairedTransportSampleDelay(NimbleImpairedTransport* self,
+                                                   const NimbleImpairedLinkSettings* settings)
+{
+    return settings->delayMs + sampleJitter(self, settings);
+}
+
+static bool shouldDrop(NimbleImpairedTransport* self, NimbleImpairedDirection* direction)
+{
+    const NimbleImpairedLinkSettings* settings = &direction->settings;
+
+    if (settings->burstEnterProbability > 0.f) {
+        if (direction->isInBurst) {
+            if (randomChance(self, settings->burstExitProbability)) {
+                direction->isInBurst = false;
+            }
+        } else if (randomChance(self, settings->burstEnterProbability)) {
+            direction->isInBurst = true;
+        }
+
+        if (direction->isInBurst && randomChance(self, settings->burstLossProbability)) {
+            direction->stats.burstDroppedCount++;
+            return true;
+        }
+    }
+
+    if (randomChance(self, settings->lossProbability)) {
+        direction->stats.droppedCount++;
+        return true;
+    }
+
+    return false;
+}
+
+static void enqueue(NimbleImpairedTransport* self, NimbleImpairedDirection* direction, const uint8_t* octets,
+                    size_t octetCount, MonotonicTimeMs now)
+{
+    const NimbleImpairedLinkSettings* settings = &direction->settings;
+
+    if (direction->inFlightCount == NIMBLE_IMPAIRED_MAX_IN_FLIGHT) {
+        direction->stats.overflowCount++;
+        return;
+    }
+
+    MonotonicTimeMs deliverAt = now + settings->delayMs + sampleJitter(self, settings);
+
+    if (randomChance(self, settings->reorderProbability)) {
+        deliverAt += settings->reorderExtraDelayMs;
+        direction->stats.reorderedCount++;
+    } else {
+        // Jitter alone does not reorder datagrams, a datagram can not overtake the previous one
+        if (deliverAt < direction->lastDeliverAt) {
+            deliverAt = direction->lastDeliverAt;
+        }
+        direction->lastDeliverAt = deliverAt;
+    }
+
+    NimbleImpairedDatagram* datagram = &direction->inFlight[direction->inFlightCount++];
+    tc_memcpy_octets(datagram->octets, octets, octetCount);
+    datagram->octetCount = octetCount;
+    datagram->deliverAt = deliverAt;
+    datagram->sequence = self->sequence++;
+}
+
+static void impair(NimbleImpairedTransport* self, NimbleImpairedDirection* direction, const uint8_t* octets,
+                   size_t octetCount, MonotonicTimeMs now)
+{
+    direction->stats.datagramCount++;
+
+    if (shouldDrop(self, direction)) {
+        return;
+    }
+
+    enqueue(self, direction, octets, octetCount, now);
+
+    if (randomChance(self, direction->settings.duplicateProbability)) {
+        direction->stats.duplicatedCount++;
+        enqueue(self, direction, octets, octetCount, now);
+    }
+}
+
+static ssize_t popDue(NimbleImpairedDirection* direction, MonotonicTimeMs now, uint8_t* target, size_t maxOctetCount,
+                      MonotonicTimeMs* deliveredAt)
+{
+    size_t foundIndex = direction->inFlightCount;
+
+    for (size_t i = 0; i < direction->inFlightCount; ++i) {
+        const NimbleImpairedDatagram* datagram = &direction->inFlight[i];
+        if (datagram->deliverAt > now) {
+            continue;
+        }
+        if (foundIndex == direction->inFlightCount) {
+            foundIndex = i;
+            continue;
+        }
+        const NimbleImpairedDatagram* found = &direction->inFlight[foundIndex];
+        if (datagram->deliverAt < found->deliverAt ||
+            (datagram->deliverAt == found->deliverAt && datagram->sequence < found->sequence)) {
+            foundIndex = i;
+        }
+    }
+
+    if (foundIndex == direction->inFlightCount) {
+        return 0;
+    }
+
+    NimbleImpairedDatagram* found = &direction->inFlight[foundIndex];
+    if (found->octetCount > maxOctetCount) {
+        return -2;
+    }
+
+    size_t octetCount = found->octetCount;
+    tc_memcpy_octets(target, found->octets, octetCount);
+    *deliveredAt = found->deliverAt;
+
+    direction->inFlightCount--;
+    if (foundIndex != direction->inFlightCount) {
+        *found = direction->inFlight[direction->inFlightCount];
+    }
+
+    return (ssize_t) octetCount;
+}
+
+static int flushOutgoing(NimbleImpairedTransport* self, MonotonicTimeMs now)
+{
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    MonotonicTimeMs deliveredAt;
+
+    while (1) {
+        ssize_t octetCount = popDue(&self->outgoing, now, buf, DATAGRAM_TRANSPORT_MAX_SIZE, &deliveredAt);
+        if (octetCount <= 0) {
+            return (int) octetCount;
+        }
+        int err = datagramTransportSend(&self->inner, buf, (size_t) octetCount);
+        if (err < 0) {
+            return err;
+        }
+    }
+}
+
+static int pullIncoming(NimbleImpairedTransport* self, MonotonicTimeMs now)
+{
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+
+    while (1) {
+        ssize_t octetCount = datagramTransportReceive(&self->inner, buf, DATAGRAM_TRANSPORT_MAX_SIZE);
+        if (octetCount <= 0) {
+            return (int) octetCount;
+        }
+        impair(self, &self->incoming, buf, (size_t) octetCount, now);
+    }
+}
+
+/// Sends datagrams that are due and receives datagrams from the wrapped transport.
+/// Should be called at least once every tick, so datagrams can be delivered even if the client is not sending.
+/// @param self impaired transport
+/// @return negative on error
+int nimbleImpairedTransportUpdate(NimbleImpairedTransport* self)
+{
+    MonotonicTimeMs now = nimbleClientClockNow(&self->clock);
+
+    int err = flushOutgoing(self, now);
+    if (err < 0) {
+        return err;
+    }
+
+    return pullIncoming(self, now);
+}
+
+static int impairedSend(void* _self, const uint8_t* data, size_t size)
+{
+    NimbleImpairedTransport* self = (NimbleImpairedTransport*) _self;
+    MonotonicTimeMs now = nimbleClientClockNow(&self->clock);
+
+    impair(self, &self->outgoing, data, size, now);
+
+    int err = flushOutgoing(self, now);
+    if (err < 0) {
+        return err;
+    }
+
+    return (int) size;
+}
+
+static ssize_t impairedReceive(void* _self, uint8_t* data, size_t size)
+{
+    NimbleImpairedTransport* self = (NimbleImpairedTransport*) _self;
+    MonotonicTimeMs now = nimbleClientClockNow(&self->clock);
+
+    int err = pullIncoming(self, now);
+    if (err < 0) {
+        return err;
+    }
+
+    return popDue(&self->incoming, now, data, size, &self->lastReceivedAt);
+}
+
+static bool impairedReceivedAt(void* _self, size_t datagramIndex, MonotonicTimeMs* receivedAt)
+{
+    const NimbleImpairedTransport* self = (const NimbleImpairedTransport*) _self;
+
+    (void) datagramIndex;
+
+    *receivedAt = self->lastReceivedAt;
+
+    return true;
+}
+
+static void directionInit(NimbleImpairedDirection* self, const NimbleImpairedLinkSettings* settings)
+{
+    self->settings = *settings;
+    self->inFlightCount = 0;
+    self->isInBurst = false;
+    self->lastDeliverAt = 0;
+    tc_mem_clear_type(&self->stats);
+}
+
+/// Initializes the impaired transport
+/// @param self impaired transport
+/// @param inner the transport to wrap
+/// @param clock time source for delivery times
+/// @param outgoing impairment for datagrams sent through the transport
+/// @param incoming impairment for datagrams received from the transport
+/// @param seed random seed, same seed gives the same impairment
+void nimbleImpairedTransportInit(NimbleImpairedTransport* self, DatagramTransport inner, NimbleClientClock clock,
+                                 const NimbleImpairedLinkSettings* outgoing,
+                                 const NimbleImpairedLinkSettings* incoming, uint64_t seed)
+{
+    self->inner = inner;
+    self->clock = clock;
+    self->sequence = 0;
+    self->lastReceivedAt = 0;
+
+    // splitmix64 of the seed, so small seeds still give a well mixed state
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    self->randomState = z != 0 ? z : 1;
+
+    directionInit(&self->outgoing, outgoing);
+    directionInit(&self->incoming, incoming);
+}
+
+/// Creates a datagram transport that goes through the impairment
+/// @param self impaired transport
+/// @return the datagram transport
+DatagramTransport nimbleImpairedTransportTransport(NimbleImpairedTransport* self)
+{
+    DatagramTransport transport;
+
+    transport.self = self;
+    transport.send = impairedSend;
+    transport.receive = impairedReceive;
+
+    return transport;
+}
+
+/// Creates a receive timestamp extension that reports when the last received datagram was due, like a kernel
+/// receive timestamp would, even if the client reads it later
+/// @param self impaired transport
+/// @return the receive timestamp extension
+NimbleClientTransportTimestamp nimbleImpairedTransportTimestamp(NimbleImpairedTransport* self)
+{
+    NimbleClientTransportTimestamp timestamp;
+
+    timestamp.self = self;
+    timestamp.receivedAt = impairedReceivedAt;
+
+    return timestamp;
+}
+
+/// Sets the settings to a perfect link
+/// @param self link settings
+void nimbleImpairedLinkSettingsClear(NimbleImpairedLinkSettings* self)
+{
+    tc_mem_clear_type(self);
+    self->jitterDistribution = NimbleImpairedJitterDistributionNone;
+}
+
+typedef struct NimbleImpairedProfile {
+    const char* name;
+    NimbleImpairedLinkSettings settings;
+} NimbleImpairedProfile;
+
+static const NimbleImpairedProfile g_profiles[] = {
+    {"perfect", {0, 0, NimbleImpairedJitterDistributionNone, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0}},
+    {"lan", {1, 1, NimbleImpairedJitterDistributionUniform, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0}},
+    {"dsl", {15, 4, NimbleImpairedJitterDistributionNormal, 0.002f, 0.f, 0.f, 0.f, 0.f, 0.f, 0}},
+    {"wifi", {8, 12, NimbleImpairedJitterDistributionSpiky, 0.01f, 0.f, 0.f, 0.f, 0.001f, 0.002f, 10}},
+    {"mobile", {40, 25, NimbleImpairedJitterDistributionSpiky, 0.01f, 0.01f, 0.3f, 0.6f, 0.f, 0.01f, 20}},
+    {"bad", {90, 40, NimbleImpairedJitterDistributionNormal, 0.05f, 0.02f, 0.2f, 0.8f, 0.01f, 0.03f, 30}},
+};
+
+/// Fills in the link settings from a named profile
+/// Known profiles are "perfect", "lan", "dsl", "wifi", "mobile" and "bad". Delays are one-way.
+/// @param self link settings
+/// @param profileName name of the profile
+/// @return negative if the profile is unknown
+int nimbleImpairedLinkSettingsFromProfile(NimbleImpairedLinkSettings* self, const char* profileName)
+{
+    for (size_t i = 0; i < sizeof(g_profiles) / sizeof(g_profiles[0]); ++i) {
+        if (strcmp(g_profiles[i].name, profileName) == 0) {
+            *self = g_profiles[i].settings;
+            return 0;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,89 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_BENCH_IMPAIRED_TRANSPORT_H
+#define NIMBLE_CLIENT_BENCH_IMPAIRED_TRANSPORT_H
+
+#include <datagram-transport/transport.h>
+#include <datagram-transport/types.h>
+#include <nimble-client/clock.h>
+#include <nimble-client/transport_timestamp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NIMBLE_IMPAIRED_MAX_IN_FLIGHT (256)
+
+typedef enum NimbleImpairedJitterDistribution {
+    NimbleImpairedJitterDistributionNone,
+    NimbleImpairedJitterDistributionUniform,
+    NimbleImpairedJitterDistributionNormal,
+    NimbleImpairedJitterDistributionSpiky,
+} NimbleImpairedJitterDistribution;
+
+/// Impairment applied to datagrams travelling in one direction.
+/// Burst loss is modelled as a two state (Gilbert-Elliott) channel.
+typedef struct NimbleImpairedLinkSettings {
+    MonotonicTimeMs delayMs;
+    MonotonicTimeMs jitterMs;
+    NimbleImpairedJitterDistribution jitterDistribution;
+    float lossProbability;
+    float burstEnterProbability;
+    float burstExitProbability;
+    float burstLossProbability;
+    float duplicateProbability;
+    float reorderProbability;
+    MonotonicTimeMs reorderExtraDelayMs;
+} NimbleImpairedLinkSettings;
+
+typedef struct NimbleImpairedDatagram {
+    uint8_t octets[DATAGRAM_TRANSPORT_MAX_SIZE];
+    size_t octetCount;
+    MonotonicTimeMs deliverAt;
+    uint64_t sequence;
+} NimbleImpairedDatagram;
+
+typedef struct NimbleImpairedDirectionStats {
+    size_t datagramCount;
+    size_t droppedCount;
+    size_t burstDroppedCount;
+    size_t duplicatedCount;
+    size_t reorderedCount;
+    size_t overflowCount;
+} NimbleImpairedDirectionStats;
+
+typedef struct NimbleImpairedDirection {
+    NimbleImpairedLinkSettings settings;
+    NimbleImpairedDatagram inFlight[NIMBLE_IMPAIRED_MAX_IN_FLIGHT];
+    size_t inFlightCount;
+    bool isInBurst;
+    MonotonicTimeMs lastDeliverAt;
+    NimbleImpairedDirectionStats stats;
+} NimbleImpairedDirection;
+
+/// Decorates a datagram transport with delay, jitter, loss, duplication and reordering.
+/// All randomness comes from a seeded generator, so runs are reproducible.
+typedef struct NimbleImpairedTransport {
+    DatagramTransport inner;
+    NimbleClientClock clock;
+    NimbleImpairedDirection outgoing;
+    NimbleImpairedDirection incoming;
+    uint64_t randomState;
+    uint64_t sequence;
+    MonotonicTimeMs lastReceivedAt;
+} NimbleImpairedTransport;
+
+void nimbleImpairedTransportInit(NimbleImpairedTransport* self, DatagramTransport inner, NimbleClientClock clock,
+                                 const NimbleImpairedLinkSettings* outgoing,
+                                 const NimbleImpairedLinkSettings* incoming, uint64_t seed);
+int nimbleImpairedTransportUpdate(NimbleImpairedTransport* self);
+DatagramTransport nimbleImpairedTransportTransport(NimbleImpairedTransport* self);
+NimbleClientTransportTimestamp nimbleImpairedTransportTimestamp(NimbleImpairedTransport* self);
+MonotonicTimeMs nimbleImpairedTransportSampleDelay(NimbleImpairedTransport* self,
+                                                   const NimbleImpairedLinkSettings* settings);
+
+void nimbleImpairedLinkSettingsClear(NimbleImpairedLinkSettings* self);
+int nimbleImpairedLinkSettingsFromProfile(NimbleImpairedLinkSettings* self, const char* profileName);
+
+#endif
@@ -0,0 +1,806 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "loopback_server.h"
+#include <flood/in_stream.h>
+#include <flood/out_stream.h>
+#include <imprint/allocator.h>
+#include <nimble-client/client.h>
+#include <nimble-client/datagram_command.h>
+#include <nimble-client/download_state_response.h>
+#include <nimble-serialize/serialize.h>
+#include <nimble-serialize/server_in.h>
+#include <nimble-serialize/server_out.h>
+#include <nimble-steps-serialize/in_serialize.h>
+#include <nimble-steps-serialize/out_serialize.h>
+#include <nimble-steps-serialize/pending_in_serialize.h>
+#include <nimble-steps-serialize/pending_out_serialize.h>
+
+#define NIMBLE_LOOPBACK_MAX_BLOB_ENTRIES_PER_UPDATE (8)
+#define NIMBLE_LOOPBACK_STEP_PAYLOAD_OCTET_COUNT (4)
+#define NIMBLE_LOOPBACK_CHANGING_GAME_STATE_OCTET_COUNT (4096)
+
+static void queueInit(NimbleLoopbackDatagramQueue* self, struct ImprintAllocator* memory, size_t capacity)
+{
+    self->datagrams = IMPRINT_ALLOC_TYPE_COUNT(memory, NimbleLoopbackDatagram, capacity);
+    self->capacity = capacity;
+    self->readIndex = 0;
+    self->writeIndex = 0;
+    self->count = 0;
+    self->droppedCount = 0;
+}
+
+static void queuePush(NimbleLoopbackDatagramQueue* self, const uint8_t* octets, size_t octetCount)
+{
+    if (self->count == self->capacity) {
+        self->droppedCount++;
+        return;
+    }
+
+    NimbleLoopbackDatagram* datagram = &self->datagrams[self->writeIndex];
+    tc_memcpy_octets(datagram->octets, octets, octetCount);
+    datagram->octetCount = octetCount;
+    self->writeIndex = (self->writeIndex + 1) % self->capacity;
+    self->count++;
+}
+
+static ssize_t queuePeek(const NimbleLoopbackDatagramQueue* self, const uint8_t** octets)
+{
+    if (self->count == 0) {
+        return 0;
+    }
+
+    const NimbleLoopbackDatagram* datagram = &self->datagrams[self->readIndex];
+    *octets = datagram->octets;
+
+    return (ssize_t) datagram->octetCount;
+}
+
+static void queueDiscard(NimbleLoopbackDatagramQueue* self)
+{
+    self->readIndex = (self->readIndex + 1) % self->capacity;
+    self->count--;
+}
+
+static ssize_t queuePop(NimbleLoopbackDatagramQueue* self, uint8_t* target, size_t maxOctetCount)
+{
+    if (self->count == 0) {
+        return 0;
+    }
+
+    const NimbleLoopbackDatagram* datagram = &self->datagrams[self->readIndex];
+    if (datagram->octetCount > maxOctetCount) {
+        return -2;
+    }
+    size_t octetCount = datagram->octetCount;
+    tc_memcpy_octets(target, datagram->octets, octetCount);
+    queueDiscard(self);
+
+    return (ssize_t) octetCount;
+}
+
+/// Same rule as the client: debug markers until the connect response has been sent, then as negotiated
+static bool wireUsesDebugInfo(const NimbleLoopbackServer* self)
+{
+    return self->phase == NimbleLoopbackServerPhaseWaitingForConnect || self->useDebugStreams;
+}
+
+static void prepareHeaderWithDebugInfo(NimbleLoopbackServer* self, FldOutStream* outStream, uint8_t* buf,
+                                       bool writeDebugInfo)
+{
+    fldOutStreamInit(outStream, buf, DATAGRAM_TRANSPORT_MAX_SIZE);
+    outStream->writeDebugInfo = writeDebugInfo;
+    orderedDatagramOutLogicPrepare(&self->orderedDatagramOut, outStream);
+    fldOutStreamWriteMarker(outStream, 0xdd);
+    fldOutStreamWriteUInt16(outStream, self->lastClientTimeLowerBits);
+}
+
+static void prepareHeader(NimbleLoopbackServer* self, FldOutStream* outStream, uint8_t* buf)
+{
+    prepareHeaderWithDebugInfo(self, outStream, buf, wireUsesDebugInfo(self));
+}
+
+static void prepareDatagram(NimbleLoopbackServer* self, FldOutStream* outStream, uint8_t* buf, uint8_t cmd)
+{
+    prepareHeader(self, outStream, buf);
+    fldOutStreamWriteUInt8(outStream, cmd);
+}
+
+static void sendDatagram(NimbleLoopbackServer* self, const FldOutStream* outStream)
+{
+    orderedDatagramOutLogicCommit(&self->orderedDatagramOut);
+    self->stats.datagramsToClient++;
+    self->stats.octetsToClient += outStream->pos;
+    queuePush(&self->toClient, outStream->octets, outStream->pos);
+}
+
+static int onConnectRequest(NimbleLoopbackServer* self, FldInStream* inStream)
+{
+    NimbleSerializeConnectRequest request;
+    int err = nimbleSerializeServerInConnectRequest(inStream, &request);
+    if (err < 0) {
+        return err;
+    }
+
+    self->useDebugStreams = request.useDebugStreams;
+
+    NimbleSerializeConnectResponse response;
+    response.useDebugStreams = self->useDebugStreams;
+    response.connectionId = self->connectionId;
+    response.clientRequestId = request.clientRequestId;
+
+    // The connect response always carries debug markers, the client has not seen the negotiated value yet
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    FldOutStream outStream;
+    prepareHeaderWithDebugInfo(self, &outStream, buf, true);
+    nimbleSerializeServerOutConnectResponse(&outStream, &response, &self->log);
+    sendDatagram(self, &outStream);
+
+    if (self->phase == NimbleLoopbackServerPhaseWaitingForConnect) {
+        self->phase = NimbleLoopbackServerPhaseConnected;
+    }
+
+    return 0;
+}
+
+static int onJoinGameRequest(NimbleLoopbackServer* self, FldInStream* inStream)
+{
+    NimbleSerializeJoinGameRequest request;
+    int err = nimbleSerializeServerInJoinGameRequest(inStream, &request);
+    if (err < 0) {
+        return err;
+    }
+
+    NimbleSerializeJoinGameResponse response;
+    response.nonce = request.nonce;
+    response.partyAndSessionSecret.partyId = 1;
+    response.partyAndSessionSecret.sessionSecret.value = 0xfeedc0de;
+    response.participantCount = request.playerCount;
+
+    // The request is resent until the response arrives, so the participant ids must be stable
+    if (self->participantCount == 0) {
+        for (size_t i = 0; i < request.playerCount && i < NIMBLE_LOOPBACK_MAX_PARTICIPANTS; ++i) {
+            self->participantIds[i] = self->nextParticipantId++;
+        }
+        self->participantCount = request.playerCount;
+    }
+
+    for (size_t i = 0; i < response.participantCount; ++i) {
+        response.participants[i].localIndex = request.players[i].localIndex;
+        response.participants[i].participantId = self->participantIds[i];
+    }
+
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    FldOutStream outStream;
+    prepareHeader(self, &outStream, buf);
+    nimbleSerializeServerOutJoinGameResponse(&outStream, &response, &self->log);
+    sendDatagram(self, &outStream);
+
+    return 0;
+}
+
+typedef struct NimbleLoopbackCachedGameState {
+    size_t segmentCount;
+    size_t octetCount;
+    size_t segmentOctetCount;
+    uint64_t segmentHashes[NIMBLE_CLIENT_GAME_STATE_CACHE_MAX_SEGMENT_COUNT];
+} NimbleLoopbackCachedGameState;
+
+static int readCachedGameState(FldInStream* inStream, NimbleLoopbackCachedGameState* cached)
+{
+    uint8_t segmentCount;
+    int err = fldInStreamReadUInt8(inStream, &segmentCount);
+    if (err < 0) {
+        return err;
+    }
+    cached->segmentCount = segmentCount;
+    if (segmentCount == 0) {
+        return 0;
+    }
+    if (segmentCount > NIMBLE_CLIENT_GAME_STATE_CACHE_MAX_SEGMENT_COUNT) {
+        return -2;
+    }
+
+    uint32_t octetCount;
+    fldInStreamReadUInt32(inStream, &octetCount);
+    cached->octetCount = octetCount;
+    uint32_t segmentOctetCount;
+    err = fldInStreamReadUInt32(inStream, &segmentOctetCount);
+    if (err < 0) {
+        return err;
+    }
+    if (segmentOctetCount == 0) {
+        return -3;
+    }
+    cached->segmentOctetCount = segmentOctetCount;
+
+    for (size_t i = 0; i < segmentCount; ++i) {
+        err = fldInStreamReadUInt64(inStream, &cached->segmentHashes[i]);
+        if (err < 0) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+/// Copies the segments of the game state that do not match the hashes of the client into the snapshot
+static void takeDeltaSnapshot(NimbleLoopbackServer* self, const NimbleLoopbackCachedGameState* cached)
+{
+    size_t snapshotOctetCount = 0;
+    size_t segmentIndex = 0;
+    uint64_t changedSegmentMask = 0;
+
+    for (size_t offset = 0; offset < self->gameStateOctetCount; offset += cached->segmentOctetCount) {
+        size_t segmentOctetCount = self->gameStateOctetCount - offset;
+        if (segmentOctetCount > cached->segmentOctetCount) {
+            segmentOctetCount = cached->segmentOctetCount;
+        }
+
+        bool isSent = true;
+        if (segmentIndex < cached->segmentCount) {
+            uint64_t hash = nimbleClientGameStateHash(self->gameState + offset, segmentOctetCount);
+            isSent = hash != cached->segmentHashes[segmentIndex];
+            if (isSent) {
+                changedSegmentMask |= 1ULL << segmentIndex;
+            }
+        }
+
+        if (isSent) {
+            tc_memcpy_octets(self->snapshot + snapshotOctetCount, self->gameState + offset, segmentOctetCount);
+            snapshotOctetCount += segmentOctetCount;
+        }
+        segmentIndex++;
+    }
+
+    if (snapshotOctetCount == 0) {
+        // A blob stream can not be empty, so the first segment is sent even if nothing has changed
+        snapshotOctetCount = cached->segmentOctetCount < self->gameStateOctetCount ? cached->segmentOctetCount
+                                                                                   : self->gameStateOctetCount;
+        tc_memcpy_octets(self->snapshot, self->gameState, snapshotOctetCount);
+        changedSegmentMask |= 1U;
+    }
+
+    self->snapshotOctetCount = snapshotOctetCount;
+    self->snapshotIsDelta = true;
+    self->changedSegmentMask = changedSegmentMask;
+}
+
+/// Takes a snapshot of the game state, or only of the changed parts if the client has a cached game state,
+/// and compresses it if the client accepts that. The game state keeps changing while the snapshot is sent.
+static void prepareGameStateBlob(NimbleLoopbackServer* self, bool acceptsLz,
+                                 const NimbleLoopbackCachedGameState* cached)
+{
+    if (cached->segmentCount > 0) {
+        takeDeltaSnapshot(self, cached);
+    } else {
+        tc_memcpy_octets(self->snapshot, self->gameState, self->gameStateOctetCount);
+        self->snapshotOctetCount = self->gameStateOctetCount;
+        self->snapshotIsDelta = false;
+        self->changedSegmentMask = 0;
+    }
+
+    self->codec = NimbleClientGameStateCodecNone;
+    self->blob = self->snapshot;
+    self->blobOctetCount = self->snapshotOctetCount;
+
+    if (acceptsLz) {
+        ssize_t compressedOctetCount = nimbleClientGameStateEncode(
+            self->snapshot, self->snapshotOctetCount, self->compressedSnapshot, self->compressedSnapshotCapacity);
+        CLOG_ASSERT(compressedOctetCount >= 0, "could not compress game state")
+        self->codec = NimbleClientGameStateCodecLz;
+        self->blob = self->compressedSnapshot;
+        self->blobOctetCount = (size_t) compressedOctetCount;
+    }
+}
+
+static int onDownloadGameStateRequest(NimbleLoopbackServer* self, FldInStream* inStream)
+{
+    uint8_t clientRequestId;
+    fldInStreamReadUInt8(inStream, &clientRequestId);
+    uint8_t requestedOptions = 0;
+    if (inStream->pos < inStream->size) {
+        fldInStreamReadUInt8(inStream, &requestedOptions);
+    }
+    NimbleLoopbackCachedGameState cached;
+    cached.segmentCount = 0;
+    if ((requestedOptions & NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_DELTA) != 0) {
+        int err = readCachedGameState(inStream, &cached);
+        if (err < 0) {
+            return err;
+        }
+    }
+
+    // A new request id means that the client wants the game state again, e.g. after a rejoin
+    bool isNewRequest = self->phase != NimbleLoopbackServerPhaseSendingState ||
+                        clientRequestId != self->downloadClientRequestId;
+    if (isNewRequest) {
+        prepareGameStateBlob(self, (requestedOptions & NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_LZ) != 0, &cached);
+        self->downloadClientRequestId = clientRequestId;
+        self->stateId = self->authoritativeSteps.expectedWriteId;
+        self->channelId++;
+        if (self->blobStreamIsAllocated) {
+            blobStreamOutDestroy(&self->blobStreamOut);
+        }
+        blobStreamOutInit(&self->blobStreamOut, self->memory, self->blobAllocator, self->blob, self->blobOctetCount,
+                          NIMBLE_CLIENT_GAME_STATE_CHUNK_SIZE, self->log);
+        blobStreamLogicOutInit(&self->blobStreamLogicOut, &self->blobStreamOut);
+        self->blobStreamIsAllocated = true;
+        self->clientWaitingForStepId = self->stateId;
+        self->phase = NimbleLoopbackServerPhaseSendingState;
+        CLOG_C_DEBUG(&self->log, "start sending game state %08X on channel %04X (%zu octets, delta: %d)",
+                     self->stateId, self->channelId, self->blobOctetCount, self->snapshotIsDelta)
+    }
+
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    FldOutStream outStream;
+    prepareDatagram(self, &outStream, buf, NimbleSerializeCmdGameStateResponse);
+    fldOutStreamWriteUInt8(&outStream, clientRequestId);
+    nimbleSerializeOutStateId(&outStream, self->stateId);
+    nimbleSerializeOutBlobStreamChannelId(&outStream, self->channelId);
+    uint8_t options = requestedOptions & NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_OCTET_COUNT;
+    if (self->codec == NimbleClientGameStateCodecLz) {
+        options |= NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_LZ;
+    }
+    if (self->snapshotIsDelta) {
+        options |= NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_DELTA;
+    }
+    fldOutStreamWriteUInt8(&outStream, options);
+    if ((options & NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_OCTET_COUNT) != 0) {
+        fldOutStreamWriteUInt32(&outStream, (uint32_t) self->blobOctetCount);
+    }
+    if ((options & NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_LZ) != 0) {
+        fldOutStreamWriteUInt32(&outStream, (uint32_t) self->snapshotOctetCount);
+    }
+    if ((options & NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_DELTA) != 0) {
+        fldOutStreamWriteUInt32(&outStream, (uint32_t) self->gameStateOctetCount);
+        fldOutStreamWriteUInt64(&outStream, self->changedSegmentMask);
+    }
+    sendDatagram(self, &outStream);
+
+    return 0;
+}
+
+static int sendGameStateChunks(NimbleLoopbackServer* self, MonotonicTimeMs now);
+
+static int onBlobStreamAck(NimbleLoopbackServer* self, FldInStream* inStream)
+{
+    if (self->phase != NimbleLoopbackServerPhaseSendingState) {
+        return 0;
+    }
+
+    int err = blobStreamLogicOutReceive(&self->blobStreamLogicOut, inStream);
+    if (err < 0) {
+        return err;
+    }
+
+    // Like a real server, the send window is refilled as soon as the client acks, not on the next tick
+    if (blobStreamLogicOutIsComplete(&self->blobStreamLogicOut)) {
+        return 0;
+    }
+
+    return sendGameStateChunks(self, self->now);
+}
+
+static int onGameStep(NimbleLoopbackServer* self, FldInStream* inStream)
+{
+    StepId waitingForStepId;
+    uint64_t receiveMask;
+    int err = nbsPendingStepsInSerializeHeader(inStream, &waitingForStepId, &receiveMask);
+    if (err < 0) {
+        return err;
+    }
+    self->clientWaitingForStepId = waitingForStepId;
+
+    StepId firstPredictedStepId;
+    size_t predictedStepCount;
+    err = nbsStepsInSerializeHeader(inStream, &firstPredictedStepId, &predictedStepCount);
+    if (err < 0) {
+        return err;
+    }
+
+    if (predictedStepCount > 0) {
+        self->lastReceivedPredictedStepId = firstPredictedStepId + (StepId) predictedStepCount - 1;
+    }
+
+    // The loopback server does not need the predicted step payloads, only the header information
+    return 0;
+}
+
+static int handleCommand(NimbleLoopbackServer* self, uint8_t cmd, FldInStream* inStream)
+{
+    switch (cmd) {
+        case NimbleSerializeCmdConnectRequest:
+            return onConnectRequest(self, inStream);
+        case NimbleSerializeCmdJoinGameRequest:
+            return onJoinGameRequest(self, inStream);
+        case NimbleSerializeCmdDownloadGameStateRequest:
+            return onDownloadGameStateRequest(self, inStream);
+        case NimbleSerializeCmdClientOutBlobStream:
+            return onBlobStreamAck(self, inStream);
+        case NimbleSerializeCmdGameStep:
+            return onGameStep(self, inStream);
+        default:
+            CLOG_C_SOFT_ERROR(&self->log, "loopback server: unknown command %02X", cmd)
+            return -1;
+    }
+}
+
+static int readAndHandleCommand(NimbleLoopbackServer* self, FldInStream* inStream)
+{
+    uint8_t cmd;
+    int err = fldInStreamReadUInt8(inStream, &cmd);
+    if (err < 0) {
+        return err;
+    }
+
+    return handleCommand(self, cmd, inStream);
+}
+
+static int feedWithDebugInfo(NimbleLoopbackServer* self, const uint8_t* data, size_t octetCount, bool readDebugInfo)
+{
+    FldInStream inStream;
+    fldInStreamInit(&inStream, data, octetCount);
+    inStream.readDebugInfo = readDebugInfo;
+
+    int delta = orderedDatagramInLogicReceive(&self->orderedDatagramIn, &inStream);
+    if (delta <= 0) {
+        return 0;
+    }
+
+    int err = fldInStreamReadUInt16(&inStream, &self->lastClientTimeLowerBits);
+    if (err < 0) {
+        return err;
+    }
+
+    uint8_t cmd;
+    err = fldInStreamReadUInt8(&inStream, &cmd);
+    if (err < 0) {
+        return err;
+    }
+
+    if (cmd != NIMBLE_CLIENT_DATAGRAM_COMMAND_LIST) {
+        return handleCommand(self, cmd, &inStream);
+    }
+
+    // Packed datagrams have the control commands first and the game step command last
+    while (inStream.pos < inStream.size) {
+        FldInStream commandStream;
+        err = nimbleClientDatagramCommandRead(&inStream, &commandStream);
+        if (err < 0) {
+            return err;
+        }
+
+        err = readAndHandleCommand(self, &commandStream);
+        if (err < 0) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+/// Feeds a datagram sent from the client to the loopback server
+/// @param self loopback server
+/// @param data datagram octets
+/// @param octetCount number of octets in data
+/// @return negative on error
+int nimbleLoopbackServerFeed(NimbleLoopbackServer* self, const uint8_t* data, size_t octetCount)
+{
+    self->stats.datagramsFromClient++;
+    self->stats.octetsFromClient += octetCount;
+
+    bool readDebugInfo = wireUsesDebugInfo(self);
+    OrderedDatagramInLogic orderedDatagramInBefore = self->orderedDatagramIn;
+
+    int err = feedWithDebugInfo(self, data, octetCount, readDebugInfo);
+    if (err < 0 && !readDebugInfo) {
+        // Most likely a connect request that the client resent before it received the connect response
+        self->orderedDatagramIn = orderedDatagramInBefore;
+        err = feedWithDebugInfo(self, data, octetCount, true);
+    }
+
+    return err;
+}
+
+static int composeAuthoritativeStep(NimbleLoopbackServer* self)
+{
+    StepId stepId = self->authoritativeSteps.expectedWriteId;
+
+    NimbleStepsOutSerializeLocalParticipants participants;
+    uint8_t payload[NIMBLE_LOOPBACK_STEP_PAYLOAD_OCTET_COUNT];
+    payload[0] = (uint8_t) (stepId & 0xff);
+    payload[1] = (uint8_t) ((stepId >> 8) & 0xff);
+    payload[2] = (uint8_t) ((stepId >> 16) & 0xff);
+    payload[3] = (uint8_t) ((stepId >> 24) & 0xff);
+
+    participants.participantCount = self->participantCount;
+    for (size_t i = 0; i < self->participantCount; ++i) {
+        participants.participants[i].participantId = self->participantIds[i];
+        participants.participants[i].payload = payload;
+        participants.participants[i].payloadCount = NIMBLE_LOOPBACK_STEP_PAYLOAD_OCTET_COUNT;
+    }
+
+    uint8_t combinedStep[256];
+    ssize_t octetCount = nbsStepsOutSerializeCombinedStep(&participants, combinedStep, sizeof(combinedStep));
+    if (octetCount < 0) {
+        return (int) octetCount;
+    }
+
+    // Keep the step window small, the client only ever asks for recent steps
+    StepId discardUpTo = self->clientWaitingForStepId;
+    if (discardUpTo == NIMBLE_STEP_MAX) {
+        discardUpTo = stepId > 8 ? stepId - 8 : 0;
+    }
+    if (discardUpTo > self->authoritativeSteps.expectedReadId) {
+        nbsStepsDiscardUpTo(&self->authoritativeSteps, discardUpTo);
+    }
+
+    // Like in most games, only a small part of the game state changes from step to step
+    size_t changingOctetCount = self->gameStateOctetCount < NIMBLE_LOOPBACK_CHANGING_GAME_STATE_OCTET_COUNT
+                                    ? self->gameStateOctetCount
+                                    : NIMBLE_LOOPBACK_CHANGING_GAME_STATE_OCTET_COUNT;
+    if (changingOctetCount > 0) {
+        self->gameState[((size_t) stepId * 13U) % changingOctetCount] ^= 0x5a;
+    }
+
+    self->stats.authoritativeStepsComposed++;
+
+    return nbsStepsWrite(&self->authoritativeSteps, stepId, combinedStep, (size_t) octetCount);
+}
+
+static int sendGameStepResponse(NimbleLoopbackServer* self)
+{
+    StepId startId = self->clientWaitingForStepId;
+    if (startId < self->authoritativeSteps.expectedReadId) {
+        startId = self->authoritativeSteps.expectedReadId;
+    }
+
+    size_t availableCount = self->authoritativeSteps.expectedWriteId - startId;
+    if (availableCount > self->maximumStepsInResponse) {
+        availableCount = self->maximumStepsInResponse;
+    }
+
+    NbsPendingRange range;
+    range.startId = startId;
+    range.count = availableCount;
+
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    FldOutStream outStream;
+    prepareDatagram(self, &outStream, buf, NimbleSerializeCmdGameStepResponse);
+    fldOutStreamWriteUInt8(&outStream, 2);
+    fldOutStreamWriteInt8(&outStream, 0);
+    fldOutStreamWriteUInt32(&outStream, self->lastReceivedPredictedStepId);
+    int err = nbsPendingStepsSerializeOutRanges(&outStream, &self->authoritativeSteps, &range, 1);
+    if (err < 0) {
+        return err;
+    }
+
+    sendDatagram(self, &outStream);
+
+    return 0;
+}
+
+static int sendGameStateChunks(NimbleLoopbackServer* self, MonotonicTimeMs now)
+{
+    const BlobStreamOutEntry* entries[NIMBLE_LOOPBACK_MAX_BLOB_ENTRIES_PER_UPDATE];
+    int entriesCount = blobStreamLogicOutPrepareSend(&self->blobStreamLogicOut, now, entries,
+                                                     NIMBLE_LOOPBACK_MAX_BLOB_ENTRIES_PER_UPDATE);
+    if (entriesCount < 0) {
+        return entriesCount;
+    }
+
+    for (size_t i = 0; i < (size_t) entriesCount; ++i) {
+        uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+        FldOutStream outStream;
+        prepareDatagram(self, &outStream, buf, NimbleSerializeCmdServerOutBlobStream);
+        nimbleSerializeOutBlobStreamChannelId(&outStream, self->channelId);
+        int err = blobStreamLogicOutSendEntry(&outStream, entries[i]);
+        if (err < 0) {
+            return err;
+        }
+        sendDatagram(self, &outStream);
+    }
+
+    return 0;
+}
+
+/// Advances the simulated server one tick
+/// Composes a new authoritative step and sends the responses that the server would send on a tick.
+/// @param self loopback server
+/// @param now current time
+/// @return negative on error
+int nimbleLoopbackServerUpdate(NimbleLoopbackServer* self, MonotonicTimeMs now)
+{
+    self->now = now;
+
+    int err = composeAuthoritativeStep(self);
+    if (err < 0) {
+        return err;
+    }
+
+    if (self->phase != NimbleLoopbackServerPhaseSendingState) {
+        return 0;
+    }
+
+    if (!blobStreamLogicOutIsComplete(&self->blobStreamLogicOut)) {
+        return sendGameStateChunks(self, now);
+    }
+
+    return sendGameStepResponse(self);
+}
+
+static int clientSendToServer(void* _self, const uint8_t* data, size_t size)
+{
+    NimbleLoopbackServer* self = (NimbleLoopbackServer*) _self;
+
+    int err = nimbleLoopbackServerFeed(self, data, size);
+    if (err < 0) {
+        return err;
+    }
+
+    return (int) size;
+}
+
+static ssize_t clientReceiveFromServer(void* _self, uint8_t* data, size_t size)
+{
+    NimbleLoopbackServer* self = (NimbleLoopbackServer*) _self;
+
+    self->stats.clientReceiveCallCount++;
+
+    return queuePop(&self->toClient, data, size);
+}
+
+static ssize_t clientReceiveBatchFromServer(void* _self, uint8_t* datagrams, size_t datagramOctetSize,
+                                            size_t* octetCounts, size_t maxDatagramCount)
+{
+    NimbleLoopbackServer* self = (NimbleLoopbackServer*) _self;
+
+    self->stats.clientReceiveCallCount++;
+
+    size_t count = 0;
+    for (; count < maxDatagramCount; ++count) {
+        ssize_t octetCount = queuePop(&self->toClient, &datagrams[count * datagramOctetSize], datagramOctetSize);
+        if (octetCount < 0) {
+            return octetCount;
+        }
+        if (octetCount == 0) {
+            break;
+        }
+        octetCounts[count] = (size_t) octetCount;
+    }
+
+    return (ssize_t) count;
+}
+
+static ssize_t clientLendFromServer(void* _self, const uint8_t** octets)
+{
+    NimbleLoopbackServer* self = (NimbleLoopbackServer*) _self;
+
+    self->stats.clientReceiveCallCount++;
+
+    return queuePeek(&self->toClient, octets);
+}
+
+static void clientReleaseToServer(void* _self)
+{
+    NimbleLoopbackServer* self = (NimbleLoopbackServer*) _self;
+
+    queueDiscard(&self->toClient);
+}
+
+/// Creates a datagram transport for the client that sends to and receives from the loopback server
+/// @param self loopback server
+/// @return datagram transport to use for the nimble client
+DatagramTransport nimbleLoopbackServerClientTransport(NimbleLoopbackServer* self)
+{
+    DatagramTransport transport;
+
+    transport.self = self;
+    transport.send = clientSendToServer;
+    transport.receive = clientReceiveFromServer;
+
+    return transport;
+}
+
+/// Creates the batch receive extension for the client transport
+/// @param self loopback server
+/// @return batch receive extension
+NimbleClientTransportBatch nimbleLoopbackServerClientTransportBatch(NimbleLoopbackServer* self)
+{
+    NimbleClientTransportBatch batch;
+
+    batch.self = self;
+    batch.receiveBatch = clientReceiveBatchFromServer;
+
+    return batch;
+}
+
+/// Creates the lend extension for the client transport, the client parses straight from the queue slots
+/// @param self loopback server
+/// @return lend extension
+NimbleClientTransportLend nimbleLoopbackServerClientTransportLend(NimbleLoopbackServer* self)
+{
+    NimbleClientTransportLend lend;
+
+    lend.self = self;
+    lend.lend = clientLendFromServer;
+    lend.release = clientReleaseToServer;
+
+    return lend;
+}
+
+/// Initializes the loopback server
+/// @param self loopback server
+/// @param memory tag allocator
+/// @param blobAllocator allocator with free
+/// @param gameStateOctetCount octet count of the (generated) game state that is sent on join
+/// @param queueCapacity number of datagrams to the client that can be waiting, e.g.
+/// NIMBLE_LOOPBACK_DATAGRAM_QUEUE_CAPACITY
+/// @param log logging target
+void nimbleLoopbackServerInit(NimbleLoopbackServer* self, struct ImprintAllocator* memory,
+                              struct ImprintAllocatorWithFree* blobAllocator, size_t gameStateOctetCount,
+                              size_t queueCapacity, Clog log)
+{
+    self->log = log;
+    self->memory = memory;
+    self->blobAllocator = blobAllocator;
+    self->phase = NimbleLoopbackServerPhaseWaitingForConnect;
+    self->now = 0;
+    self->connectionId = 1;
+    self->useDebugStreams = false;
+    self->participantCount = 0;
+    self->nextParticipantId = 1;
+    self->channelId = 0;
+    self->stateId = 0;
+    self->blobStreamIsAllocated = false;
+    self->clientWaitingForStepId = NIMBLE_STEP_MAX;
+    self->lastReceivedPredictedStepId = NIMBLE_STEP_MAX;
+    self->maximumStepsInResponse = NimbleSerializeMaxRedundancyCount + 1;
+    self->lastClientTimeLowerBits = 0;
+    tc_mem_clear_type(&self->stats);
+
+    queueInit(&self->toClient, memory, queueCapacity);
+    orderedDatagramOutLogicInit(&self->orderedDatagramOut);
+    orderedDatagramInLogicInit(&self->orderedDatagramIn);
+
+    self->gameStateOctetCount = gameStateOctetCount;
+    self->gameState = IMPRINT_ALLOC((ImprintAllocator*) blobAllocator, gameStateOctetCount, "loopback game state");
+    for (size_t i = 0; i < gameStateOctetCount; ++i) {
+        self->gameState[i] = (uint8_t) (i * 31U);
+    }
+
+    self->snapshot = IMPRINT_ALLOC((ImprintAllocator*) blobAllocator, gameStateOctetCount, "loopback snapshot");
+    self->snapshotOctetCount = 0;
+    self->snapshotIsDelta = false;
+    self->changedSegmentMask = 0;
+    self->compressedSnapshotCapacity = nimbleClientGameStateEncodeMaxOctetCount(gameStateOctetCount);
+    self->compressedSnapshot = IMPRINT_ALLOC((ImprintAllocator*) blobAllocator, self->compressedSnapshotCapacity,
+                                             "loopback compressed snapshot");
+    self->codec = NimbleClientGameStateCodecNone;
+    self->blob = 0;
+    self->blobOctetCount = 0;
+    self->downloadClientRequestId = 0;
+
+    size_t combinedStepOctetCount = nbsStepsOutSerializeCalculateCombinedSize(NIMBLE_LOOPBACK_MAX_PARTICIPANTS,
+                                                                              NIMBLE_LOOPBACK_STEP_PAYLOAD_OCTET_COUNT);
+    nbsStepsInit(&self->authoritativeSteps, memory, combinedStepOctetCount, log);
+    nbsStepsReInit(&self->authoritativeSteps, 0);
+}
+
+/// Frees the memory allocated by the loopback server
+/// @param self loopback server
+void nimbleLoopbackServerDestroy(NimbleLoopbackServer* self)
+{
+    if (self->blobStreamIsAllocated) {
+        blobStreamOutDestroy(&self->blobStreamOut);
+        self->blobStreamIsAllocated = false;
+    }
+    IMPRINT_FREE(self->blobAllocator, self->gameState);
+    self->gameState = 0;
+    IMPRINT_FREE(self->blobAllocator, self->snapshot);
+    self->snapshot = 0;
+    IMPRINT_FREE(self->blobAllocator, self->compressedSnapshot);
+    self->compressedSnapshot = 0;
+}
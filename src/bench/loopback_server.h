@@ -0,0 +1,120 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_BENCH_LOOPBACK_SERVER_H
+#define NIMBLE_CLIENT_BENCH_LOOPBACK_SERVER_H
+
+#include <blob-stream/blob_stream_logic_out.h>
+#include <clog/clog.h>
+#include <datagram-transport/transport.h>
+#include <datagram-transport/types.h>
+#include <monotonic-time/lower_bits.h>
+#include <nimble-client/game_state_cache.h>
+#include <nimble-client/game_state_codec.h>
+#include <nimble-client/transport_batch.h>
+#include <nimble-client/transport_lend.h>
+#include <nimble-serialize/types.h>
+#include <nimble-steps/steps.h>
+#include <ordered-datagram/in_logic.h>
+#include <ordered-datagram/out_logic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ImprintAllocator;
+struct ImprintAllocatorWithFree;
+
+#define NIMBLE_LOOPBACK_DATAGRAM_QUEUE_CAPACITY (128)
+#define NIMBLE_LOOPBACK_MAX_PARTICIPANTS (8)
+
+typedef struct NimbleLoopbackDatagram {
+    uint8_t octets[DATAGRAM_TRANSPORT_MAX_SIZE];
+    size_t octetCount;
+} NimbleLoopbackDatagram;
+
+/// Fixed size in-memory datagram queue. Behaves like a UDP socket buffer: datagrams are dropped when it is full.
+typedef struct NimbleLoopbackDatagramQueue {
+    NimbleLoopbackDatagram* datagrams;
+    size_t capacity;
+    size_t readIndex;
+    size_t writeIndex;
+    size_t count;
+    size_t droppedCount;
+} NimbleLoopbackDatagramQueue;
+
+typedef enum NimbleLoopbackServerPhase {
+    NimbleLoopbackServerPhaseWaitingForConnect,
+    NimbleLoopbackServerPhaseConnected,
+    NimbleLoopbackServerPhaseSendingState,
+} NimbleLoopbackServerPhase;
+
+typedef struct NimbleLoopbackServerStats {
+    size_t datagramsFromClient;
+    size_t datagramsToClient;
+    size_t octetsFromClient;
+    size_t octetsToClient;
+    size_t authoritativeStepsComposed;
+    size_t clientReceiveCallCount;
+} NimbleLoopbackServerStats;
+
+/// A minimal stand-in for a Nimble Server that lives in the same process as the client.
+/// It answers connect, join game, download game state and game step requests, so the complete
+/// client lifecycle can be exercised without sockets.
+typedef struct NimbleLoopbackServer {
+    NimbleLoopbackServerPhase phase;
+    NimbleLoopbackDatagramQueue toClient;
+    MonotonicTimeMs now;
+
+    OrderedDatagramOutLogic orderedDatagramOut;
+    OrderedDatagramInLogic orderedDatagramIn;
+    MonotonicTimeLowerBitsMs lastClientTimeLowerBits;
+
+    uint8_t connectionId;
+    bool useDebugStreams;
+
+    NimbleSerializeParticipantId participantIds[NIMBLE_LOOPBACK_MAX_PARTICIPANTS];
+    size_t participantCount;
+    NimbleSerializeParticipantId nextParticipantId;
+
+    uint8_t* gameState;
+    size_t gameStateOctetCount;
+    uint8_t* snapshot;
+    size_t snapshotOctetCount;
+    bool snapshotIsDelta;
+    uint64_t changedSegmentMask;
+    uint8_t* compressedSnapshot;
+    size_t compressedSnapshotCapacity;
+    NimbleClientGameStateCodec codec;
+    const uint8_t* blob;
+    size_t blobOctetCount;
+    uint8_t downloadClientRequestId;
+    StepId stateId;
+    NimbleSerializeBlobStreamChannelId channelId;
+    BlobStreamOut blobStreamOut;
+    BlobStreamLogicOut blobStreamLogicOut;
+    bool blobStreamIsAllocated;
+
+    NbsSteps authoritativeSteps;
+    StepId clientWaitingForStepId;
+    StepId lastReceivedPredictedStepId;
+    size_t maximumStepsInResponse;
+
+    struct ImprintAllocator* memory;
+    struct ImprintAllocatorWithFree* blobAllocator;
+
+    NimbleLoopbackServerStats stats;
+    Clog log;
+} NimbleLoopbackServer;
+
+void nimbleLoopbackServerInit(NimbleLoopbackServer* self, struct ImprintAllocator* memory,
+                              struct ImprintAllocatorWithFree* blobAllocator, size_t gameStateOctetCount,
+                              size_t queueCapacity, Clog log);
+void nimbleLoopbackServerDestroy(NimbleLoopbackServer* self);
+int nimbleLoopbackServerUpdate(NimbleLoopbackServer* self, MonotonicTimeMs now);
+int nimbleLoopbackServerFeed(NimbleLoopbackServer* self, const uint8_t* data, size_t octetCount);
+DatagramTransport nimbleLoopbackServerClientTransport(NimbleLoopbackServer* self);
+NimbleClientTransportBatch nimbleLoopbackServerClientTransportBatch(NimbleLoopbackServer* self);
+NimbleClientTransportLend nimbleLoopbackServerClientTransportLend(NimbleLoopbackServer* self);
+
+#endif
@@ -0,0 +1,99 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "loopback_shared_transport.h"
+#include "loopback_server.h"
+#include <nimble-client/pool.h>
+
+static int sharedSendToServer(void* _self, const uint8_t* data, size_t size)
+{
+    NimbleLoopbackSharedTransport* self = (NimbleLoopbackSharedTransport*) _self;
+
+    self->stats.datagramsFromClients++;
+
+    if (size <= NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT) {
+        self->stats.droppedDatagramCount++;
+        return (int) size;
+    }
+
+    NimbleClientPoolConnectionId connectionId = (NimbleClientPoolConnectionId) ((data[0] << 8) | data[1]);
+    size_t serverIndex = (size_t) connectionId - 1;
+    if (connectionId == 0 || serverIndex >= self->serverCount) {
+        // Like a server socket, datagrams from unknown connections are dropped
+        self->stats.droppedDatagramCount++;
+        return (int) size;
+    }
+
+    int err = nimbleLoopbackServerFeed(&self->servers[serverIndex],
+                                       data + NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT,
+                                       size - NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT);
+    if (err < 0) {
+        return err;
+    }
+
+    return (int) size;
+}
+
+static ssize_t sharedReceiveFromServer(void* _self, uint8_t* data, size_t size)
+{
+    NimbleLoopbackSharedTransport* self = (NimbleLoopbackSharedTransport*) _self;
+
+    if (size <= NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT) {
+        return -1;
+    }
+
+    // Takes from the server that was last read from first, and then goes round the others
+    for (size_t i = 0; i < self->serverCount; ++i) {
+        size_t serverIndex = (self->nextServerIndex + i) % self->serverCount;
+        DatagramTransport serverTransport = nimbleLoopbackServerClientTransport(&self->servers[serverIndex]);
+        ssize_t octetCount = datagramTransportReceive(&serverTransport,
+                                                      data + NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT,
+                                                      size - NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT);
+        if (octetCount < 0) {
+            return octetCount;
+        }
+        if (octetCount == 0) {
+            continue;
+        }
+
+        NimbleClientPoolConnectionId connectionId = (NimbleClientPoolConnectionId) (serverIndex + 1);
+        data[0] = (uint8_t) (connectionId >> 8);
+        data[1] = (uint8_t) (connectionId & 0xff);
+        self->nextServerIndex = serverIndex;
+        self->stats.datagramsToClients++;
+
+        return NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT + octetCount;
+    }
+
+    return 0;
+}
+
+/// Initializes the shared transport
+/// @param self shared transport
+/// @param servers loopback servers, one for each client on the shared transport
+/// @param serverCount number of servers
+void nimbleLoopbackSharedTransportInit(NimbleLoopbackSharedTransport* self, struct NimbleLoopbackServer* servers,
+                                       size_t serverCount)
+{
+    self->servers = servers;
+    self->serverCount = serverCount;
+    self->nextServerIndex = 0;
+    self->stats.datagramsFromClients = 0;
+    self->stats.datagramsToClients = 0;
+    self->stats.droppedDatagramCount = 0;
+}
+
+/// Creates the datagram transport that the client pool shares between its clients
+/// @param self shared transport
+/// @return datagram transport to use as the NimbleClientPoolSettings sharedTransport
+DatagramTransport nimbleLoopbackSharedTransportTransport(NimbleLoopbackSharedTransport* self)
+{
+    DatagramTransport transport;
+
+    transport.self = self;
+    transport.send = sharedSendToServer;
+    transport.receive = sharedReceiveFromServer;
+
+    return transport;
+}
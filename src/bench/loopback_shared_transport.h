@@ -0,0 +1,34 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_BENCH_LOOPBACK_SHARED_TRANSPORT_H
+#define NIMBLE_CLIENT_BENCH_LOOPBACK_SHARED_TRANSPORT_H
+
+#include <datagram-transport/transport.h>
+#include <stddef.h>
+
+struct NimbleLoopbackServer;
+
+typedef struct NimbleLoopbackSharedTransportStats {
+    size_t datagramsFromClients;
+    size_t datagramsToClients;
+    size_t droppedDatagramCount;
+} NimbleLoopbackSharedTransportStats;
+
+/// The server half of a transport that is shared by the clients of a NimbleClientPool, like one UDP socket that
+/// all the clients send from. Datagrams from the clients are routed to a loopback server by the connection id in
+/// front of them, and the datagrams from a loopback server get the connection id of its client put back in front.
+/// Connection id N belongs to servers[N - 1], which is the order that the pool hands out the connection ids in.
+typedef struct NimbleLoopbackSharedTransport {
+    struct NimbleLoopbackServer* servers;
+    size_t serverCount;
+    size_t nextServerIndex;
+    NimbleLoopbackSharedTransportStats stats;
+} NimbleLoopbackSharedTransport;
+
+void nimbleLoopbackSharedTransportInit(NimbleLoopbackSharedTransport* self, struct NimbleLoopbackServer* servers,
+                                       size_t serverCount);
+DatagramTransport nimbleLoopbackSharedTransportTransport(NimbleLoopbackSharedTransport* self);
+
+#endif
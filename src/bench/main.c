@@ -0,0 +1,580 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "common.h"
+#include "impaired_transport.h"
+#include "loopback_server.h"
+#include <clog/console.h>
+#include <imprint/allocator.h>
+#include <imprint/default_setup.h>
+#include <nimble-client/client.h>
+#include <nimble-client/network_realizer.h>
+#include <nimble-client/utils.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+clog_config g_clog;
+
+typedef struct BenchOptions {
+    size_t syncedTickCount;
+    size_t gameStateOctetCount;
+    const NimbleImpairedLinkSettings* link;
+    uint64_t seed;
+    bool useBatchReceive;
+    bool useLentReceive;
+    bool useReceiveTimestamps;
+    bool usePackedDatagrams;
+    bool flushSteps;
+    bool useDebugStreams;
+    bool streamGameState;
+    bool compressGameState;
+    bool measureDownload;
+    bool usePipelinedJoin;
+    bool rejoin;
+    bool useDeltaResync;
+    bool useArena;
+    bool useStats;
+    size_t tickDurationUs;
+    size_t predictionPercentile;
+    MonotonicTimeMs predictionSafetyMarginMs;
+    size_t ackChunkWindow;
+    MonotonicTimeMs ackIntervalMs;
+} BenchOptions;
+
+typedef struct BenchResult {
+    size_t tickDurationUs;
+    bool disconnected;
+    size_t updateCount;
+    uint64_t updateNs;
+    size_t ticksToSynced;
+    uint64_t wallNsToSynced;
+    size_t datagramCount;
+    size_t octetCount;
+    size_t datagramsFromClient;
+    size_t octetsFromClient;
+    size_t datagramsToClient;
+    size_t octetsToClient;
+    size_t receiveCallCount;
+    size_t stepsReceived;
+    size_t gameStateChunkCount;
+    size_t gameStateStreamedOctetCount;
+    size_t predictionSampleCount;
+    size_t predictionTickCountSum;
+    size_t predictionTickCountMin;
+    size_t predictionTickCountMax;
+    size_t serverStepEstimateSampleCount;
+    size_t serverStepEstimateErrorSum;
+    size_t serverStepEstimateErrorMax;
+    int latencyAvgMs;
+    uint8_t qualityRating;
+    NimbleImpairedDirectionStats linkOut;
+    NimbleImpairedDirectionStats linkIn;
+    bool downloadStarted;
+    MonotonicTimeMs downloadStartMs;
+    MonotonicTimeMs downloadEndMs;
+    size_t downloadOctetCount;
+    bool rejoined;
+    size_t rejoinStartTick;
+    size_t rejoinTickCount;
+    size_t rejoinStartOctetsToClient;
+    size_t rejoinOctetsToClient;
+    size_t arenaOctetCount;
+} BenchResult;
+
+static void benchReceiveGameStateChunk(void* _self, StepId stateId, size_t offset, const uint8_t* octets,
+                                       size_t octetCount, size_t totalOctetCount)
+{
+    BenchResult* result = (BenchResult*) _self;
+    (void) stateId;
+    (void) offset;
+    (void) octets;
+    (void) totalOctetCount;
+
+    result->gameStateChunkCount++;
+    result->gameStateStreamedOctetCount += octetCount;
+}
+
+static void trackDownload(const NimbleClient* client, MonotonicTimeMs now, BenchResult* result)
+{
+    if (client->state == NimbleClientStateJoiningDownloadingState && !result->downloadStarted) {
+        result->downloadStarted = true;
+        result->downloadStartMs = now;
+        result->downloadOctetCount = client->blobStreamIn.octetCount;
+    } else if (client->state == NimbleClientStateSynced && result->downloadStarted && result->downloadEndMs == 0) {
+        result->downloadEndMs = now;
+    }
+}
+
+/// Advances the virtual time to the next tick in steps of one millisecond and lets the client receive in between,
+/// like an application that waits on the socket. Game state chunks are then acked when they arrive.
+static void receiveUntilNextTick(NimbleClientRealize* realize, NimbleImpairedTransport* impairedTransport,
+                                 MonotonicTimeMs* now, MonotonicTimeMs nextTickAt, BenchResult* result)
+{
+    while (*now + 1 < nextTickAt) {
+        (*now)++;
+        if (impairedTransport != 0) {
+            nimbleImpairedTransportUpdate(impairedTransport);
+        }
+        nimbleClientRealizeReceive(realize, *now);
+        trackDownload(&realize->client, *now, result);
+    }
+    *now = nextTickAt;
+}
+
+/// Downloads the game state again halfway through the run, and measures how long it takes and how much is sent
+static void trackRejoin(NimbleClient* client, const NimbleLoopbackServer* server, size_t syncedTicks,
+                        size_t rejoinAtSyncedTick, size_t tick, BenchResult* result)
+{
+    if (!result->rejoined) {
+        if (syncedTicks == rejoinAtSyncedTick && client->state == NimbleClientStateSynced) {
+            nimbleClientReJoin(client);
+            result->rejoined = true;
+            result->rejoinStartTick = tick;
+            result->rejoinStartOctetsToClient = server->stats.octetsToClient;
+        }
+        return;
+    }
+
+    if (result->rejoinTickCount == 0 && client->state == NimbleClientStateSynced) {
+        result->rejoinTickCount = tick - result->rejoinStartTick;
+        result->rejoinOctetsToClient = server->stats.octetsToClient - result->rejoinStartOctetsToClient;
+    }
+}
+
+static void samplePrediction(const NimbleClient* client, BenchResult* result)
+{
+    StepId stepIdToSend;
+    size_t predictionTickCount;
+    if (!nimbleClientOptimalStepIdToSend(client, &stepIdToSend, &predictionTickCount)) {
+        return;
+    }
+
+    if (result->predictionSampleCount == 0 || predictionTickCount < result->predictionTickCountMin) {
+        result->predictionTickCountMin = predictionTickCount;
+    }
+    if (predictionTickCount > result->predictionTickCountMax) {
+        result->predictionTickCountMax = predictionTickCount;
+    }
+    result->predictionTickCountSum += predictionTickCount;
+    result->predictionSampleCount++;
+}
+
+static void sampleServerStepEstimate(const NimbleClient* client, const NimbleLoopbackServer* server,
+                                     MonotonicTimeMs now, BenchResult* result)
+{
+    StepId estimatedStepId;
+    if (!nimbleClientEstimatedServerStepId(client, now, &estimatedStepId)) {
+        return;
+    }
+
+    // The loopback server composed its latest step earlier in this tick
+    StepId serverStepId = server->authoritativeSteps.expectedWriteId - 1;
+    size_t error = estimatedStepId > serverStepId ? estimatedStepId - serverStepId : serverStepId - estimatedStepId;
+
+    if (error > result->serverStepEstimateErrorMax) {
+        result->serverStepEstimateErrorMax = error;
+    }
+    result->serverStepEstimateErrorSum += error;
+    result->serverStepEstimateSampleCount++;
+}
+
+static int runLifecycle(ImprintDefaultSetup* memory, const BenchOptions* options, BenchResult* result)
+{
+    Clog serverLog;
+    serverLog.config = &g_clog;
+    serverLog.constantPrefix = "server";
+
+    NimbleLoopbackServer server;
+    nimbleLoopbackServerInit(&server, &memory->tagAllocator.info, &memory->slabAllocator.info,
+                             options->gameStateOctetCount, NIMBLE_LOOPBACK_DATAGRAM_QUEUE_CAPACITY, serverLog);
+
+    MonotonicTimeMs now = 0;
+    NimbleClientClock virtualClock;
+    virtualClock.self = &now;
+    virtualClock.now = nimbleBenchVirtualClockNow;
+
+    NimbleImpairedTransport impairedTransport;
+    DatagramTransport transport = nimbleLoopbackServerClientTransport(&server);
+    if (options->link != 0) {
+        nimbleImpairedTransportInit(&impairedTransport, transport, virtualClock, options->link, options->link,
+                                    options->seed);
+        transport = nimbleImpairedTransportTransport(&impairedTransport);
+    }
+
+    NimbleClientRealizeSettings settings;
+    settings.memory = &memory->tagAllocator.info;
+    settings.blobMemory = &memory->slabAllocator.info;
+    settings.transport = transport;
+    settings.maximumSingleParticipantStepOctetCount = 16;
+    settings.maximumNumberOfParticipants = NIMBLE_LOOPBACK_MAX_PARTICIPANTS;
+    settings.maximumGameStateOctetCount = options->gameStateOctetCount;
+    settings.arena = 0;
+    settings.arenaOctetCount = 0;
+    if (options->useArena) {
+        settings.arenaOctetCount = nimbleClientMemoryRequirements(settings.maximumSingleParticipantStepOctetCount,
+                                                                  settings.maximumNumberOfParticipants,
+                                                                  settings.maximumGameStateOctetCount);
+        settings.arena = IMPRINT_ALLOC(&memory->tagAllocator.info, settings.arenaOctetCount, "client arena");
+    }
+    settings.applicationVersion.major = 0x10;
+    settings.applicationVersion.minor = 0x20;
+    settings.applicationVersion.patch = 0x30;
+    settings.wantsDebugStreams = options->useDebugStreams;
+    settings.log.config = &g_clog;
+    settings.log.constantPrefix = "client";
+
+    NimbleClientRealize clientRealize;
+    nimbleClientRealizeInit(&clientRealize, &settings);
+    nimbleClientSetClock(&clientRealize.client, virtualClock);
+    nimbleClientSetPackedDatagrams(&clientRealize.client, options->usePackedDatagrams);
+    nimbleClientSetStats(&clientRealize.client, options->useStats);
+    nimbleClientSetTickDuration(&clientRealize.client, options->tickDurationUs);
+    nimbleClientSetPredictionMargin(&clientRealize.client, options->predictionPercentile,
+                                    options->predictionSafetyMarginMs);
+    nimbleClientSetCompressedGameState(&clientRealize.client, options->compressGameState);
+    nimbleClientSetPipelinedJoin(&clientRealize.client, options->usePipelinedJoin);
+    nimbleClientSetDeltaResync(&clientRealize.client, options->useDeltaResync);
+    nimbleClientSetBlobStreamAckPacing(&clientRealize.client, options->ackChunkWindow, options->ackIntervalMs);
+    if (options->useBatchReceive && options->link == 0) {
+        nimbleClientSetTransportBatch(&clientRealize.client, nimbleLoopbackServerClientTransportBatch(&server));
+    }
+    if (options->useLentReceive && options->link == 0) {
+        nimbleClientSetTransportLend(&clientRealize.client, nimbleLoopbackServerClientTransportLend(&server));
+    }
+    if (options->useReceiveTimestamps && options->link != 0) {
+        // The client only reads at the ticks, so without them the round trip times include the wait for the tick
+        nimbleClientSetTransportTimestamp(&clientRealize.client, nimbleImpairedTransportTimestamp(&impairedTransport));
+    }
+    if (options->streamGameState) {
+        NimbleClientGameStateReceiver receiver;
+        receiver.self = result;
+        receiver.receiveChunk = benchReceiveGameStateChunk;
+        nimbleClientSetGameStateReceiver(&clientRealize.client, receiver);
+    }
+    nimbleClientRealizeReInit(&clientRealize, &settings);
+
+    NimbleSerializeJoinGameRequest joinGameRequest;
+    tc_mem_clear_type(&joinGameRequest);
+    joinGameRequest.playerCount = 1;
+    joinGameRequest.players[0].localIndex = 0xca;
+    nimbleClientRealizeJoinGame(&clientRealize, joinGameRequest);
+
+    tc_mem_clear_type(result);
+    result->arenaOctetCount = settings.arenaOctetCount;
+    result->tickDurationUs = options->tickDurationUs;
+
+    // The virtual clock is in milliseconds, the ticks are scheduled in microseconds like in the client
+    uint64_t nowUs = 0;
+    bool isSynced = false;
+    size_t tick = 0;
+    size_t syncedTicks = 0;
+    uint64_t startNs = nimbleBenchNowNs();
+
+    while (syncedTicks < options->syncedTickCount) {
+        if (!isSynced && tick >= BENCH_MAX_TICKS_TO_SYNC) {
+            fprintf(stderr, "client did not reach synced within %d ticks\n", BENCH_MAX_TICKS_TO_SYNC);
+            nimbleClientRealizeDestroy(&clientRealize);
+            nimbleLoopbackServerDestroy(&server);
+            return -1;
+        }
+
+        nowUs += options->tickDurationUs;
+        if (options->measureDownload) {
+            receiveUntilNextTick(&clientRealize, options->link != 0 ? &impairedTransport : 0, &now,
+                                 (MonotonicTimeMs) (nowUs / 1000U), result);
+        } else {
+            now = (MonotonicTimeMs) (nowUs / 1000U);
+        }
+        tick++;
+
+        if (options->link != 0) {
+            nimbleImpairedTransportUpdate(&impairedTransport);
+        }
+
+        int err = nimbleLoopbackServerUpdate(&server, now);
+        if (err < 0) {
+            fprintf(stderr, "loopback server failed: %d\n", err);
+            break;
+        }
+
+        if (isSynced && clientRealize.client.state == NimbleClientStateSynced) {
+            nimbleBenchWritePredictedStep(&clientRealize.client);
+            if (options->flushSteps) {
+                nimbleClientFlushSteps(&clientRealize.client);
+            }
+        }
+
+        uint64_t beforeNs = nimbleBenchNowNs();
+        nimbleClientRealizeUpdate(&clientRealize, now);
+        result->updateNs += nimbleBenchNowNs() - beforeNs;
+        result->updateCount++;
+
+        result->stepsReceived += nimbleBenchReadAuthoritativeSteps(&clientRealize.client);
+        trackDownload(&clientRealize.client, now, result);
+
+        if (!isSynced && clientRealize.state == NimbleClientRealizeStateSynced) {
+            isSynced = true;
+            result->ticksToSynced = tick;
+            result->wallNsToSynced = nimbleBenchNowNs() - startNs;
+            if (options->measureDownload) {
+                break;
+            }
+        }
+
+        if (clientRealize.state == NimbleClientRealizeStateDisconnected) {
+            result->disconnected = true;
+            break;
+        }
+
+        if (isSynced) {
+            samplePrediction(&clientRealize.client, result);
+            sampleServerStepEstimate(&clientRealize.client, &server, now, result);
+            syncedTicks++;
+        }
+
+        if (options->rejoin) {
+            trackRejoin(&clientRealize.client, &server, syncedTicks, options->syncedTickCount / 2, tick, result);
+        }
+    }
+
+    result->latencyAvgMs = clientRealize.client.latencyMsStat.avg;
+    result->qualityRating = clientRealize.client.quality.qualityRating;
+    if (options->link != 0) {
+        result->linkOut = impairedTransport.outgoing.stats;
+        result->linkIn = impairedTransport.incoming.stats;
+    }
+
+    result->datagramCount = server.stats.datagramsFromClient + server.stats.datagramsToClient;
+    result->octetCount = server.stats.octetsFromClient + server.stats.octetsToClient;
+    result->datagramsFromClient = server.stats.datagramsFromClient;
+    result->octetsFromClient = server.stats.octetsFromClient;
+    result->datagramsToClient = server.stats.datagramsToClient;
+    result->octetsToClient = server.stats.octetsToClient;
+    result->receiveCallCount = server.stats.clientReceiveCallCount;
+
+    nimbleClientRealizeDestroy(&clientRealize);
+    nimbleLoopbackServerDestroy(&server);
+
+    return 0;
+}
+
+static void reportLifecycle(const BenchResult* result)
+{
+    double updateSeconds = (double) result->updateNs / 1e9;
+    double simulatedSeconds = (double) result->updateCount * (double) result->tickDurationUs / 1e6;
+
+    printf("lifecycle\n");
+    printf("  updates:                %zu\n", result->updateCount);
+    printf("  ns per nimbleClientUpdate: %.1f\n", (double) result->updateNs / (double) result->updateCount);
+    printf("  datagrams (in+out):     %zu (%zu octets)\n", result->datagramCount, result->octetCount);
+    printf("  octets per datagram:    %.1f from client, %.1f to client\n",
+           (double) result->octetsFromClient / (double) result->datagramsFromClient,
+           (double) result->octetsToClient / (double) result->datagramsToClient);
+    printf("  datagrams/s (client cpu): %.0f\n", (double) result->datagramCount / updateSeconds);
+    printf("  datagrams/s (simulated):  %.1f\n", (double) result->datagramCount / simulatedSeconds);
+    printf("  transport receive calls per update: %.2f\n",
+           (double) result->receiveCallCount / (double) result->updateCount);
+    printf("  time to synced:         %zu ticks (%zu ms simulated, %.3f ms wall)\n", result->ticksToSynced,
+           result->ticksToSynced * result->tickDurationUs / 1000U, (double) result->wallNsToSynced / 1e6);
+    printf("  authoritative steps read: %zu\n", result->stepsReceived);
+    if (result->gameStateChunkCount > 0) {
+        printf("  game state streamed:    %zu parts (%zu octets)\n", result->gameStateChunkCount,
+               result->gameStateStreamedOctetCount);
+    }
+    if (result->rejoinTickCount > 0) {
+        printf("  rejoin:                 %zu ticks, %zu octets to client\n", result->rejoinTickCount,
+               result->rejoinOctetsToClient);
+    }
+    if (result->arenaOctetCount > 0) {
+        printf("  client arena:           %zu octets\n", result->arenaOctetCount);
+    }
+}
+
+static void reportLink(const char* profileName, const BenchResult* result)
+{
+    printf("link profile '%s'%s\n", profileName, result->disconnected ? " (client disconnected)" : "");
+    printf("  time to synced:         %zu ticks (%zu ms simulated)\n", result->ticksToSynced,
+           result->ticksToSynced * result->tickDurationUs / 1000U);
+    printf("  latency avg:            %d ms\n", result->latencyAvgMs);
+    if (result->predictionSampleCount > 0) {
+        printf("  prediction tick count:  avg %.2f min %zu max %zu\n",
+               (double) result->predictionTickCountSum / (double) result->predictionSampleCount,
+               result->predictionTickCountMin, result->predictionTickCountMax);
+    }
+    if (result->serverStepEstimateSampleCount > 0) {
+        printf("  server step estimate:   error avg %.2f max %zu ticks\n",
+               (double) result->serverStepEstimateErrorSum / (double) result->serverStepEstimateSampleCount,
+               result->serverStepEstimateErrorMax);
+    }
+    printf("  quality rating:         %d\n", result->qualityRating);
+    printf("  link out: %zu datagrams, %zu lost, %zu burst lost, %zu duplicated, %zu reordered\n",
+           result->linkOut.datagramCount, result->linkOut.droppedCount, result->linkOut.burstDroppedCount,
+           result->linkOut.duplicatedCount, result->linkOut.reorderedCount);
+    printf("  link in:  %zu datagrams, %zu lost, %zu burst lost, %zu duplicated, %zu reordered\n",
+           result->linkIn.datagramCount, result->linkIn.droppedCount, result->linkIn.burstDroppedCount,
+           result->linkIn.duplicatedCount, result->linkIn.reorderedCount);
+}
+
+static void reportDownload(const char* profileName, const BenchResult* result)
+{
+    MonotonicTimeMs downloadMs = result->downloadEndMs - result->downloadStartMs;
+    if (!result->downloadStarted || result->downloadEndMs == 0 || downloadMs == 0) {
+        printf("download '%s': did not complete\n", profileName);
+        return;
+    }
+
+    double megabytesPerSecond = (double) result->downloadOctetCount / (double) downloadMs / 1000.0;
+    printf("download '%s': %zu octets in %" PRIu64 " ms simulated, %.2f MB/s (%zu datagrams to client)\n",
+           profileName, result->downloadOctetCount, (uint64_t) downloadMs, megabytesPerSecond,
+           result->datagramsToClient);
+}
+
+static int runLinkProfile(ImprintDefaultSetup* memory, BenchOptions options, const char* profileName)
+{
+    NimbleImpairedLinkSettings link;
+    if (nimbleImpairedLinkSettingsFromProfile(&link, profileName) < 0) {
+        fprintf(stderr, "unknown link profile '%s'\n", profileName);
+        return -1;
+    }
+    options.link = &link;
+
+    BenchResult result;
+    int err = runLifecycle(memory, &options, &result);
+    if (err < 0) {
+        return err;
+    }
+
+    if (options.measureDownload) {
+        reportDownload(profileName, &result);
+    } else {
+        reportLink(profileName, &result);
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    g_clog.log = clog_console;
+    g_clog.level = CLOG_TYPE_WARN;
+
+    BenchOptions options;
+    options.syncedTickCount = 100000;
+    options.gameStateOctetCount = 64 * 1024;
+    options.link = 0;
+    options.seed = 0x5eed;
+    options.useBatchReceive = false;
+    options.useLentReceive = false;
+    options.useReceiveTimestamps = false;
+    options.usePackedDatagrams = false;
+    options.flushSteps = false;
+    options.useDebugStreams = false;
+    options.streamGameState = false;
+    options.compressGameState = false;
+    options.measureDownload = false;
+    options.usePipelinedJoin = false;
+    options.rejoin = false;
+    options.useDeltaResync = false;
+    options.useArena = false;
+    options.useStats = true;
+    options.tickDurationUs = BENCH_TICK_DURATION_MS * 1000;
+    options.predictionPercentile = NIMBLE_CLIENT_PREDICTION_DEPTH_DEFAULT_PERCENTILE;
+    options.predictionSafetyMarginMs = NIMBLE_CLIENT_PREDICTION_DEPTH_DEFAULT_SAFETY_MARGIN_MS;
+    options.ackChunkWindow = NIMBLE_CLIENT_BLOB_STREAM_ACK_CHUNK_WINDOW;
+    options.ackIntervalMs = NIMBLE_CLIENT_BLOB_STREAM_ACK_INTERVAL_MS;
+    const char* profileName = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            options.syncedTickCount = (size_t) strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--state-size") == 0 && i + 1 < argc) {
+            options.gameStateOctetCount = (size_t) strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profileName = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = (uint64_t) strtoull(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--batch-receive") == 0) {
+            options.useBatchReceive = true;
+        } else if (strcmp(argv[i], "--lent-receive") == 0) {
+            options.useLentReceive = true;
+        } else if (strcmp(argv[i], "--receive-timestamps") == 0) {
+            options.useReceiveTimestamps = true;
+        } else if (strcmp(argv[i], "--packed") == 0) {
+            options.usePackedDatagrams = true;
+        } else if (strcmp(argv[i], "--flush") == 0) {
+            options.flushSteps = true;
+        } else if (strcmp(argv[i], "--debug-streams") == 0) {
+            options.useDebugStreams = true;
+        } else if (strcmp(argv[i], "--stream-state") == 0) {
+            options.streamGameState = true;
+        } else if (strcmp(argv[i], "--compress-state") == 0) {
+            options.compressGameState = true;
+        } else if (strcmp(argv[i], "--pipelined-join") == 0) {
+            options.usePipelinedJoin = true;
+        } else if (strcmp(argv[i], "--rejoin") == 0) {
+            options.rejoin = true;
+        } else if (strcmp(argv[i], "--delta-resync") == 0) {
+            options.useDeltaResync = true;
+        } else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            unsigned long tickRate = strtoul(argv[++i], 0, 10);
+            if (tickRate > 0) {
+                options.tickDurationUs = (size_t) ((1000000UL + tickRate / 2) / tickRate);
+            }
+        } else if (strcmp(argv[i], "--percentile") == 0 && i + 1 < argc) {
+            options.predictionPercentile = (size_t) strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--margin") == 0 && i + 1 < argc) {
+            options.predictionSafetyMarginMs = (MonotonicTimeMs) strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--no-stats") == 0) {
+            options.useStats = false;
+        } else if (strcmp(argv[i], "--arena") == 0) {
+            options.useArena = true;
+        } else if (strcmp(argv[i], "--download") == 0) {
+            options.measureDownload = true;
+        } else if (strcmp(argv[i], "--ack-window") == 0 && i + 1 < argc) {
+            options.ackChunkWindow = (size_t) strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--ack-interval") == 0 && i + 1 < argc) {
+            options.ackIntervalMs = (MonotonicTimeMs) strtoul(argv[++i], 0, 10);
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--ticks count] [--state-size octets] [--profile perfect|lan|dsl|wifi|mobile|bad|all] "
+                    "[--seed seed] [--batch-receive] [--lent-receive] [--receive-timestamps] [--packed] [--flush] "
+                    "[--debug-streams] [--stream-state] [--compress-state] [--download] [--ack-window chunks] "
+                    "[--ack-interval ms] [--pipelined-join] [--rejoin] [--delta-resync] [--arena] [--no-stats] "
+                    "[--percentile p] [--margin ms] [--tick-rate hz]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    ImprintDefaultSetup memory;
+    imprintDefaultSetupInit(&memory, 64 * 1024 * 1024);
+
+    if (profileName == 0) {
+        BenchResult result;
+        int err = runLifecycle(&memory, &options, &result);
+        if (err < 0) {
+            return 1;
+        }
+        if (options.measureDownload) {
+            reportDownload("loopback", &result);
+        } else {
+            reportLifecycle(&result);
+        }
+    } else if (strcmp(profileName, "all") == 0) {
+        static const char* allProfiles[] = {"perfect", "lan", "dsl", "wifi", "mobile", "bad"};
+        for (size_t i = 0; i < sizeof(allProfiles) / sizeof(allProfiles[0]); ++i) {
+            if (runLinkProfile(&memory, options, allProfiles[i]) < 0) {
+                return 1;
+            }
+        }
+    } else if (runLinkProfile(&memory, options, profileName) < 0) {
+        return 1;
+    }
+
+    imprintDefaultSetupDestroy(&memory);
+
+    return 0;
+}
@@ -0,0 +1,240 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "common.h"
+#include "loopback_server.h"
+#include "loopback_shared_transport.h"
+#include <clog/console.h>
+#include <imprint/allocator.h>
+#include <imprint/default_setup.h>
+#include <nimble-client/client.h>
+#include <nimble-client/network_realizer.h>
+#include <nimble-client/pool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+clog_config g_clog;
+
+#define BENCH_POOL_QUEUE_CAPACITY (16)
+// Upper estimate of what a pooled client and its loopback server allocate from the tag allocator
+#define BENCH_POOL_MEMORY_PER_CLIENT (192 * 1024)
+// Datagrams for each client that the pool can receive from the shared transport in one update
+#define BENCH_POOL_SHARED_IN_DATAGRAMS_PER_CLIENT (4)
+
+typedef struct PoolBenchOptions {
+    size_t syncedTickCount;
+    size_t gameStateOctetCount;
+    size_t clientCount;
+    size_t workerCount;
+    bool useStats;
+    bool useSharedTransport;
+} PoolBenchOptions;
+
+static bool allClientsAreSynced(NimbleClientRealize** clients, size_t clientCount)
+{
+    for (size_t i = 0; i < clientCount; ++i) {
+        if (clients[i]->state != NimbleClientRealizeStateSynced) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// Updates many clients with a NimbleClientPool, each against its own loopback server, and measures the updates
+/// per second once all of them are synced. With the shared transport, all clients send and receive through one
+/// transport, and the connection id in front of each datagram routes it to the loopback server of the client.
+static int runPool(ImprintDefaultSetup* memory, const PoolBenchOptions* options)
+{
+    ImprintAllocator* tagAllocator = &memory->tagAllocator.info;
+    size_t clientCount = options->clientCount;
+
+    Clog serverLog;
+    serverLog.config = &g_clog;
+    serverLog.constantPrefix = "server";
+
+    MonotonicTimeMs now = 0;
+    NimbleClientClock virtualClock;
+    virtualClock.self = &now;
+    virtualClock.now = nimbleBenchVirtualClockNow;
+
+    NimbleLoopbackServer* servers = IMPRINT_ALLOC_TYPE_COUNT(tagAllocator, NimbleLoopbackServer, clientCount);
+    NimbleClientRealize** clients = IMPRINT_ALLOC_TYPE_COUNT(tagAllocator, NimbleClientRealize*, clientCount);
+
+    NimbleLoopbackSharedTransport sharedTransport;
+    nimbleLoopbackSharedTransportInit(&sharedTransport, servers, clientCount);
+
+    NimbleClientPoolSettings poolSettings;
+    poolSettings.memory = tagAllocator;
+    poolSettings.sharedTransport.self = 0;
+    poolSettings.sharedTransport.send = 0;
+    poolSettings.sharedTransport.receive = 0;
+    poolSettings.inDatagramCapacity = 0;
+    if (options->useSharedTransport) {
+        poolSettings.sharedTransport = nimbleLoopbackSharedTransportTransport(&sharedTransport);
+        poolSettings.inDatagramCapacity = clientCount * BENCH_POOL_SHARED_IN_DATAGRAMS_PER_CLIENT;
+    }
+    poolSettings.clientCapacity = clientCount;
+    poolSettings.workerCount = options->workerCount;
+    poolSettings.log.config = &g_clog;
+    poolSettings.log.constantPrefix = "pool";
+
+    NimbleClientRealizeSettings* clientSettings = &poolSettings.clientSettings;
+    clientSettings->memory = tagAllocator;
+    clientSettings->blobMemory = &memory->slabAllocator.info;
+    clientSettings->arena = 0;
+    clientSettings->arenaOctetCount = 0;
+    clientSettings->maximumSingleParticipantStepOctetCount = 8;
+    clientSettings->maximumNumberOfParticipants = 1;
+    clientSettings->maximumGameStateOctetCount = options->gameStateOctetCount;
+    clientSettings->applicationVersion.major = 0x10;
+    clientSettings->applicationVersion.minor = 0x20;
+    clientSettings->applicationVersion.patch = 0x30;
+    clientSettings->wantsDebugStreams = false;
+    clientSettings->log.config = &g_clog;
+    clientSettings->log.constantPrefix = "client";
+
+    NimbleClientPool pool;
+    int err = nimbleClientPoolInit(&pool, &poolSettings);
+    if (err < 0) {
+        fprintf(stderr, "could not initialize the client pool: %d\n", err);
+        return err;
+    }
+
+    NimbleSerializeJoinGameRequest joinGameRequest;
+    tc_mem_clear_type(&joinGameRequest);
+    joinGameRequest.playerCount = 1;
+    joinGameRequest.players[0].localIndex = 0xca;
+
+    for (size_t i = 0; i < clientCount; ++i) {
+        nimbleLoopbackServerInit(&servers[i], tagAllocator, &memory->slabAllocator.info, options->gameStateOctetCount,
+                                 BENCH_POOL_QUEUE_CAPACITY, serverLog);
+        DatagramTransport transport = nimbleLoopbackServerClientTransport(&servers[i]);
+        // The pool hands out the connection ids in order, so client i is routed to servers[i]
+        clients[i] = nimbleClientPoolAdd(&pool, options->useSharedTransport ? 0 : &transport);
+        nimbleClientSetClock(&clients[i]->client, virtualClock);
+        nimbleClientSetStats(&clients[i]->client, options->useStats);
+        nimbleClientRealizeReInit(clients[i], &clients[i]->settings);
+        nimbleClientRealizeJoinGame(clients[i], joinGameRequest);
+    }
+
+    size_t tick = 0;
+    size_t ticksToSynced = 0;
+    size_t measuredTickCount = 0;
+    uint64_t measuredNs = 0;
+
+    while (measuredTickCount < options->syncedTickCount) {
+        if (ticksToSynced == 0 && tick >= BENCH_MAX_TICKS_TO_SYNC) {
+            fprintf(stderr, "clients did not reach synced within %d ticks\n", BENCH_MAX_TICKS_TO_SYNC);
+            break;
+        }
+
+        now += BENCH_TICK_DURATION_MS;
+        tick++;
+
+        for (size_t i = 0; i < clientCount; ++i) {
+            nimbleLoopbackServerUpdate(&servers[i], now);
+            if (clients[i]->client.state == NimbleClientStateSynced) {
+                nimbleBenchWritePredictedStep(&clients[i]->client);
+            }
+        }
+
+        uint64_t beforeNs = nimbleBenchNowNs();
+        nimbleClientPoolUpdate(&pool, now);
+        uint64_t updateNs = nimbleBenchNowNs() - beforeNs;
+
+        for (size_t i = 0; i < clientCount; ++i) {
+            nimbleBenchReadAuthoritativeSteps(&clients[i]->client);
+        }
+
+        if (ticksToSynced == 0) {
+            if (allClientsAreSynced(clients, clientCount)) {
+                ticksToSynced = tick;
+            }
+            continue;
+        }
+
+        measuredNs += updateNs;
+        measuredTickCount++;
+    }
+
+    if (measuredTickCount > 0) {
+        double seconds = (double) measuredNs / 1e9;
+        size_t clientUpdateCount = measuredTickCount * clientCount;
+        size_t hotOctetCount = offsetof(NimbleClient, outSteps);
+        printf("pool\n");
+        printf("  clients:                %zu on %zu workers, stats %s, %s transport\n", clientCount,
+               options->workerCount, options->useStats ? "on" : "off", options->useSharedTransport ? "shared" : "own");
+        printf("  time to synced:         %zu ticks\n", ticksToSynced);
+        printf("  ms per pool update:     %.3f\n", (double) measuredNs / 1e6 / (double) measuredTickCount);
+        printf("  ns per client update:   %.1f\n", (double) measuredNs / (double) clientUpdateCount);
+        printf("  client updates/s:       %.0f\n", (double) clientUpdateCount / seconds);
+        printf("  stolen client updates:  %zu\n", pool.stats.stolenCount);
+        if (options->useSharedTransport) {
+            printf("  shared datagrams:       %zu to clients, %zu from clients, %zu dropped\n",
+                   sharedTransport.stats.datagramsToClients, sharedTransport.stats.datagramsFromClients,
+                   pool.stats.droppedDatagramCount + sharedTransport.stats.droppedDatagramCount);
+        }
+        printf("  NimbleClient:           %zu octets, %zu octets (%zu cache lines) before the step buffers\n",
+               sizeof(NimbleClient), hotOctetCount, (hotOctetCount + 63) / 64);
+    }
+
+    nimbleClientPoolDestroy(&pool);
+    for (size_t i = 0; i < clientCount; ++i) {
+        nimbleLoopbackServerDestroy(&servers[i]);
+    }
+
+    return measuredTickCount > 0 ? 0 : -1;
+}
+
+int main(int argc, char* argv[])
+{
+    g_clog.log = clog_console;
+    g_clog.level = CLOG_TYPE_WARN;
+
+    PoolBenchOptions options;
+    options.syncedTickCount = 1000;
+    options.gameStateOctetCount = 1024;
+    options.clientCount = 1000;
+    options.workerCount = 1;
+    options.useStats = true;
+    options.useSharedTransport = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            options.syncedTickCount = (size_t) strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--state-size") == 0 && i + 1 < argc) {
+            options.gameStateOctetCount = (size_t) strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) {
+            options.clientCount = (size_t) strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            options.workerCount = (size_t) strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--no-stats") == 0) {
+            options.useStats = false;
+        } else if (strcmp(argv[i], "--shared-transport") == 0) {
+            options.useSharedTransport = true;
+        } else {
+            fprintf(stderr, "usage: %s [--clients count] [--workers count] [--ticks count] [--state-size octets] "
+                            "[--no-stats] [--shared-transport]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.clientCount == 0) {
+        fprintf(stderr, "need at least one client\n");
+        return 1;
+    }
+
+    ImprintDefaultSetup memory;
+    imprintDefaultSetupInit(&memory, 64 * 1024 * 1024 + options.clientCount * BENCH_POOL_MEMORY_PER_CLIENT);
+
+    int err = runPool(&memory, &options);
+
+    imprintDefaultSetupDestroy(&memory);
+
+    return err < 0 ? 1 : 0;
+}
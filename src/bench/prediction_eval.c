@@ -0,0 +1,159 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "prediction_eval.h"
+#include <nimble-client/prediction_depth.h>
+#include <stdio.h>
+#include <tiny-libc/tiny_libc.h>
+
+/// Number of round trip times in each average of the heuristic that the controller replaced
+#define NIMBLE_PREDICTION_EVAL_AVERAGE_SAMPLE_COUNT (20)
+
+/// Simulates a delay trace from a link profile, with the same delay and jitter in both directions.
+/// Loss is not part of the trace, a lost step is lost whatever the prediction depth is.
+/// @param samples trace to fill in
+/// @param count number of ticks in the trace
+/// @param link one-way link settings
+/// @param seed random seed, same seed gives the same trace
+void nimblePredictionTraceFromLink(NimblePredictionTraceSample* samples, size_t count,
+                                   const NimbleImpairedLinkSettings* link, uint64_t seed)
+{
+    NimbleImpairedTransport random;
+    DatagramTransport noTransport;
+    tc_mem_clear_type(&noTransport);
+    NimbleClientClock noClock;
+    tc_mem_clear_type(&noClock);
+    nimbleImpairedTransportInit(&random, noTransport, noClock, link, link, seed);
+
+    for (size_t i = 0; i < count; ++i) {
+        MonotonicTimeMs upMs = nimbleImpairedTransportSampleDelay(&random, link);
+        MonotonicTimeMs downMs = nimbleImpairedTransportSampleDelay(&random, link);
+        samples[i].upMs = upMs;
+        samples[i].rttMs = upMs + downMs;
+    }
+}
+
+/// Reads a recorded delay trace. Each line is a round trip time in milliseconds, optionally followed by the
+/// one-way delay to the server. Without it half of the round trip time is used.
+/// @param samples trace to fill in
+/// @param capacity maximum number of ticks to read
+/// @param filename text file to read
+/// @param[out] outCount number of ticks that were read
+/// @return negative on error
+int nimblePredictionTraceRead(NimblePredictionTraceSample* samples, size_t capacity, const char* filename,
+                              size_t* outCount)
+{
+    FILE* file = fopen(filename, "r");
+    if (file == 0) {
+        return -1;
+    }
+
+    size_t count = 0;
+    char line[128];
+    while (count < capacity && fgets(line, sizeof(line), file) != 0) {
+        unsigned long rttMs;
+        unsigned long upMs;
+        int fieldCount = sscanf(line, "%lu %lu", &rttMs, &upMs);
+        if (fieldCount < 1) {
+            continue;
+        }
+        samples[count].rttMs = (MonotonicTimeMs) rttMs;
+        samples[count].upMs = fieldCount == 2 ? (MonotonicTimeMs) upMs : (MonotonicTimeMs) rttMs / 2;
+        count++;
+    }
+
+    fclose(file);
+    *outCount = count;
+
+    return 0;
+}
+
+/// The depth that a step sent in this tick needed, in the same terms as NimbleClientPredictionDepth
+static size_t neededDepth(const NimblePredictionTraceSample* sample, size_t tickDurationUs)
+{
+    return ((size_t) sample->upMs * 1000U + tickDurationUs - 1) / tickDurationUs + 1;
+}
+
+static void evalStep(NimblePredictionEvalResult* result, size_t depth, size_t previousDepth, size_t needed)
+{
+    result->stepCount++;
+    result->depthTickSum += depth;
+    if (depth > result->depthMax) {
+        result->depthMax = depth;
+    }
+    if (result->stepCount > 1 && depth != previousDepth) {
+        result->depthChangeCount++;
+    }
+
+    if (depth < needed) {
+        // Arrives after the server composed the authoritative step, so the server drops it
+        result->lateCount++;
+    } else {
+        // Each tick of extra depth is a tick that the client has to predict and roll back
+        result->excessTickSum += depth - needed;
+    }
+}
+
+/// Replays a delay trace through NimbleClientPredictionDepth, as if one pong arrived every tick
+/// The server step is assumed to be known exactly, so only the depth is evaluated.
+/// @param samples delay trace
+/// @param count number of ticks in the trace
+/// @param tickDurationUs duration of a step in microseconds
+/// @param percentile percentile of the one-way delays to cover
+/// @param safetyMarginMs safety margin on top of the percentile
+/// @param[out] result late and excess ticks
+void nimblePredictionEvalController(const NimblePredictionTraceSample* samples, size_t count,
+                                    size_t tickDurationUs, size_t percentile, MonotonicTimeMs safetyMarginMs,
+                                    NimblePredictionEvalResult* result)
+{
+    tc_mem_clear_type(result);
+
+    NimbleClientPredictionDepthWindow window;
+    NimbleClientPredictionDepth depth;
+    nimbleClientPredictionDepthInit(&depth, &window, tickDurationUs, percentile, safetyMarginMs);
+
+    size_t previousDepth = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (depth.hasTarget) {
+            evalStep(result, depth.targetTickCount, previousDepth, neededDepth(&samples[i], tickDurationUs));
+            previousDepth = depth.targetTickCount;
+        }
+        nimbleClientPredictionDepthAddRtt(&depth, samples[i].rttMs);
+    }
+}
+
+/// Replays a delay trace through the heuristic that was used before NimbleClientPredictionDepth: the average of
+/// NIMBLE_PREDICTION_EVAL_AVERAGE_SAMPLE_COUNT round trip times, with half of it rounded up to ticks, plus one
+/// @param samples delay trace
+/// @param count number of ticks in the trace
+/// @param tickDurationUs duration of a step in microseconds
+/// @param[out] result late and excess ticks
+void nimblePredictionEvalAverage(const NimblePredictionTraceSample* samples, size_t count, size_t tickDurationUs,
+                                 NimblePredictionEvalResult* result)
+{
+    tc_mem_clear_type(result);
+
+    bool hasAverage = false;
+    MonotonicTimeMs averageRttMs = 0;
+    MonotonicTimeMs totalMs = 0;
+    size_t totalCount = 0;
+
+    size_t previousDepth = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (hasAverage) {
+            size_t depth = ((size_t) (averageRttMs / 2) * 1000U + tickDurationUs - 1) / tickDurationUs + 1;
+            evalStep(result, depth, previousDepth, neededDepth(&samples[i], tickDurationUs));
+            previousDepth = depth;
+        }
+
+        totalMs += samples[i].rttMs;
+        totalCount++;
+        if (totalCount == NIMBLE_PREDICTION_EVAL_AVERAGE_SAMPLE_COUNT) {
+            averageRttMs = totalMs / (MonotonicTimeMs) totalCount;
+            hasAverage = true;
+            totalMs = 0;
+            totalCount = 0;
+        }
+    }
+}
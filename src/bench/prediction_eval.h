@@ -0,0 +1,40 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_BENCH_PREDICTION_EVAL_H
+#define NIMBLE_CLIENT_BENCH_PREDICTION_EVAL_H
+
+#include "impaired_transport.h"
+#include <monotonic-time/monotonic_time.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// One tick of a delay trace: the round trip time that the pong measured, and the one-way delay of the predicted
+/// step that was sent in the same tick
+typedef struct NimblePredictionTraceSample {
+    MonotonicTimeMs rttMs;
+    MonotonicTimeMs upMs;
+} NimblePredictionTraceSample;
+
+typedef struct NimblePredictionEvalResult {
+    size_t stepCount;
+    size_t lateCount;
+    size_t excessTickSum;
+    size_t depthTickSum;
+    size_t depthMax;
+    size_t depthChangeCount;
+} NimblePredictionEvalResult;
+
+void nimblePredictionTraceFromLink(NimblePredictionTraceSample* samples, size_t count,
+                                   const NimbleImpairedLinkSettings* link, uint64_t seed);
+int nimblePredictionTraceRead(NimblePredictionTraceSample* samples, size_t capacity, const char* filename,
+                              size_t* outCount);
+
+void nimblePredictionEvalController(const NimblePredictionTraceSample* samples, size_t count,
+                                    size_t tickDurationUs, size_t percentile, MonotonicTimeMs safetyMarginMs,
+                                    NimblePredictionEvalResult* result);
+void nimblePredictionEvalAverage(const NimblePredictionTraceSample* samples, size_t count, size_t tickDurationUs,
+                                 NimblePredictionEvalResult* result);
+
+#endif
@@ -0,0 +1,140 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "common.h"
+#include "impaired_transport.h"
+#include "prediction_eval.h"
+#include <clog/clog.h>
+#include <clog/console.h>
+#include <imprint/allocator.h>
+#include <imprint/default_setup.h>
+#include <inttypes.h>
+#include <nimble-client/prediction_depth.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+clog_config g_clog;
+
+typedef struct PredictionBenchOptions {
+    size_t tickCount;
+    uint64_t seed;
+    size_t tickDurationUs;
+    const char* rttTraceFilename;
+    size_t predictionPercentile;
+    MonotonicTimeMs predictionSafetyMarginMs;
+} PredictionBenchOptions;
+
+static void reportPredictionEval(const char* name, const char* traceName, const NimblePredictionEvalResult* result)
+{
+    if (result->stepCount == 0) {
+        printf("  %-10s no steps\n", name);
+        return;
+    }
+
+    printf("  %-10s late %.3f%%  excess %.2f ticks  depth avg %.2f max %zu  depth changes %zu  (%s)\n", name,
+           100.0 * (double) result->lateCount / (double) result->stepCount,
+           (double) result->excessTickSum / (double) result->stepCount,
+           (double) result->depthTickSum / (double) result->stepCount, result->depthMax, result->depthChangeCount,
+           traceName);
+}
+
+/// Replays a delay trace through the prediction depth controller and the average based heuristic it replaced.
+/// Late steps are dropped by the server, excess ticks are extra prediction and rollback work.
+static int runPredictionEval(ImprintDefaultSetup* memory, const PredictionBenchOptions* options, const char* profileName)
+{
+    size_t capacity = options->tickCount;
+    NimblePredictionTraceSample* samples = IMPRINT_ALLOC_TYPE_COUNT(&memory->tagAllocator.info,
+                                                                    NimblePredictionTraceSample, capacity);
+    size_t count = capacity;
+    const char* traceName = profileName;
+
+    if (options->rttTraceFilename != 0) {
+        if (nimblePredictionTraceRead(samples, capacity, options->rttTraceFilename, &count) < 0) {
+            fprintf(stderr, "could not read rtt trace '%s'\n", options->rttTraceFilename);
+            return -1;
+        }
+        traceName = options->rttTraceFilename;
+    } else {
+        NimbleImpairedLinkSettings link;
+        if (nimbleImpairedLinkSettingsFromProfile(&link, profileName) < 0) {
+            fprintf(stderr, "unknown link profile '%s'\n", profileName);
+            return -1;
+        }
+        nimblePredictionTraceFromLink(samples, count, &link, options->seed);
+    }
+
+    NimblePredictionEvalResult controller;
+    nimblePredictionEvalController(samples, count, options->tickDurationUs, options->predictionPercentile,
+                                   options->predictionSafetyMarginMs, &controller);
+    NimblePredictionEvalResult average;
+    nimblePredictionEvalAverage(samples, count, options->tickDurationUs, &average);
+
+    printf("prediction depth '%s' (%zu ticks, p%zu + %" PRIu64 " ms)\n", traceName, count,
+           options->predictionPercentile, (uint64_t) options->predictionSafetyMarginMs);
+    reportPredictionEval("controller", "percentile and hysteresis", &controller);
+    reportPredictionEval("average", "previous heuristic", &average);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    g_clog.log = clog_console;
+    g_clog.level = CLOG_TYPE_WARN;
+
+    PredictionBenchOptions options;
+    options.tickCount = 100000;
+    options.seed = 0x5eed;
+    options.tickDurationUs = BENCH_TICK_DURATION_MS * 1000;
+    options.rttTraceFilename = 0;
+    options.predictionPercentile = NIMBLE_CLIENT_PREDICTION_DEPTH_DEFAULT_PERCENTILE;
+    options.predictionSafetyMarginMs = NIMBLE_CLIENT_PREDICTION_DEPTH_DEFAULT_SAFETY_MARGIN_MS;
+    const char* profileName = "all";
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            options.tickCount = (size_t) strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profileName = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = (uint64_t) strtoull(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--rtt-trace") == 0 && i + 1 < argc) {
+            options.rttTraceFilename = argv[++i];
+        } else if (strcmp(argv[i], "--percentile") == 0 && i + 1 < argc) {
+            options.predictionPercentile = (size_t) strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--margin") == 0 && i + 1 < argc) {
+            options.predictionSafetyMarginMs = (MonotonicTimeMs) strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            unsigned long tickRate = strtoul(argv[++i], 0, 10);
+            if (tickRate > 0) {
+                options.tickDurationUs = (size_t) ((1000000UL + tickRate / 2) / tickRate);
+            }
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--ticks count] [--profile perfect|lan|dsl|wifi|mobile|bad|all] [--seed seed] "
+                    "[--rtt-trace file] [--percentile p] [--margin ms] [--tick-rate hz]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    ImprintDefaultSetup memory;
+    imprintDefaultSetupInit(&memory, 64 * 1024 * 1024);
+
+    int err = 0;
+    if (options.rttTraceFilename != 0 || strcmp(profileName, "all") != 0) {
+        err = runPredictionEval(&memory, &options, profileName);
+    } else {
+        static const char* allProfiles[] = {"perfect", "lan", "dsl", "wifi", "mobile", "bad"};
+        for (size_t i = 0; i < sizeof(allProfiles) / sizeof(allProfiles[0]) && err >= 0; ++i) {
+            err = runPredictionEval(&memory, &options, allProfiles[i]);
+        }
+    }
+
+    imprintDefaultSetupDestroy(&memory);
+
+    return err < 0 ? 1 : 0;
+}
@@ -68,6 +68,7 @@ int main(int argc, char* argv[])
 
     settings.blobMemory = &memory.slabAllocator.info;
     settings.memory = &memory.tagAllocator.info;
+    settings.arena = 0;
     settings.transport = transport;
     settings.applicationVersion = exampleApplicationVersion;
 
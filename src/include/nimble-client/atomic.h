@@ -0,0 +1,98 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_ATOMIC_H
+#define NIMBLE_CLIENT_ATOMIC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The library is C99, so there is no <stdatomic.h>. Acquire loads and release stores are enough for the single
+// producer / single consumer hand over between the game thread and the network thread. The client pool also needs
+// a compare and exchange, for the work ranges that the worker threads steal from each other.
+
+#if defined _MSC_VER
+#include <intrin.h>
+
+#if defined _M_IX86 || defined _M_X64
+// Loads are not reordered with other loads and stores are not reordered with other stores on x86 and x64, so it
+// is enough to stop the compiler from reordering them
+static inline size_t nimbleClientAtomicLoadAcquire(const volatile size_t* p)
+{
+    size_t value = *p;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static inline void nimbleClientAtomicStoreRelease(volatile size_t* p, size_t value)
+{
+    _ReadWriteBarrier();
+    *p = value;
+}
+#elif defined _M_ARM64
+// ARM64 reorders plain loads and stores, so they must be the load-acquire and store-release instructions
+static inline size_t nimbleClientAtomicLoadAcquire(const volatile size_t* p)
+{
+    return (size_t) __ldar64((volatile unsigned __int64*) p);
+}
+
+static inline void nimbleClientAtomicStoreRelease(volatile size_t* p, size_t value)
+{
+    __stlr64((volatile unsigned __int64*) p, (unsigned __int64) value);
+}
+#else
+#error "nimble-client: acquire and release atomics are not implemented for this MSVC target"
+#endif
+
+static inline uint64_t nimbleClientAtomicLoadAcquire64(const volatile uint64_t* p)
+{
+    return (uint64_t) _InterlockedCompareExchange64((volatile __int64*) p, 0, 0);
+}
+
+static inline void nimbleClientAtomicStoreRelease64(volatile uint64_t* p, uint64_t value)
+{
+    _InterlockedExchange64((volatile __int64*) p, (__int64) value);
+}
+
+/// Sets *p to desired if it is *expected. Otherwise *expected is set to the current value.
+static inline bool nimbleClientAtomicCompareExchange64(volatile uint64_t* p, uint64_t* expected, uint64_t desired)
+{
+    uint64_t previous = (uint64_t) _InterlockedCompareExchange64((volatile __int64*) p, (__int64) desired,
+                                                                 (__int64) *expected);
+    if (previous == *expected) {
+        return true;
+    }
+    *expected = previous;
+    return false;
+}
+#else
+static inline size_t nimbleClientAtomicLoadAcquire(const volatile size_t* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void nimbleClientAtomicStoreRelease(volatile size_t* p, size_t value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t nimbleClientAtomicLoadAcquire64(const volatile uint64_t* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void nimbleClientAtomicStoreRelease64(volatile uint64_t* p, uint64_t value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+/// Sets *p to desired if it is *expected. Otherwise *expected is set to the current value.
+static inline bool nimbleClientAtomicCompareExchange64(volatile uint64_t* p, uint64_t* expected, uint64_t desired)
+{
+    return __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#endif
+
+#endif
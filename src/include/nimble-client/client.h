@@ -9,10 +9,22 @@
 #include <blob-stream/blob_stream_logic_out.h>
 #include <clog/clog.h>
 #include <datagram-transport/transport.h>
+#include <imprint/linear_allocator.h>
 #include <lagometer/lagometer.h>
+#include <nimble-client/clock.h>
+#include <nimble-client/clock_sync.h>
 #include <nimble-client/connection_quality.h>
 #include <nimble-client/game_state.h>
+#include <nimble-client/game_state_cache.h>
+#include <nimble-client/game_state_codec.h>
+#include <nimble-client/game_state_receiver.h>
 #include <nimble-client/incoming_api.h>
+#include <nimble-client/prediction_depth.h>
+#include <nimble-client/retransmit.h>
+#include <nimble-client/time_dilation.h>
+#include <nimble-client/transport_batch.h>
+#include <nimble-client/transport_lend.h>
+#include <nimble-client/transport_timestamp.h>
 #include <nimble-serialize/client_out.h>
 #include <nimble-steps/pending_steps.h>
 #include <nimble-steps/steps.h>
@@ -47,6 +59,11 @@ typedef enum NimbleJoiningState {
 } NimbleJoiningState;
 
 #define NIMBLE_CLIENT_MAX_LOCAL_USERS_COUNT (8)
+#define NIMBLE_CLIENT_GAME_STATE_CHUNK_SIZE (1024)
+#define NIMBLE_CLIENT_BLOB_STREAM_ACK_CHUNK_WINDOW (4)
+#define NIMBLE_CLIENT_BLOB_STREAM_ACK_INTERVAL_MS (4)
+#define NIMBLE_CLIENT_ARENA_ALIGNMENT (16)
+#define NIMBLE_CLIENT_DEFAULT_TICK_DURATION_US (16000)
 
 typedef struct NimbleClientParticipantEntry {
     bool isUsed;
@@ -57,86 +74,152 @@ typedef struct NimbleClientParticipantEntry {
 struct ImprintAllocator;
 
 typedef struct NimbleClient {
-    int waitTime;
-
+    // Read or written by every update of a synced client. Kept together at the start, so the working set of an
+    // update is this block plus the step buffers. The block is 632 octets (10 cache lines) on x86-64, client.c
+    // fails to compile if it grows past 12 cache lines. The fields below the step buffers are only used while
+    // connecting, downloading the game state, receiving the clock and prediction depth samples, or for the
+    // diagnostic stats.
     NimbleClientState state;
     NimbleJoiningState joinParticipantPhase;
-
-    NimbleClientParticipantEntry localParticipantLookup[NIMBLE_CLIENT_MAX_LOCAL_USERS_COUNT];
-    size_t localParticipantCount;
+    bool useStats;
+    bool useDebugStreams;
+    bool usePackedDatagrams;
+    bool lastUpdateMonotonicMsIsSet;
+    uint8_t remoteConnectionId;
+    OrderedDatagramOutLogic orderedDatagramOut;
+    OrderedDatagramInLogic orderedDatagramIn;
+    uint32_t loggingTickCount;
+    MonotonicTimeMs now;
+    // When the datagram that is being fed arrived, earlier than now if the transport knows it
+    MonotonicTimeMs datagramReceivedAt;
+    MonotonicTimeMs lastUpdateMonotonicMs;
+    // In microseconds, so tick rates that are not a whole number of milliseconds (e.g. 120 Hz) do not drift
+    size_t expectedTickDurationUs;
+    int64_t nextTickAtUs;
+    size_t latencyMs;
+    size_t frame;
+    StepId receivedStepIdByServerOnlyForDebug;
 
     DatagramTransport transport;
+    NimbleClientTransportBatch transportBatch;
+    NimbleClientTransportLend transportLend;
+    NimbleClientTransportTimestamp transportTimestamp;
+
+    NimbleClientRto rto;
+    NimbleClientClockSync clockSync;
+    NimbleClientPredictionDepth predictionDepth;
+    NimbleClientTimeDilation timeDilation;
+    NimbleClientRequestTimer requestTimer;
+    NimbleClientRequestTimer joinGameRequestTimer;
+    NimbleClientConnectionQuality quality;
 
     NbsSteps outSteps;
     NbsPendingSteps authoritativePendingStepsFromServer;
     NbsSteps authoritativeStepsFromServer;
-    StepId receivedStepIdByServerOnlyForDebug;
+
+    // Only used when a game step response arrives or a round trip time is measured, the estimates in clockSync
+    // and predictionDepth are what the updates read
+    NimbleClientClockSyncWindow clockSyncWindow;
+    NimbleClientPredictionDepthWindow predictionDepthWindow;
+
+    NimbleClientParticipantEntry localParticipantLookup[NIMBLE_CLIENT_MAX_LOCAL_USERS_COUNT];
+    size_t localParticipantCount;
+
     NimbleClientGameState joinedGameState;
     NimbleSerializeBlobStreamChannelId joinStateChannel;
+    StepId joinStateId;
 
     BlobStreamLogicIn blobStreamInLogic;
     BlobStreamIn blobStreamIn;
+    bool blobStreamInIsAllocated;
+    NimbleClientGameStateReceiver gameStateReceiver;
+    size_t gameStateDeliveredOctetCount;
+    bool wantsCompressedGameState;
+    NimbleClientGameStateCodec gameStateCodec;
+    NimbleClientGameStateDecoder gameStateDecoder;
+    bool useDeltaResync;
+    NimbleClientGameStateCache gameStateCache;
+    NimbleClientGameStateDelta gameStateDelta;
     uint8_t downloadStateClientRequestId;
+    uint8_t downloadStateRequestOptions;
+    size_t blobStreamAckChunkWindow;
+    MonotonicTimeMs blobStreamAckIntervalMs;
+    size_t blobStreamChunksSinceAck;
+    MonotonicTimeMs lastBlobStreamAckAt;
 
-    StepId joinStateId;
+    NimbleSerializePartyAndSessionSecret partyAndSessionSecret;
+    NimbleSerializeJoinGameRequest joinGameRequest;
+    bool usePipelinedJoin;
+    bool wantsDebugStreams;
+    NimbleSerializeVersion applicationVersion;
+    NimbleSerializeClientRequestId connectRequestId;
 
-    size_t frame;
-    bool useStats;
-    size_t statsCounter;
+    size_t maximumSingleParticipantStepOctetCount;
+    size_t maximumNumberOfParticipants;
+    struct ImprintAllocator* memory;
+    struct ImprintAllocatorWithFree* blobStreamAllocator;
+    bool usesArena;
+    ImprintLinearAllocator arena;
+    ImprintLinearAllocator blobStreamInMemory;
+    size_t maximumGameStateOctetCount;
+
+    NimbleClientClock clock;
+    int transportPollHandle;
 
+    size_t statsCounter;
+    StatsInt latencyMsStat;
+    StatsInt authoritativeBufferDeltaStat;
     StatsInt waitingStepsFromServer;
     StatsInt stepCountInIncomingBufferOnServerStat;
-    StatsInt authoritativeBufferDeltaStat;
-    StatsInt latencyMsStat;
     StatsInt outgoingStepsInQueue;
+    StatsInt tickDuration;
 
     StatsIntPerSecond packetsPerSecondOut;
     StatsIntPerSecond packetsPerSecondIn;
     StatsIntPerSecond simulationStepsPerSecond;
     StatsIntPerSecond sentStepsDatagramCountPerSecond;
 
-    struct ImprintAllocator* memory;
-    struct ImprintAllocatorWithFree* blobStreamAllocator;
-
-    NimbleSerializePartyAndSessionSecret partyAndSessionSecret;
-
-    NimbleSerializeJoinGameRequest joinGameRequest;
-
-    OrderedDatagramOutLogic orderedDatagramOut;
-    OrderedDatagramInLogic orderedDatagramIn;
-
-    size_t maximumSingleParticipantStepOctetCount;
-    size_t maximumNumberOfParticipants;
-    NimbleSerializeVersion applicationVersion;
-    NimbleSerializeClientRequestId connectRequestId;
-    Clog log;
-
-    bool lastUpdateMonotonicMsIsSet;
-    MonotonicTimeMs lastUpdateMonotonicMs;
-    size_t expectedTickDurationMs;
-    StatsInt tickDuration;
-
-    size_t latencyMs;
-
     Lagometer lagometer;
-
-    NimbleClientConnectionQuality quality;
-
-    bool useDebugStreams;
-    uint8_t remoteConnectionId;
-    bool wantsDebugStreams;
-    uint32_t loggingTickCount;
+    Clog log;
 } NimbleClient;
 
 int nimbleClientInit(NimbleClient* self, struct ImprintAllocator* memory,
                      struct ImprintAllocatorWithFree* blobAllocator, DatagramTransport* transport,
                      size_t maximumSingleParticipantStepOctetCount, size_t maximumNumberOfParticipants,
                      NimbleSerializeVersion applicationVersion, bool wantsDebugStreams, Clog log);
+size_t nimbleClientMemoryRequirements(size_t maximumSingleParticipantStepOctetCount, size_t maximumNumberOfParticipants,
+                                      size_t maximumGameStateOctetCount);
+int nimbleClientInitFromArena(NimbleClient* self, uint8_t* arena, size_t arenaOctetCount,
+                              struct ImprintAllocatorWithFree* blobAllocator, DatagramTransport* transport,
+                              size_t maximumSingleParticipantStepOctetCount, size_t maximumNumberOfParticipants,
+                              size_t maximumGameStateOctetCount, NimbleSerializeVersion applicationVersion,
+                              bool wantsDebugStreams, Clog log);
 void nimbleClientReset(NimbleClient* self);
 void nimbleClientReInit(NimbleClient* self, DatagramTransport* transport);
 void nimbleClientDestroy(NimbleClient* self);
 void nimbleClientDisconnect(NimbleClient* self);
 int nimbleClientUpdate(NimbleClient* self, MonotonicTimeMs now);
+int nimbleClientFlushSteps(NimbleClient* self);
+ssize_t nimbleClientReceive(NimbleClient* self, MonotonicTimeMs now);
+bool nimbleClientNextDeadline(const NimbleClient* self, MonotonicTimeMs* deadline);
+int nimbleClientPollTimeoutMs(const NimbleClient* self, MonotonicTimeMs now);
+void nimbleClientSetTransportPollHandle(NimbleClient* self, int handle);
+int nimbleClientTransportPollHandle(const NimbleClient* self);
+void nimbleClientSetClock(NimbleClient* self, NimbleClientClock clock);
+void nimbleClientSetTransportBatch(NimbleClient* self, NimbleClientTransportBatch transportBatch);
+void nimbleClientSetTransportLend(NimbleClient* self, NimbleClientTransportLend transportLend);
+void nimbleClientSetTransportTimestamp(NimbleClient* self, NimbleClientTransportTimestamp transportTimestamp);
+void nimbleClientSetGameStateReceiver(NimbleClient* self, NimbleClientGameStateReceiver receiver);
+void nimbleClientSetCompressedGameState(NimbleClient* self, bool wantsCompressedGameState);
+void nimbleClientSetDeltaResync(NimbleClient* self, bool useDeltaResync);
+void nimbleClientSetBlobStreamAckPacing(NimbleClient* self, size_t chunkWindow, MonotonicTimeMs intervalMs);
+void nimbleClientSetStats(NimbleClient* self, bool useStats);
+void nimbleClientSetTickDuration(NimbleClient* self, size_t tickDurationUs);
+MonotonicTimeMs nimbleClientNextTickAt(const NimbleClient* self);
+void nimbleClientSetPredictionMargin(NimbleClient* self, size_t percentile, MonotonicTimeMs safetyMarginMs);
+void nimbleClientSetTimeDilationTarget(NimbleClient* self, int targetBufferDelta);
+void nimbleClientSetPackedDatagrams(NimbleClient* self, bool usePackedDatagrams);
+void nimbleClientSetPipelinedJoin(NimbleClient* self, bool usePipelinedJoin);
 int nimbleClientFindParticipantId(const NimbleClient* self, uint8_t localUserDeviceIndex, uint8_t* participantId);
 int nimbleClientReJoin(NimbleClient* self);
 
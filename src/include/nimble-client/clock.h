@@ -0,0 +1,22 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_CLOCK_H
+#define NIMBLE_CLIENT_CLOCK_H
+
+#include <monotonic-time/monotonic_time.h>
+
+typedef MonotonicTimeMs (*NimbleClientClockNowFn)(void* self);
+
+/// Source of monotonic time for the nimble client.
+/// Can be replaced with a virtual clock to run the client faster than real time.
+typedef struct NimbleClientClock {
+    void* self;
+    NimbleClientClockNowFn now;
+} NimbleClientClock;
+
+NimbleClientClock nimbleClientClockMonotonic(void);
+MonotonicTimeMs nimbleClientClockNow(const NimbleClientClock* self);
+
+#endif
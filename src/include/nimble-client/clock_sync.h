@@ -0,0 +1,60 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_CLOCK_SYNC_H
+#define NIMBLE_CLIENT_CLOCK_SYNC_H
+
+#include <monotonic-time/monotonic_time.h>
+#include <nimble-steps/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NIMBLE_CLIENT_CLOCK_SYNC_SAMPLE_COUNT (32)
+#define NIMBLE_CLIENT_CLOCK_SYNC_DRIFT_INTERVAL_MS (2000)
+#define NIMBLE_CLIENT_CLOCK_SYNC_MAXIMUM_DRIFT_PPM (20000)
+#define NIMBLE_CLIENT_CLOCK_SYNC_STEP_OUT_COUNT (8)
+
+typedef struct NimbleClientClockSyncSample {
+    MonotonicTimeMs receivedAt;
+    MonotonicTimeMs rttMs;
+    int64_t offsetUs;
+} NimbleClientClockSyncSample;
+
+/// The sample window of NimbleClientClockSync. It is only used when a game step response arrives, so it is kept
+/// apart from the estimate that is read on every update.
+typedef struct NimbleClientClockSyncWindow {
+    NimbleClientClockSyncSample samples[NIMBLE_CLIENT_CLOCK_SYNC_SAMPLE_COUNT];
+    size_t sampleCount;
+    size_t writeIndex;
+} NimbleClientClockSyncWindow;
+
+/// Estimates the server clock from the game step responses, in the spirit of the NTP clock filter.
+/// The server clock is its step id times the tick duration. Each response gives an offset sample
+/// (the newest step id in it, plus half of the round trip time, minus the local receive time). The sample with
+/// the lowest round trip time in the window is used, since it has the least queuing delay, and the drift of the
+/// server tick rate against the local clock is tracked from how the selected offset moves over time.
+typedef struct NimbleClientClockSync {
+    NimbleClientClockSyncWindow* window;
+    bool hasDriftReference;
+    int64_t driftReferenceOffsetUs;
+    MonotonicTimeMs driftReferenceAt;
+    size_t outlierCount;
+
+    // Read by nimbleClientClockSyncServerStepId(), last so they are next to the fields that follow in NimbleClient
+    bool hasEstimate;
+    int64_t offsetUs;
+    MonotonicTimeMs offsetAt;
+    MonotonicTimeMs rttMs;
+    int64_t driftPpm;
+    size_t tickDurationUs;
+} NimbleClientClockSync;
+
+void nimbleClientClockSyncInit(NimbleClientClockSync* self, NimbleClientClockSyncWindow* window,
+                               size_t tickDurationUs);
+void nimbleClientClockSyncAddSample(NimbleClientClockSync* self, StepId stepId, MonotonicTimeMs receivedAt,
+                                    MonotonicTimeMs rttMs);
+bool nimbleClientClockSyncServerStepId(const NimbleClientClockSync* self, MonotonicTimeMs now, StepId* outStepId);
+
+#endif
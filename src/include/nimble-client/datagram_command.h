@@ -0,0 +1,25 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_DATAGRAM_COMMAND_H
+#define NIMBLE_CLIENT_DATAGRAM_COMMAND_H
+
+#include <stddef.h>
+
+struct FldOutStream;
+struct FldInStream;
+
+/// Command octet that starts a datagram with more than one command. The commands follow it, each with its octet
+/// count in front (see nimbleClientDatagramCommandBegin()). A datagram that starts with any other command octet has
+/// only that command. The nimble-serialize commands are all below it.
+#define NIMBLE_CLIENT_DATAGRAM_COMMAND_LIST (0xfe)
+
+size_t nimbleClientDatagramCommandsBegin(struct FldOutStream* outStream);
+int nimbleClientDatagramCommandsEnd(struct FldOutStream* outStream, size_t listStart);
+size_t nimbleClientDatagramCommandBegin(struct FldOutStream* outStream);
+int nimbleClientDatagramCommandEnd(struct FldOutStream* outStream, size_t commandStart);
+int nimbleClientDatagramCommandRead(struct FldInStream* inStream, struct FldInStream* commandStream);
+void nimbleClientDatagramCommandSkip(struct FldInStream* commandStream);
+
+#endif
@@ -8,6 +8,20 @@
 struct NimbleClient;
 struct FldInStream;
 
+/// Options octet that follows the client request id in the download game state request. The response echoes the
+/// options that the server agreed to, and each of them adds fields to the request or the response.
+/// This is a change of the protocol that the server must support: the client always asks for
+/// NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_OCTET_COUNT, since the blob stream has no size of its own, and can not
+/// download the game state from a server that does not answer with it.
+#define NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_OCTET_COUNT (0x01)
+/// In the request: the client accepts an LZ compressed game state. In the response: the game state is compressed,
+/// and the decoded octet count follows.
+#define NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_LZ (0x02)
+/// In the request: the hashes of the cached game state follow, and the server may only send the changed segments.
+/// In the response: the game state is a delta, and the full game state octet count and the changed segment mask
+/// follow.
+#define NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_DELTA (0x04)
+
 int nimbleClientOnDownloadGameStateResponse(struct NimbleClient* self, struct FldInStream* inStream);
 
 #endif
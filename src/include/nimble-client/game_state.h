@@ -17,6 +17,8 @@ typedef struct NimbleClientGameState {
 
 void nimbleClientGameStateInit(NimbleClientGameState* self, struct ImprintAllocatorWithFree* blobAllocator,
                                StepId stepId, const uint8_t* gameState, size_t gameStateOctetCount);
+void nimbleClientGameStateAdopt(NimbleClientGameState* self, struct ImprintAllocatorWithFree* blobAllocator,
+                                StepId stepId, uint8_t* gameState, size_t gameStateOctetCount);
 void nimbleClientGameStateReset(NimbleClientGameState* self);
 void nimbleClientGameStateDestroy(NimbleClientGameState* self);
 void nimbleClientGameStateDebug(const NimbleClientGameState* self, const char* debug);
@@ -0,0 +1,47 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_GAME_STATE_CACHE_H
+#define NIMBLE_CLIENT_GAME_STATE_CACHE_H
+
+#include <nimble-client/game_state.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct FldOutStream;
+
+#define NIMBLE_CLIENT_GAME_STATE_CACHE_MAX_SEGMENT_COUNT (64)
+#define NIMBLE_CLIENT_GAME_STATE_CACHE_MIN_SEGMENT_OCTET_COUNT (1024)
+
+/// The game state that the client had before a rejoin or reconnect, split into segments with a hash each.
+/// The hashes are sent in the download game state request, so the server only has to send the segments that differ.
+typedef struct NimbleClientGameStateCache {
+    NimbleClientGameState gameState;
+    size_t segmentOctetCount;
+    size_t segmentCount;
+    uint64_t segmentHashes[NIMBLE_CLIENT_GAME_STATE_CACHE_MAX_SEGMENT_COUNT];
+} NimbleClientGameStateCache;
+
+/// Describes a game state that is downloaded as a delta against the cached game state.
+/// The downloaded octets are the sent segments one after another. A segment is sent if its bit is set in
+/// changedSegmentMask, or if it is outside of the cached game state.
+typedef struct NimbleClientGameStateDelta {
+    bool isDelta;
+    size_t gameStateOctetCount;
+    uint64_t changedSegmentMask;
+} NimbleClientGameStateDelta;
+
+uint64_t nimbleClientGameStateHash(const uint8_t* octets, size_t octetCount);
+size_t nimbleClientGameStateSegmentOctetCount(size_t gameStateOctetCount);
+
+void nimbleClientGameStateCacheInit(NimbleClientGameStateCache* self);
+void nimbleClientGameStateCacheAdopt(NimbleClientGameStateCache* self, NimbleClientGameState* gameState);
+void nimbleClientGameStateCacheDestroy(NimbleClientGameStateCache* self);
+bool nimbleClientGameStateCacheIsSet(const NimbleClientGameStateCache* self);
+int nimbleClientGameStateCacheWriteHashes(const NimbleClientGameStateCache* self, struct FldOutStream* stream);
+int nimbleClientGameStateCacheApplyDelta(NimbleClientGameStateCache* self, const NimbleClientGameStateDelta* delta,
+                                         const uint8_t* octets, size_t octetCount, uint8_t** gameState);
+
+#endif
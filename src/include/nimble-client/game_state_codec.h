@@ -0,0 +1,40 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_GAME_STATE_CODEC_H
+#define NIMBLE_CLIENT_GAME_STATE_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum NimbleClientGameStateCodec {
+    NimbleClientGameStateCodecNone,
+    NimbleClientGameStateCodecLz,
+} NimbleClientGameStateCodec;
+
+/// Raw octet count of each compressed block. Blocks are small enough for the game state to be decoded
+/// while it is downloading.
+#define NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_OCTET_COUNT (16 * 1024)
+#define NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_HEADER_OCTET_COUNT (4)
+
+/// Decodes a compressed game state block by block, as the compressed octets become available in order
+typedef struct NimbleClientGameStateDecoder {
+    uint8_t* target;
+    size_t targetOctetCount;
+    size_t writeOffset;
+    size_t readOffset;
+} NimbleClientGameStateDecoder;
+
+void nimbleClientGameStateDecoderInit(NimbleClientGameStateDecoder* self, uint8_t* target, size_t targetOctetCount);
+int nimbleClientGameStateDecoderFeed(NimbleClientGameStateDecoder* self, const uint8_t* compressed,
+                                     size_t availableOctetCount);
+bool nimbleClientGameStateDecoderIsComplete(const NimbleClientGameStateDecoder* self);
+
+size_t nimbleClientGameStateEncodeMaxOctetCount(size_t rawOctetCount);
+ssize_t nimbleClientGameStateEncode(const uint8_t* raw, size_t rawOctetCount, uint8_t* target,
+                                    size_t targetOctetCount);
+
+#endif
@@ -0,0 +1,29 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_GAME_STATE_RECEIVER_H
+#define NIMBLE_CLIENT_GAME_STATE_RECEIVER_H
+
+#include <nimble-steps/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Receives the next in-order part of the game state while it is still downloading.
+/// The octets are only valid during the call.
+/// @param self application specific
+/// @param stateId the step id the game state was captured at
+/// @param offset octet offset of the part in the complete game state
+/// @param octets the part of the game state
+/// @param octetCount octet count of the part
+/// @param totalOctetCount octet count of the complete game state
+typedef void (*NimbleClientGameStateReceiveChunkFn)(void* self, StepId stateId, size_t offset, const uint8_t* octets,
+                                                    size_t octetCount, size_t totalOctetCount);
+
+/// Optional streaming receiver of the downloaded game state
+typedef struct NimbleClientGameStateReceiver {
+    void* self;
+    NimbleClientGameStateReceiveChunkFn receiveChunk;
+} NimbleClientGameStateReceiver;
+
+#endif
@@ -5,8 +5,12 @@
 #ifndef NIMBLE_CLIENT_INCOMING_H
 #define NIMBLE_CLIENT_INCOMING_H
 
+#include <monotonic-time/monotonic_time.h>
+
 struct NimbleClient;
 
 int nimbleClientFeed(struct NimbleClient* self, const uint8_t* data, size_t len);
+int nimbleClientFeedReceivedAt(struct NimbleClient* self, const uint8_t* data, size_t len,
+                               MonotonicTimeMs receivedAt);
 
 #endif
@@ -24,8 +24,11 @@ typedef struct NimbleClientRealizeSettings {
     DatagramTransport transport;
     struct ImprintAllocator* memory;
     struct ImprintAllocatorWithFree* blobMemory;
+    uint8_t* arena;
+    size_t arenaOctetCount;
     size_t maximumSingleParticipantStepOctetCount;
     size_t maximumNumberOfParticipants;
+    size_t maximumGameStateOctetCount;
     NimbleSerializeVersion applicationVersion;
     bool wantsDebugStreams;
     Clog log;
@@ -46,5 +49,7 @@ void nimbleClientRealizeDestroy(NimbleClientRealize* self);
 void nimbleClientRealizeReset(NimbleClientRealize* self);
 void nimbleClientRealizeQuitGame(NimbleClientRealize* self);
 void nimbleClientRealizeUpdate(NimbleClientRealize* self, MonotonicTimeMs now);
+void nimbleClientRealizeReceive(NimbleClientRealize* self, MonotonicTimeMs now);
+bool nimbleClientRealizeNextDeadline(const NimbleClientRealize* self, MonotonicTimeMs* deadline);
 
 #endif
@@ -0,0 +1,52 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_NETWORK_THREAD_H
+#define NIMBLE_CLIENT_NETWORK_THREAD_H
+
+#include <nimble-client/network_realizer.h>
+#include <nimble-client/step_queue.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined _WIN32
+#include <windows.h>
+typedef HANDLE NimbleClientThreadHandle;
+#else
+#include <pthread.h>
+typedef pthread_t NimbleClientThreadHandle;
+#endif
+
+struct ImprintAllocator;
+
+/// Runs receive, send and connection quality work of a client realizer on a dedicated thread.
+/// Once started, the game thread must only touch the realizer through the functions below:
+/// predicted steps and authoritative steps cross the thread boundary through single producer,
+/// single consumer step queues. The local participant ids can be read once the state is synced.
+typedef struct NimbleClientNetworkThread {
+    NimbleClientRealize* realize;
+    NimbleClientStepQueue predictedSteps;
+    NimbleClientStepQueue authoritativeSteps;
+    uint8_t* stepBuffer;
+    size_t stepBufferOctetCount;
+    bool hasPendingAuthoritativeStep;
+    StepId pendingAuthoritativeStepId;
+    size_t pendingAuthoritativeStepOctetCount;
+    volatile size_t isRunning;
+    volatile size_t publishedRealizeState;
+    NimbleClientThreadHandle thread;
+    Clog log;
+} NimbleClientNetworkThread;
+
+int nimbleClientNetworkThreadInit(NimbleClientNetworkThread* self, NimbleClientRealize* realize,
+                                  struct ImprintAllocator* memory, size_t queueCapacity);
+int nimbleClientNetworkThreadStart(NimbleClientNetworkThread* self);
+void nimbleClientNetworkThreadStop(NimbleClientNetworkThread* self);
+int nimbleClientNetworkThreadAddPredictedStep(NimbleClientNetworkThread* self, StepId stepId, const uint8_t* payload,
+                                              size_t octetCount);
+int nimbleClientNetworkThreadReadStep(NimbleClientNetworkThread* self, uint8_t* target, size_t maxTarget,
+                                      StepId* outStepId);
+NimbleClientRealizeState nimbleClientNetworkThreadState(const NimbleClientNetworkThread* self);
+
+#endif
@@ -5,9 +5,14 @@
 #ifndef NIMBLE_CLIENT_OUTGOING_H
 #define NIMBLE_CLIENT_OUTGOING_H
 
+#include <monotonic-time/monotonic_time.h>
+#include <stdbool.h>
+
 struct NimbleClient;
 struct DatagramTransportOut;
 
 int nimbleClientOutgoing(struct NimbleClient* self, struct DatagramTransportOut* transportOut);
+int nimbleClientSendBlobStreamAckIfDue(struct NimbleClient* self);
+bool nimbleClientBlobStreamAckDeadline(const struct NimbleClient* self, MonotonicTimeMs* deadline);
 
 #endif
@@ -0,0 +1,131 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_POOL_H
+#define NIMBLE_CLIENT_POOL_H
+
+#include <clog/clog.h>
+#include <datagram-transport/transport.h>
+#include <datagram-transport/types.h>
+#include <monotonic-time/monotonic_time.h>
+#include <nimble-client/network_realizer.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined _WIN32
+#include <windows.h>
+typedef HANDLE NimbleClientPoolThreadHandle;
+typedef CRITICAL_SECTION NimbleClientPoolMutex;
+typedef CONDITION_VARIABLE NimbleClientPoolCondition;
+#else
+#include <pthread.h>
+typedef pthread_t NimbleClientPoolThreadHandle;
+typedef pthread_mutex_t NimbleClientPoolMutex;
+typedef pthread_cond_t NimbleClientPoolCondition;
+#endif
+
+struct ImprintAllocator;
+struct NimbleClientPool;
+
+#define NIMBLE_CLIENT_POOL_MAX_WORKER_COUNT (64)
+#define NIMBLE_CLIENT_POOL_WORKER_OUT_DATAGRAM_CAPACITY (64)
+#define NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT (2)
+
+typedef uint16_t NimbleClientPoolConnectionId;
+
+typedef struct NimbleClientPoolDatagram {
+    uint8_t octets[NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT + DATAGRAM_TRANSPORT_MAX_SIZE];
+    size_t octetCount;
+    size_t nextIndex;
+} NimbleClientPoolDatagram;
+
+/// A client in the pool. The transport of a client that uses the shared transport points to its entry.
+typedef struct NimbleClientPoolEntry {
+    NimbleClientRealize realize;
+    struct NimbleClientPool* pool;
+    NimbleClientPoolConnectionId connectionId;
+    size_t workerIndex;
+    bool isUsed;
+    bool usesSharedTransport;
+} NimbleClientPoolEntry;
+
+typedef struct NimbleClientPoolWorker {
+    // begin index in the lower 32 bits and end index in the upper 32 bits. The owner takes from the front and the
+    // other workers steal from the back.
+    volatile uint64_t range;
+    struct NimbleClientPool* pool;
+    size_t index;
+    NimbleClientPoolDatagram* outDatagrams;
+    size_t outDatagramCount;
+    size_t updatedCount;
+    size_t stolenCount;
+    NimbleClientPoolThreadHandle thread;
+    // Keeps the range of the next worker out of the cache line that this worker writes to
+    uint8_t padding[64];
+} NimbleClientPoolWorker;
+
+typedef struct NimbleClientPoolStats {
+    size_t updateCount;
+    size_t receivedDatagramCount;
+    size_t droppedDatagramCount;
+    size_t stolenCount;
+} NimbleClientPoolStats;
+
+typedef struct NimbleClientPoolSettings {
+    struct ImprintAllocator* memory;
+    // Shared datagram transport. Set send to NULL if every client has its own transport.
+    DatagramTransport sharedTransport;
+    // Settings for each client, the transport is set when the client is added
+    NimbleClientRealizeSettings clientSettings;
+    size_t clientCapacity;
+    // Number of threads that update clients, including the thread that calls nimbleClientPoolUpdate()
+    size_t workerCount;
+    // Number of datagrams that can be received from the shared transport in each update
+    size_t inDatagramCapacity;
+    Clog log;
+} NimbleClientPoolSettings;
+
+/// Owns many clients, e.g. the bots of a load test, and updates them in batches on a set of worker threads.
+/// The clients are spread over the workers, and a worker that runs out of clients steals from the others.
+/// Clients can share one datagram transport (one socket). Each datagram on it starts with the
+/// NimbleClientPoolConnectionId of the client (big endian), and the server side is expected to send it back in
+/// front of the datagrams for that client, so they can be demultiplexed.
+typedef struct NimbleClientPool {
+    NimbleClientPoolEntry* entries;
+    size_t entryCount;
+    size_t clientCapacity;
+    NimbleClientRealizeSettings clientSettings;
+
+    DatagramTransport sharedTransport;
+    NimbleClientPoolDatagram* inDatagrams;
+    size_t inDatagramCount;
+    size_t inDatagramCapacity;
+    size_t* inHeadIndices;
+    size_t* inTailIndices;
+
+    NimbleClientPoolWorker workers[NIMBLE_CLIENT_POOL_MAX_WORKER_COUNT];
+    size_t workerCount;
+    bool isUpdating;
+    MonotonicTimeMs now;
+
+    NimbleClientPoolMutex mutex;
+    NimbleClientPoolCondition startCondition;
+    NimbleClientPoolCondition doneCondition;
+    NimbleClientPoolMutex sendMutex;
+    size_t generation;
+    size_t activeWorkerCount;
+    bool isRunning;
+
+    NimbleClientPoolStats stats;
+    Clog log;
+} NimbleClientPool;
+
+int nimbleClientPoolInit(NimbleClientPool* self, const NimbleClientPoolSettings* settings);
+void nimbleClientPoolDestroy(NimbleClientPool* self);
+NimbleClientRealize* nimbleClientPoolAdd(NimbleClientPool* self, const DatagramTransport* transport);
+void nimbleClientPoolRemove(NimbleClientPool* self, NimbleClientRealize* realize);
+int nimbleClientPoolUpdate(NimbleClientPool* self, MonotonicTimeMs now);
+
+#endif
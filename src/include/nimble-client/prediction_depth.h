@@ -0,0 +1,56 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_PREDICTION_DEPTH_H
+#define NIMBLE_CLIENT_PREDICTION_DEPTH_H
+
+#include <monotonic-time/monotonic_time.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define NIMBLE_CLIENT_PREDICTION_DEPTH_SAMPLE_COUNT (64)
+#define NIMBLE_CLIENT_PREDICTION_DEPTH_DEFAULT_PERCENTILE (95)
+#define NIMBLE_CLIENT_PREDICTION_DEPTH_DEFAULT_SAFETY_MARGIN_MS (2)
+#define NIMBLE_CLIENT_PREDICTION_DEPTH_LOWER_AFTER_SAMPLE_COUNT (120)
+#define NIMBLE_CLIENT_PREDICTION_DEPTH_MAXIMUM_LATE_TICK_COUNT (5)
+
+/// The round trip time window of NimbleClientPredictionDepth. It is only used when a round trip time is measured,
+/// so it is kept apart from the target depth that is read on every update.
+typedef struct NimbleClientPredictionDepthWindow {
+    MonotonicTimeMs roundTripTimesMs[NIMBLE_CLIENT_PREDICTION_DEPTH_SAMPLE_COUNT];
+    size_t sampleCount;
+    size_t writeIndex;
+} NimbleClientPredictionDepthWindow;
+
+/// Decides how many ticks ahead of the server the predicted steps are sent.
+/// A predicted step has to reach the server before the server composes the authoritative step for it, so the
+/// depth covers a percentile of the one-way delay plus a safety margin. The round trip times can not tell which
+/// direction the jitter was in, so the one-way delay is half of the lowest round trip time in the window plus the
+/// jitter percentile (how far the round trip time percentile is above the lowest).
+/// The depth is raised as soon as it is too low, since a late step is dropped by the server, but it is only
+/// lowered after it has been higher than needed for NIMBLE_CLIENT_PREDICTION_DEPTH_LOWER_AFTER_SAMPLE_COUNT
+/// samples in a row, so it does not flap between two values.
+typedef struct NimbleClientPredictionDepth {
+    // Read by nimbleClientOptimalStepIdToSend() on every update
+    bool hasTarget;
+    size_t targetTickCount;
+
+    size_t requiredTickCount;
+    MonotonicTimeMs oneWayDelayPercentileMs;
+    size_t aboveRequiredCount;
+
+    size_t tickDurationUs;
+    size_t percentile;
+    MonotonicTimeMs safetyMarginMs;
+
+    NimbleClientPredictionDepthWindow* window;
+} NimbleClientPredictionDepth;
+
+void nimbleClientPredictionDepthInit(NimbleClientPredictionDepth* self, NimbleClientPredictionDepthWindow* window,
+                                     size_t tickDurationUs, size_t percentile, MonotonicTimeMs safetyMarginMs);
+void nimbleClientPredictionDepthReset(NimbleClientPredictionDepth* self);
+void nimbleClientPredictionDepthAddRtt(NimbleClientPredictionDepth* self, MonotonicTimeMs rttMs);
+void nimbleClientPredictionDepthAddBufferDelta(NimbleClientPredictionDepth* self, int bufferDelta);
+
+#endif
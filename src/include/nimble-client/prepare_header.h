@@ -5,11 +5,14 @@
 #ifndef NIMBLE_CLIENT_PREPARE_HEADER_H
 #define NIMBLE_CLIENT_PREPARE_HEADER_H
 
+#include <monotonic-time/monotonic_time.h>
+
 struct NimbleClient;
 struct FldOutStream;
 struct FldOutStreamStoredPosition;
 
 int nimbleClientWriteHeader(struct NimbleClient* self, struct FldOutStream* outStream);
+int nimbleClientWriteHeaderAt(struct NimbleClient* self, struct FldOutStream* outStream, MonotonicTimeMs sentAt);
 void nimbleClientCommitHeader(struct NimbleClient* self);
 
 #endif
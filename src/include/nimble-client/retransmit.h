@@ -0,0 +1,42 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_RETRANSMIT_H
+#define NIMBLE_CLIENT_RETRANSMIT_H
+
+#include <monotonic-time/monotonic_time.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NIMBLE_CLIENT_RTO_INITIAL_MS (100)
+#define NIMBLE_CLIENT_RTO_MINIMUM_MS (30)
+#define NIMBLE_CLIENT_RTO_MAXIMUM_MS (2000)
+
+/// Retransmission timeout estimator (as in RFC 6298), fed with the round trip times measured by the pongs.
+typedef struct NimbleClientRto {
+    bool hasSample;
+    MonotonicTimeMs smoothedRttMs;
+    MonotonicTimeMs rttVariationMs;
+    MonotonicTimeMs rtoMs;
+    uint64_t randomState;
+} NimbleClientRto;
+
+/// Schedule for a request that is resent until its response arrives.
+/// Every resend doubles the timeout, up to NIMBLE_CLIENT_RTO_MAXIMUM_MS, and adds a random jitter.
+typedef struct NimbleClientRequestTimer {
+    bool isSent;
+    MonotonicTimeMs resendAt;
+    size_t resendCount;
+} NimbleClientRequestTimer;
+
+void nimbleClientRtoInit(NimbleClientRto* self, uint64_t seed);
+void nimbleClientRtoAddSample(NimbleClientRto* self, MonotonicTimeMs rttMs);
+
+void nimbleClientRequestTimerReset(NimbleClientRequestTimer* self);
+bool nimbleClientRequestTimerIsDue(const NimbleClientRequestTimer* self, MonotonicTimeMs now);
+MonotonicTimeMs nimbleClientRequestTimerDeadline(const NimbleClientRequestTimer* self, MonotonicTimeMs now);
+void nimbleClientRequestTimerSent(NimbleClientRequestTimer* self, NimbleClientRto* rto, MonotonicTimeMs now);
+
+#endif
@@ -5,9 +5,16 @@
 #ifndef NIMBLE_CLIENT_OUTGOING_SEND_STEPS_H
 #define NIMBLE_CLIENT_OUTGOING_SEND_STEPS_H
 
+#include <monotonic-time/monotonic_time.h>
+#include <stddef.h>
+
 struct NimbleClient;
 struct DatagramTransportOut;
+struct FldOutStream;
 
 int nimbleClientSendStepsToServer(struct NimbleClient* self, struct DatagramTransportOut* transportOut);
+int nimbleClientSendStepsToServerAt(struct NimbleClient* self, struct DatagramTransportOut* transportOut,
+                                    MonotonicTimeMs sentAt);
+ssize_t nimbleClientWriteStepsToStream(struct NimbleClient* self, struct FldOutStream* stream);
 
 #endif
@@ -0,0 +1,43 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_STEP_QUEUE_H
+#define NIMBLE_CLIENT_STEP_QUEUE_H
+
+#include <nimble-steps/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ImprintAllocator;
+
+#define NIMBLE_CLIENT_STEP_QUEUE_CACHE_LINE_SIZE (64)
+
+typedef struct NimbleClientStepQueueSlot {
+    StepId stepId;
+    size_t octetCount;
+    uint8_t* payload;
+} NimbleClientStepQueueSlot;
+
+/// Lock-free single producer, single consumer queue of steps.
+/// The write and read positions are kept on separate cache lines, so the producer and consumer threads
+/// do not invalidate each other's cache line on every step.
+typedef struct NimbleClientStepQueue {
+    NimbleClientStepQueueSlot* slots;
+    size_t capacity;
+    size_t maxOctetCount;
+    uint8_t paddingBeforeWrite[NIMBLE_CLIENT_STEP_QUEUE_CACHE_LINE_SIZE];
+    volatile size_t writeCount;
+    uint8_t paddingBeforeRead[NIMBLE_CLIENT_STEP_QUEUE_CACHE_LINE_SIZE];
+    volatile size_t readCount;
+    uint8_t paddingAfterRead[NIMBLE_CLIENT_STEP_QUEUE_CACHE_LINE_SIZE];
+} NimbleClientStepQueue;
+
+int nimbleClientStepQueueInit(NimbleClientStepQueue* self, struct ImprintAllocator* memory, size_t capacity,
+                              size_t maxOctetCount);
+int nimbleClientStepQueueWrite(NimbleClientStepQueue* self, StepId stepId, const uint8_t* payload, size_t octetCount);
+int nimbleClientStepQueueRead(NimbleClientStepQueue* self, StepId* stepId, uint8_t* target, size_t maxTarget);
+size_t nimbleClientStepQueueCount(const NimbleClientStepQueue* self);
+size_t nimbleClientStepQueueFreeCount(const NimbleClientStepQueue* self);
+
+#endif
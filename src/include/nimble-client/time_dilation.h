@@ -0,0 +1,35 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_TIME_DILATION_H
+#define NIMBLE_CLIENT_TIME_DILATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NIMBLE_CLIENT_TIME_DILATION_DEFAULT_TARGET_BUFFER_DELTA (2)
+#define NIMBLE_CLIENT_TIME_DILATION_FILTER_SHIFT (4)
+#define NIMBLE_CLIENT_TIME_DILATION_DEAD_BAND_MILLI_STEPS (500)
+#define NIMBLE_CLIENT_TIME_DILATION_PPM_PER_STEP (10000)
+#define NIMBLE_CLIENT_TIME_DILATION_MAXIMUM_PPM (20000)
+
+/// Recommends a local tick rate multiplier (about 0.98 - 1.02) that makes the predicted steps drift towards
+/// arriving `targetBufferDelta` steps ahead on the server, instead of the application skipping or stalling ticks
+/// when the buffer runs too full or too empty.
+/// It follows the buffer delta that the server reports in every game step response, smoothed with an exponential
+/// moving average (1 / 2^NIMBLE_CLIENT_TIME_DILATION_FILTER_SHIFT). Within the dead band around the target the
+/// multiplier is exactly one.
+typedef struct NimbleClientTimeDilation {
+    int targetBufferDelta;
+    bool hasSample;
+    int32_t filteredBufferDeltaMilliSteps;
+    int32_t rateAdjustPpm;
+} NimbleClientTimeDilation;
+
+void nimbleClientTimeDilationInit(NimbleClientTimeDilation* self, int targetBufferDelta);
+void nimbleClientTimeDilationReset(NimbleClientTimeDilation* self);
+void nimbleClientTimeDilationAddBufferDelta(NimbleClientTimeDilation* self, int bufferDelta);
+float nimbleClientTimeDilationMultiplier(const NimbleClientTimeDilation* self);
+
+#endif
@@ -0,0 +1,26 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_TRANSPORT_BATCH_H
+#define NIMBLE_CLIENT_TRANSPORT_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define NIMBLE_CLIENT_RECEIVE_BATCH_MAX_COUNT (8)
+
+/// Receives up to maxDatagramCount datagrams in one call, e.g. using recvmmsg().
+/// Datagram i is written to datagrams + i * datagramOctetSize and its octet count to octetCounts[i].
+/// @return number of datagrams received, zero if none are available, negative on error
+typedef ssize_t (*NimbleClientTransportReceiveBatchFn)(void* self, uint8_t* datagrams, size_t datagramOctetSize,
+                                                       size_t* octetCounts, size_t maxDatagramCount);
+
+/// Optional extension of the DatagramTransport that the client uses when it is set
+typedef struct NimbleClientTransportBatch {
+    void* self;
+    NimbleClientTransportReceiveBatchFn receiveBatch;
+} NimbleClientTransportBatch;
+
+#endif
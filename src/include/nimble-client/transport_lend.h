@@ -0,0 +1,27 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_TRANSPORT_LEND_H
+#define NIMBLE_CLIENT_TRANSPORT_LEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/// Lends the next received datagram from a buffer owned by the transport.
+/// The octets must stay valid until the release function is called.
+/// @return octet count of the datagram, zero if none is available, negative on error
+typedef ssize_t (*NimbleClientTransportLendFn)(void* self, const uint8_t** octets);
+
+/// Gives the buffer of the last lent datagram back to the transport
+typedef void (*NimbleClientTransportReleaseFn)(void* self);
+
+/// Optional extension of the DatagramTransport that lets the client parse datagrams in place
+typedef struct NimbleClientTransportLend {
+    void* self;
+    NimbleClientTransportLendFn lend;
+    NimbleClientTransportReleaseFn release;
+} NimbleClientTransportLend;
+
+#endif
@@ -0,0 +1,33 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_TRANSPORT_TIMESTAMP_H
+#define NIMBLE_CLIENT_TRANSPORT_TIMESTAMP_H
+
+#include <monotonic-time/monotonic_time.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/// Gets the time that the last received datagram arrived, e.g. from the kernel receive timestamp that came with it.
+/// datagramIndex is the index of the datagram in the last batch of NimbleClientTransportBatch, and zero when the
+/// datagram was received with the DatagramTransport or lent with NimbleClientTransportLend.
+/// @return true if the arrival time is known
+typedef bool (*NimbleClientTransportReceivedAtFn)(void* self, size_t datagramIndex, MonotonicTimeMs* receivedAt);
+
+/// Optional extension of the DatagramTransport. With it, the round trip times are measured from when a datagram
+/// arrived, instead of from when the client got around to reading it.
+typedef struct NimbleClientTransportTimestamp {
+    void* self;
+    NimbleClientTransportReceivedAtFn receivedAt;
+} NimbleClientTransportTimestamp;
+
+#if defined __linux__
+struct msghdr;
+
+int nimbleClientTransportTimestampEnable(int socketHandle);
+bool nimbleClientTransportTimestampFromMessage(struct msghdr* message, MonotonicTimeMs now,
+                                               MonotonicTimeMs* receivedAt);
+#endif
+
+#endif
@@ -5,6 +5,7 @@
 #ifndef NIMBLE_CLIENT_UTILS_H
 #define NIMBLE_CLIENT_UTILS_H
 
+#include <monotonic-time/monotonic_time.h>
 #include <nimble-steps/types.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -12,5 +13,8 @@
 struct NimbleClient;
 
 bool nimbleClientOptimalStepIdToSend(const struct NimbleClient* self, StepId* outStepId, size_t* outDiff);
+bool nimbleClientEstimatedServerStepId(const struct NimbleClient* self, MonotonicTimeMs now, StepId* outStepId);
+float nimbleClientRecommendedTickRateMultiplier(const struct NimbleClient* self);
+bool nimbleClientWireUsesDebugInfo(const struct NimbleClient* self);
 
 #endif
@@ -2,13 +2,34 @@
  *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
  *  Licensed under the MIT License. See LICENSE in the project root for license information.
  *--------------------------------------------------------------------------------------------------------*/
-#include <monotonic-time/monotonic_time.h>
+#include <imprint/allocator.h>
+#include <imprint/linear_allocator.h>
 #include <nimble-client/client.h>
 #include <nimble-client/outgoing.h>
 #include <nimble-client/receive_transport.h>
+#include <nimble-client/send_steps.h>
 #include <nimble-steps-serialize/out_serialize.h>
 #include <secure-random/secure_random.h>
 #include <inttypes.h>
+#include <stddef.h>
+
+// The fields before the step buffers are read by every update of a synced client. The build fails (negative array
+// size) if they grow past 12 cache lines, 632 octets are used on x86-64.
+typedef char NimbleClientHotFieldsFitCacheLines[offsetof(NimbleClient, outSteps) <= 12 * 64 ? 1 : -1];
+
+/// Frees the blob stream and the decoded game state of a download that did not complete (or was not taken over
+/// by the joined game state)
+static void releaseDownload(NimbleClient* self)
+{
+    if (self->blobStreamInIsAllocated) {
+        blobStreamInDestroy(&self->blobStreamIn);
+        self->blobStreamInIsAllocated = false;
+    }
+    if (self->gameStateDecoder.target != 0) {
+        IMPRINT_FREE(self->blobStreamAllocator, self->gameStateDecoder.target);
+        self->gameStateDecoder.target = 0;
+    }
+}
 
 /// Resets the nimble client so it can be reused for the same transport
 /// @param self nimble client
@@ -17,9 +38,8 @@ void nimbleClientReset(NimbleClient* self)
     nbsStepsReset(&self->outSteps);
     nbsPendingStepsReset(&self->authoritativePendingStepsFromServer, 0);
 
-    size_t combinedStepOctetCount = nbsStepsOutSerializeCalculateCombinedSize(
-        self->maximumNumberOfParticipants, self->maximumSingleParticipantStepOctetCount);
-    nbsStepsInit(&self->authoritativeStepsFromServer, self->memory, combinedStepOctetCount, self->log);
+    // The step storage is allocated once in init, so a reconnect does not allocate it again
+    nbsStepsReset(&self->authoritativeStepsFromServer);
 
     self->receivedStepIdByServerOnlyForDebug = NIMBLE_STEP_MAX;
 
@@ -37,7 +57,9 @@ void nimbleClientReset(NimbleClient* self)
     statsIntInit(&self->latencyMsStat, 20);
     self->lastUpdateMonotonicMsIsSet = false;
 
-    MonotonicTimeMs now = monotonicTimeMsNow();
+    MonotonicTimeMs now = nimbleClientClockNow(&self->clock);
+    self->now = now;
+    self->datagramReceivedAt = now;
 
     statsIntInit(&self->authoritativeBufferDeltaStat, 10);
     statsIntPerSecondInit(&self->packetsPerSecondOut, now, 1000);
@@ -45,14 +67,30 @@ void nimbleClientReset(NimbleClient* self)
     statsIntPerSecondInit(&self->simulationStepsPerSecond, now, 1000);
     statsIntPerSecondInit(&self->sentStepsDatagramCountPerSecond, now, 1000);
 
-    self->useStats = true;
     self->state = NimbleClientStateIdle;
+    nimbleClientRtoInit(&self->rto, secureRandomUInt64());
+    nimbleClientClockSyncInit(&self->clockSync, &self->clockSyncWindow, self->expectedTickDurationUs);
+    nimbleClientPredictionDepthReset(&self->predictionDepth);
+    nimbleClientTimeDilationReset(&self->timeDilation);
+    nimbleClientRequestTimerReset(&self->requestTimer);
+    nimbleClientRequestTimerReset(&self->joinGameRequestTimer);
 
     if (self->joinedGameState.gameState != 0) {
-        nimbleClientGameStateDestroy(&self->joinedGameState);
+        if (self->useDeltaResync) {
+            // Kept so the next download only has to transfer the parts of the game state that changed
+            nimbleClientGameStateCacheAdopt(&self->gameStateCache, &self->joinedGameState);
+        } else {
+            nimbleClientGameStateDestroy(&self->joinedGameState);
+        }
     }
     self->joinedGameState.gameState = 0;
+    self->gameStateDelta.isDelta = false;
+    releaseDownload(self);
+    self->joinStateChannel = 0;
+    self->gameStateDeliveredOctetCount = 0;
+    self->gameStateCodec = NimbleClientGameStateCodecNone;
     self->downloadStateClientRequestId = 1;
+    self->downloadStateRequestOptions = 0;
     nimbleClientConnectionQualityReset(&self->quality);
     orderedDatagramInLogicInit(&self->orderedDatagramIn);
     orderedDatagramOutLogicInit(&self->orderedDatagramOut);
@@ -68,23 +106,16 @@ void nimbleClientReInit(NimbleClient* self, DatagramTransport* transport)
     nimbleClientReset(self);
 }
 
-/// Initializes a nimble client
-/// @param self nimble client
-/// @param memory tagAllocator
-/// @param blobAllocator freeAllocator
-/// @param transport the datagram transport to use
-/// @param maximumSingleParticipantStepOctetCount application specific step octet size
-/// @param maximumNumberOfParticipants maximum number of participants in a game
-/// @param applicationVersion application specific version
-/// @param log logging target
-/// @return negative on error
-int nimbleClientInit(NimbleClient* self, struct ImprintAllocator* memory,
-                     struct ImprintAllocatorWithFree* blobAllocator, DatagramTransport* transport,
-                     size_t maximumSingleParticipantStepOctetCount, size_t maximumNumberOfParticipants,
-                     NimbleSerializeVersion applicationVersion, bool wantsDebugStreams, Clog log)
+static int initClient(NimbleClient* self, struct ImprintAllocator* memory,
+                      struct ImprintAllocatorWithFree* blobAllocator, DatagramTransport* transport,
+                      size_t maximumSingleParticipantStepOctetCount, size_t maximumNumberOfParticipants,
+                      NimbleSerializeVersion applicationVersion, bool wantsDebugStreams, Clog log)
 {
     self->log = log;
     self->useDebugStreams = false;
+    self->usePackedDatagrams = false;
+    self->usePipelinedJoin = false;
+    self->useStats = true;
     self->wantsDebugStreams = wantsDebugStreams;
     self->applicationVersion = applicationVersion;
     self->connectRequestId = 0;
@@ -105,7 +136,8 @@ int nimbleClientInit(NimbleClient* self, struct ImprintAllocator* memory,
     }
 
     self->memory = memory;
-    self->expectedTickDurationMs = 16;
+    self->clock = nimbleClientClockMonotonic();
+    self->expectedTickDurationUs = NIMBLE_CLIENT_DEFAULT_TICK_DURATION_US;
     self->blobStreamAllocator = blobAllocator;
     self->joinedGameState.gameState = 0;
     self->maximumSingleParticipantStepOctetCount = maximumSingleParticipantStepOctetCount;
@@ -113,6 +145,23 @@ int nimbleClientInit(NimbleClient* self, struct ImprintAllocator* memory,
 
     self->state = NimbleClientStateIdle;
     self->transport = *transport;
+    self->transportBatch.self = 0;
+    self->transportBatch.receiveBatch = 0;
+    self->transportLend.self = 0;
+    self->transportLend.lend = 0;
+    self->transportLend.release = 0;
+    self->transportTimestamp.self = 0;
+    self->transportTimestamp.receivedAt = 0;
+    self->transportPollHandle = -1;
+    self->blobStreamInIsAllocated = false;
+    self->gameStateReceiver.self = 0;
+    self->gameStateReceiver.receiveChunk = 0;
+    self->wantsCompressedGameState = false;
+    self->gameStateDecoder.target = 0;
+    self->useDeltaResync = false;
+    nimbleClientGameStateCacheInit(&self->gameStateCache);
+    self->blobStreamAckChunkWindow = NIMBLE_CLIENT_BLOB_STREAM_ACK_CHUNK_WINDOW;
+    self->blobStreamAckIntervalMs = NIMBLE_CLIENT_BLOB_STREAM_ACK_INTERVAL_MS;
 
     size_t combinedStepOctetCount = nbsStepsOutSerializeCalculateCombinedSize(maximumNumberOfParticipants,
                                                                               maximumSingleParticipantStepOctetCount);
@@ -120,6 +169,10 @@ int nimbleClientInit(NimbleClient* self, struct ImprintAllocator* memory,
     nbsStepsInit(&self->outSteps, memory, combinedStepOctetCount, log);
     nbsPendingStepsInit(&self->authoritativePendingStepsFromServer, 0, blobAllocator, log);
     nbsStepsInit(&self->authoritativeStepsFromServer, self->memory, combinedStepOctetCount, log);
+    nimbleClientPredictionDepthInit(&self->predictionDepth, &self->predictionDepthWindow, self->expectedTickDurationUs,
+                                    NIMBLE_CLIENT_PREDICTION_DEPTH_DEFAULT_PERCENTILE,
+                                    NIMBLE_CLIENT_PREDICTION_DEPTH_DEFAULT_SAFETY_MARGIN_MS);
+    nimbleClientTimeDilationInit(&self->timeDilation, NIMBLE_CLIENT_TIME_DILATION_DEFAULT_TARGET_BUFFER_DELTA);
 
     nimbleClientReInit(self, transport);
     nimbleClientConnectionQualityInit(&self->quality, log);
@@ -127,6 +180,244 @@ int nimbleClientInit(NimbleClient* self, struct ImprintAllocator* memory,
     return 0;
 }
 
+/// Initializes a nimble client
+/// @param self nimble client
+/// @param memory tagAllocator
+/// @param blobAllocator freeAllocator
+/// @param transport the datagram transport to use
+/// @param maximumSingleParticipantStepOctetCount application specific step octet size
+/// @param maximumNumberOfParticipants maximum number of participants in a game
+/// @param applicationVersion application specific version
+/// @param log logging target
+/// @return negative on error
+int nimbleClientInit(NimbleClient* self, struct ImprintAllocator* memory,
+                     struct ImprintAllocatorWithFree* blobAllocator, DatagramTransport* transport,
+                     size_t maximumSingleParticipantStepOctetCount, size_t maximumNumberOfParticipants,
+                     NimbleSerializeVersion applicationVersion, bool wantsDebugStreams, Clog log)
+{
+    self->usesArena = false;
+    self->maximumGameStateOctetCount = 0;
+
+    return initClient(self, memory, blobAllocator, transport, maximumSingleParticipantStepOctetCount,
+                      maximumNumberOfParticipants, applicationVersion, wantsDebugStreams, log);
+}
+
+static size_t arenaAllocationOctetCount(size_t octetCount)
+{
+    // One extra alignment, in case the linear allocator aligns the start of the allocation
+    return (octetCount / NIMBLE_CLIENT_ARENA_ALIGNMENT + 2) * NIMBLE_CLIENT_ARENA_ALIGNMENT;
+}
+
+static size_t blobStreamInMemoryOctetCount(size_t maximumGameStateOctetCount)
+{
+    // The blob stream only allocates the received chunk bits from it, the blob itself is from the blob allocator
+    size_t maximumBlobOctetCount = nimbleClientGameStateEncodeMaxOctetCount(maximumGameStateOctetCount);
+    size_t chunkCount = (maximumBlobOctetCount + NIMBLE_CLIENT_GAME_STATE_CHUNK_SIZE - 1) /
+                        NIMBLE_CLIENT_GAME_STATE_CHUNK_SIZE;
+
+    return arenaAllocationOctetCount((chunkCount + 63) / 64 * sizeof(uint64_t));
+}
+
+/// Calculates the arena size that nimbleClientInitFromArena() needs
+/// @param maximumSingleParticipantStepOctetCount application specific step octet size
+/// @param maximumNumberOfParticipants maximum number of participants in a game
+/// @param maximumGameStateOctetCount largest (uncompressed) game state that can be downloaded
+/// @return arena octet count
+size_t nimbleClientMemoryRequirements(size_t maximumSingleParticipantStepOctetCount, size_t maximumNumberOfParticipants,
+                                      size_t maximumGameStateOctetCount)
+{
+    size_t combinedStepOctetCount = nbsStepsOutSerializeCalculateCombinedSize(maximumNumberOfParticipants,
+                                                                              maximumSingleParticipantStepOctetCount);
+    size_t stepsOctetCount = arenaAllocationOctetCount(combinedStepOctetCount * NBS_WINDOW_SIZE);
+
+    // outSteps and authoritativeStepsFromServer
+    return 2 * stepsOctetCount + blobStreamInMemoryOctetCount(maximumGameStateOctetCount);
+}
+
+/// Initializes a nimble client that takes all of its fixed size memory from the arena, which must be at least
+/// nimbleClientMemoryRequirements() octets and live as long as the client. Nothing is allocated from the arena after
+/// init, so reset, reinit and rejoin keep the memory footprint constant. The game state and the pending steps are
+/// still allocated from and returned to the blobAllocator, since their size is only known when they arrive.
+/// @param self nimble client
+/// @param arena caller owned memory
+/// @param arenaOctetCount octet count of arena
+/// @param blobAllocator freeAllocator
+/// @param transport the datagram transport to use
+/// @param maximumSingleParticipantStepOctetCount application specific step octet size
+/// @param maximumNumberOfParticipants maximum number of participants in a game
+/// @param maximumGameStateOctetCount largest (uncompressed) game state that can be downloaded
+/// @param applicationVersion application specific version
+/// @param log logging target
+/// @return negative on error
+int nimbleClientInitFromArena(NimbleClient* self, uint8_t* arena, size_t arenaOctetCount,
+                              struct ImprintAllocatorWithFree* blobAllocator, DatagramTransport* transport,
+                              size_t maximumSingleParticipantStepOctetCount, size_t maximumNumberOfParticipants,
+                              size_t maximumGameStateOctetCount, NimbleSerializeVersion applicationVersion,
+                              bool wantsDebugStreams, Clog log)
+{
+    size_t requiredOctetCount = nimbleClientMemoryRequirements(
+        maximumSingleParticipantStepOctetCount, maximumNumberOfParticipants, maximumGameStateOctetCount);
+    if (arenaOctetCount < requiredOctetCount) {
+        CLOG_C_SOFT_ERROR(&log, "nimbleClientInitFromArena. arena is too small %zu of %zu", arenaOctetCount,
+                          requiredOctetCount)
+        return -1;
+    }
+
+    size_t blobStreamInOctetCount = blobStreamInMemoryOctetCount(maximumGameStateOctetCount);
+    imprintLinearAllocatorInit(&self->blobStreamInMemory, arena, blobStreamInOctetCount, "nimble client blob stream");
+    imprintLinearAllocatorInit(&self->arena, arena + blobStreamInOctetCount, arenaOctetCount - blobStreamInOctetCount,
+                               "nimble client");
+    self->usesArena = true;
+    self->maximumGameStateOctetCount = maximumGameStateOctetCount;
+
+    return initClient(self, &self->arena.info, blobAllocator, transport, maximumSingleParticipantStepOctetCount,
+                      maximumNumberOfParticipants, applicationVersion, wantsDebugStreams, log);
+}
+
+/// Replaces the clock that the client reads time from when it is not given a time explicitly
+/// @param self nimble client
+/// @param clock clock to use
+void nimbleClientSetClock(NimbleClient* self, NimbleClientClock clock)
+{
+    self->clock = clock;
+    self->now = nimbleClientClockNow(&self->clock);
+}
+
+/// Lets the client receive several datagrams per call instead of using the receive function of the transport.
+/// Must read from the same connection as the transport. Set receiveBatch to NULL to turn it off.
+/// @param self nimble client
+/// @param transportBatch batch receive extension of the transport
+void nimbleClientSetTransportBatch(NimbleClient* self, NimbleClientTransportBatch transportBatch)
+{
+    self->transportBatch = transportBatch;
+}
+
+/// Lets the client parse received datagrams directly from buffers owned by the transport.
+/// Must read from the same connection as the transport. Set lend to NULL to turn it off.
+/// Takes precedence over the batch receive extension.
+/// @param self nimble client
+/// @param transportLend lend extension of the transport
+void nimbleClientSetTransportLend(NimbleClient* self, NimbleClientTransportLend transportLend)
+{
+    self->transportLend = transportLend;
+}
+
+/// Lets the client measure the round trip times from when the datagrams arrived, e.g. using kernel receive
+/// timestamps (see nimbleClientTransportTimestampFromMessage()), instead of from when they were read.
+/// Set receivedAt to NULL to turn it off.
+/// @param self nimble client
+/// @param transportTimestamp receive timestamp extension of the transport
+void nimbleClientSetTransportTimestamp(NimbleClient* self, NimbleClientTransportTimestamp transportTimestamp)
+{
+    self->transportTimestamp = transportTimestamp;
+}
+
+/// Streams the downloaded game state to the receiver, chunk by chunk in order, while it is downloading.
+/// The client then does not keep its own copy of the game state in joinedGameState.
+/// Set receiveChunk to NULL to get the complete game state in joinedGameState instead.
+/// @param self nimble client
+/// @param receiver game state receiver
+void nimbleClientSetGameStateReceiver(NimbleClient* self, NimbleClientGameStateReceiver receiver)
+{
+    self->gameStateReceiver = receiver;
+}
+
+/// Asks the server to send the game state compressed. The game state is decoded while it is downloading.
+/// The server is free to send it uncompressed anyway.
+/// @param self nimble client
+/// @param wantsCompressedGameState true to accept a compressed game state
+void nimbleClientSetCompressedGameState(NimbleClient* self, bool wantsCompressedGameState)
+{
+    self->wantsCompressedGameState = wantsCompressedGameState;
+}
+
+/// Keeps the game state when the client is reset or rejoins, and sends hashes of it in the download game state
+/// request. The server can then send only the parts of the game state that changed, which makes a rejoin after a
+/// short disconnect much cheaper. Has no effect when a game state receiver is set, since the client has no copy
+/// of the game state then.
+/// @param self nimble client
+/// @param useDeltaResync true to download the game state as a delta against the previous one
+void nimbleClientSetDeltaResync(NimbleClient* self, bool useDeltaResync)
+{
+    self->useDeltaResync = useDeltaResync;
+    if (!useDeltaResync) {
+        nimbleClientGameStateCacheDestroy(&self->gameStateCache);
+    }
+}
+
+/// Sets how often the received game state chunks are acked while downloading, independent of nimbleClientUpdate().
+/// An ack is sent as soon as chunkWindow chunks have arrived since the last ack, or when intervalMs has passed
+/// since the last ack and there are chunks that have not been acked. The server can only advance its send window
+/// when it receives an ack, so acking more often lets the download follow the link capacity instead of the tick rate.
+/// @param self nimble client
+/// @param chunkWindow number of received chunks that triggers an ack, zero to not ack on arrival
+/// @param intervalMs maximum time to hold back an ack, zero to only ack on arrival and in nimbleClientUpdate()
+void nimbleClientSetBlobStreamAckPacing(NimbleClient* self, size_t chunkWindow, MonotonicTimeMs intervalMs)
+{
+    self->blobStreamAckChunkWindow = chunkWindow;
+    self->blobStreamAckIntervalMs = intervalMs;
+}
+
+/// Turns the diagnostic stats (latency, packets and steps per second, buffer counts, tick duration and the
+/// lagometer) on or off. They are on by default. Turning them off keeps an update from touching them, which
+/// matters when a process updates many clients. The prediction does not use them.
+/// @param self nimble client
+/// @param useStats true to collect the diagnostic stats
+void nimbleClientSetStats(NimbleClient* self, bool useStats)
+{
+    self->useStats = useStats;
+}
+
+/// Sets how much of the network delay the prediction depth covers. Higher values cost more rollbacks, lower values
+/// make it more likely that a predicted step reaches the server too late and is dropped.
+/// @param self nimble client
+/// @param percentile percentile (0-100) of the one-way delays that the depth covers
+/// @param safetyMarginMs added to the one-way delay percentile
+void nimbleClientSetPredictionMargin(NimbleClient* self, size_t percentile, MonotonicTimeMs safetyMarginMs)
+{
+    self->predictionDepth.percentile = percentile > 100 ? 100 : percentile;
+    self->predictionDepth.safetyMarginMs = safetyMarginMs;
+}
+
+/// Sets the number of steps that the predicted steps should arrive ahead on the server. The recommended tick rate
+/// multiplier (nimbleClientRecommendedTickRateMultiplier()) steers towards it.
+/// @param self nimble client
+/// @param targetBufferDelta target buffer delta in steps
+void nimbleClientSetTimeDilationTarget(NimbleClient* self, int targetBufferDelta)
+{
+    self->timeDilation.targetBufferDelta = targetBufferDelta;
+}
+
+/// Sets the duration of a tick (step), it must be the same as on the server. Call it before connecting.
+/// @param self nimble client
+/// @param tickDurationUs tick duration in microseconds, e.g. 8333 for 120 Hz
+void nimbleClientSetTickDuration(NimbleClient* self, size_t tickDurationUs)
+{
+    self->expectedTickDurationUs = tickDurationUs;
+    self->clockSync.tickDurationUs = tickDurationUs;
+    self->predictionDepth.tickDurationUs = tickDurationUs;
+}
+
+/// Sends the control commands and the predicted steps in the same datagram while synced.
+/// Only enable it if the server reads more than one command from each datagram.
+/// @param self nimble client
+/// @param usePackedDatagrams true if commands should be packed into the same datagram
+void nimbleClientSetPackedDatagrams(NimbleClient* self, bool usePackedDatagrams)
+{
+    self->usePackedDatagrams = usePackedDatagrams;
+}
+
+/// Sends the download game state request and the participant join request together with the connect request,
+/// instead of waiting for the response of the previous request. Each request is resent on its own until it is
+/// answered, so the client is synced after about one round trip plus the download time.
+/// Only enable it if the server reads more than one command from each datagram.
+/// @param self nimble client
+/// @param usePipelinedJoin true if the join handshake should be pipelined
+void nimbleClientSetPipelinedJoin(NimbleClient* self, bool usePipelinedJoin)
+{
+    self->usePipelinedJoin = usePipelinedJoin;
+}
+
 /// Destroys a nimble client and frees the allocated memory
 /// @param self nimble client
 void nimbleClientDestroy(NimbleClient* self)
@@ -134,6 +425,40 @@ void nimbleClientDestroy(NimbleClient* self)
     if (self->joinedGameState.gameState != 0) {
         nimbleClientGameStateDestroy(&self->joinedGameState);
     }
+    nimbleClientGameStateCacheDestroy(&self->gameStateCache);
+    releaseDownload(self);
+}
+
+/// Downloads the game state again while keeping the connection and the joined participants,
+/// e.g. when the client has fallen too far behind the authoritative steps.
+/// With delta resync, the current game state is kept and only the changed parts are downloaded.
+/// @param self nimble client
+/// @return negative on error
+int nimbleClientReJoin(NimbleClient* self)
+{
+    if (self->state != NimbleClientStateSynced && self->state != NimbleClientStateJoiningDownloadingState) {
+        CLOG_C_NOTICE(&self->log, "can not rejoin before the game state has been requested")
+        return -1;
+    }
+
+    if (self->joinedGameState.gameState != 0) {
+        if (self->useDeltaResync) {
+            nimbleClientGameStateCacheAdopt(&self->gameStateCache, &self->joinedGameState);
+        } else {
+            nimbleClientGameStateDestroy(&self->joinedGameState);
+        }
+    }
+    self->joinedGameState.gameState = 0;
+
+    releaseDownload(self);
+    self->gameStateDelta.isDelta = false;
+
+    // A new request id makes sure that a late response to the previous request is ignored
+    self->downloadStateClientRequestId++;
+    self->state = NimbleClientStateJoiningRequestingState;
+    nimbleClientRequestTimerReset(&self->requestTimer);
+
+    return 0;
 }
 
 /// Disconnects the client
@@ -213,26 +538,50 @@ int nimbleClientFindParticipantId(const NimbleClient* self, uint8_t localUserDev
 
 static void checkTickInterval(NimbleClient* self, MonotonicTimeMs now)
 {
+    int64_t nowUs = (int64_t) now * 1000;
+    int64_t tickDurationUs = (int64_t) self->expectedTickDurationUs;
+
     if (self->lastUpdateMonotonicMsIsSet) {
-        MonotonicTimeMs encounteredTickDuration = now - self->lastUpdateMonotonicMs;
-        if (encounteredTickDuration + 10 < (int) self->expectedTickDurationMs) {
-            // CLOG_C_VERBOSE(&self->log, "updating too often, time in ms since last update: %" PRIi64,
-            // encounteredTickDuration)
+        if (nowUs + tickDurationUs / 2 < self->nextTickAtUs) {
+            // updating more often than the tick rate
             return;
         }
-        statsIntAdd(&self->tickDuration, (int) encounteredTickDuration);
-        if (self->tickDuration.avgIsSet) {
-            if (abs((int) self->expectedTickDurationMs - self->tickDuration.avg) > 10) {
-                CLOG_C_VERBOSE(&self->log, "not holding tick rate: expected: %zu vs %d", self->expectedTickDurationMs,
-                               self->tickDuration.avg)
+        MonotonicTimeMs encounteredTickDuration = now - self->lastUpdateMonotonicMs;
+        if (self->useStats) {
+            statsIntAdd(&self->tickDuration, (int) encounteredTickDuration);
+        }
+        if (self->useStats && self->tickDuration.avgIsSet) {
+            if (llabs((int64_t) self->tickDuration.avg * 1000 - tickDurationUs) > 10000) {
+                CLOG_C_VERBOSE(&self->log, "not holding tick rate: expected: %zu us vs %d ms",
+                               self->expectedTickDurationUs, self->tickDuration.avg)
             }
         }
+        // Advance by exactly one tick, so the fractions of a millisecond add up instead of being rounded away
+        self->nextTickAtUs += tickDurationUs;
+        if (self->nextTickAtUs <= nowUs) {
+            // A whole tick behind, do not try to catch up with a burst of updates
+            self->nextTickAtUs = nowUs + tickDurationUs;
+        }
     } else {
         self->lastUpdateMonotonicMsIsSet = true;
+        self->nextTickAtUs = nowUs + tickDurationUs;
     }
     self->lastUpdateMonotonicMs = now;
 }
 
+/// Gets the time of the next tick. Ticks are scheduled in microseconds, so the time is rounded up to the next
+/// millisecond and the average tick rate is exact.
+/// @param self nimble client
+/// @return time of the next tick, or the current time if the client has not ticked yet
+MonotonicTimeMs nimbleClientNextTickAt(const NimbleClient* self)
+{
+    if (!self->lastUpdateMonotonicMsIsSet) {
+        return self->now;
+    }
+
+    return (MonotonicTimeMs) ((self->nextTickAtUs + 999) / 1000);
+}
+
 static void checkIfDisconnectIsNeeded(NimbleClient* self)
 {
     if (self->state != NimbleClientStateSynced) {
@@ -246,11 +595,12 @@ static void checkIfDisconnectIsNeeded(NimbleClient* self)
 
 /// Updates the nimble client
 /// @param self nimble client
-/// @param now current time with milliseconds resolution
+/// @param now current time with milliseconds resolution. All timing during the update is based on it.
 /// @return negative on error
 int nimbleClientUpdate(NimbleClient* self, MonotonicTimeMs now)
 {
     self->loggingTickCount++;
+    self->now = now;
     checkTickInterval(self, now);
 
     ssize_t errorCode = nimbleClientReceiveAllDatagramsFromTransport(self);
@@ -262,14 +612,132 @@ int nimbleClientUpdate(NimbleClient* self, MonotonicTimeMs now)
 
     checkIfDisconnectIsNeeded(self);
 
-    if (self->waitTime > 0) {
-        self->waitTime--;
-        return 0;
+    if (self->useStats) {
+        calcStats(self, now);
+        showStats(self);
     }
-
-    calcStats(self, now);
-    showStats(self);
     sendPackets(self);
 
     return (int) errorCode;
 }
+
+/// Sends the predicted steps to the server right away, instead of waiting for the next nimbleClientUpdate().
+/// Call it directly after writing a new predicted step to outSteps to save up to a tick of input latency.
+/// Does nothing unless the client is synced.
+/// @param self nimble client
+/// @return negative on error
+int nimbleClientFlushSteps(NimbleClient* self)
+{
+    if (self->state != NimbleClientStateSynced || self->outSteps.stepsCount == 0) {
+        return 0;
+    }
+
+    // Only the datagram is stamped with the current time, the time of the client is still the one that was
+    // passed to nimbleClientUpdate(), so a flush in the middle of a frame does not change it
+    MonotonicTimeMs now = nimbleClientClockNow(&self->clock);
+
+    DatagramTransportOut transportOut;
+    transportOut.self = self->transport.self;
+    transportOut.send = self->transport.send;
+
+    return nimbleClientSendStepsToServerAt(self, &transportOut, now);
+}
+
+/// Receives and handles all datagrams that are waiting in the transport, without sending anything.
+/// Intended to be called when the transport poll handle is readable. Sending is still done by nimbleClientUpdate().
+/// @param self nimble client
+/// @param now current time
+/// @return the number of datagrams received, or negative on error
+ssize_t nimbleClientReceive(NimbleClient* self, MonotonicTimeMs now)
+{
+    self->now = now;
+
+    ssize_t datagramCount = nimbleClientReceiveAllDatagramsFromTransport(self);
+    if (datagramCount < 0) {
+        return datagramCount;
+    }
+
+    int err = nimbleClientSendBlobStreamAckIfDue(self);
+    if (err < 0) {
+        return err;
+    }
+
+    return datagramCount;
+}
+
+/// Calculates when nimbleClientUpdate() must be called next. While requesting, it is when the request is resent
+/// (see NimbleClientRequestTimer). While downloading or synced it is the next tick, or when the received game state
+/// chunks must be acked, nimbleClientReceive() sends that ack as well.
+/// @param self nimble client
+/// @param deadline the time of the next update
+/// @return false if there is nothing scheduled and the client only has to react to incoming datagrams
+bool nimbleClientNextDeadline(const NimbleClient* self, MonotonicTimeMs* deadline)
+{
+    switch (self->state) {
+        case NimbleClientStateIdle:
+        case NimbleClientStateConnected:
+        case NimbleClientStateDisconnected:
+            return false;
+        case NimbleClientStateRequestingConnect:
+            *deadline = nimbleClientRequestTimerDeadline(&self->requestTimer, self->now);
+            return true;
+        case NimbleClientStateJoiningRequestingState: {
+            *deadline = nimbleClientRequestTimerDeadline(&self->requestTimer, self->now);
+            if (self->usePipelinedJoin && self->joinParticipantPhase == NimbleJoiningStateJoiningParticipant) {
+                MonotonicTimeMs joinDeadline = nimbleClientRequestTimerDeadline(&self->joinGameRequestTimer,
+                                                                                self->now);
+                if (joinDeadline < *deadline) {
+                    *deadline = joinDeadline;
+                }
+            }
+            return true;
+        }
+        case NimbleClientStateJoiningDownloadingState:
+        case NimbleClientStateSynced:
+            break;
+    }
+
+    *deadline = nimbleClientNextTickAt(self);
+
+    MonotonicTimeMs ackDeadline;
+    if (nimbleClientBlobStreamAckDeadline(self, &ackDeadline) && ackDeadline < *deadline) {
+        *deadline = ackDeadline;
+    }
+
+    return true;
+}
+
+/// Converts the next deadline to a timeout suitable for poll() or epoll_wait()
+/// @param self nimble client
+/// @param now current time
+/// @return milliseconds to wait, zero if an update is due and -1 if there is no deadline
+int nimbleClientPollTimeoutMs(const NimbleClient* self, MonotonicTimeMs now)
+{
+    MonotonicTimeMs deadline;
+    if (!nimbleClientNextDeadline(self, &deadline)) {
+        return -1;
+    }
+
+    if (deadline <= now) {
+        return 0;
+    }
+
+    return (int) (deadline - now);
+}
+
+/// Sets the handle (e.g. socket file descriptor) that becomes readable when the transport has datagrams.
+/// The client never uses it, it is only stored so it can be handed to the application's event loop.
+/// @param self nimble client
+/// @param handle pollable handle, -1 if the transport has none
+void nimbleClientSetTransportPollHandle(NimbleClient* self, int handle)
+{
+    self->transportPollHandle = handle;
+}
+
+/// Gets the pollable handle of the transport
+/// @param self nimble client
+/// @return pollable handle, -1 if the transport has none
+int nimbleClientTransportPollHandle(const NimbleClient* self)
+{
+    return self->transportPollHandle;
+}
@@ -4,96 +4,88 @@
  *--------------------------------------------------------------------------------------------------------*/
 #include <nimble-client/client.h>
 #include <nimble-client/utils.h>
+#include <inttypes.h>
 
-/// Calculates the optimal number of prediction ticks that should be in the
-/// outgoing prediction step buffer
-/// @param self nimble client
-/// @param outDiff the number of prediction ticks ahead of the last received authoritative step.
-/// @return false if an estimation could not be made, true if successful.
-static bool calculateOptimalSendPredictionTickCount(const NimbleClient* self, size_t* outDiff)
+/// Calculates the optimal stepId (tickId) that should be sent to the server right now.
+/// It is the step the server is estimated to be at, plus the prediction depth that covers the one-way delay
+/// to the server (see NimbleClientPredictionDepth).
+/// @param self nimbleClient
+/// @param[out] outStepId the stepId that should be sent
+/// @param[out] outDiff the number of prediction ticks ahead of the last received authoritative step
+/// @retval true if an optimal StepId could be calculated
+/// @retval false an optimal StepId could not be determined
+bool nimbleClientOptimalStepIdToSend(const NimbleClient* self, StepId* outStepId, size_t* outDiff)
 {
-    bool hasLatencyStat = self->latencyMsStat.avgIsSet;
+    const NimbleClientPredictionDepth* depth = &self->predictionDepth;
 
-    // Latency is so critical to estimate the prediction tick count, so we can
-    // not make an estimation without valid latency information.
-    if (!hasLatencyStat) {
+    StepId serverStepId;
+    if (!depth->hasTarget || !nimbleClientClockSyncServerStepId(&self->clockSync, self->now, &serverStepId)) {
         if (self->loggingTickCount % 4 == 0) {
-            CLOG_C_VERBOSE(&self->log, "no latency average yet. can not calculate optimal prediction tick count")
+            CLOG_C_VERBOSE(&self->log, "no latency or server step estimate yet. can not calculate optimal prediction "
+                                       "tick count")
         }
+        *outStepId = NIMBLE_STEP_MAX;
+        *outDiff = 0;
         return false;
     }
 
-    int latency = self->latencyMsStat.avg;
-    if (latency < 0) {
-        latency = 0;
-    }
-
-    size_t unsignedLatency = (size_t) latency;
-
-    // We need our predicted step to reach the server at the exact (or a bit ahead of)
-    // the moment the server compiles a combined authoritative step.
-    // The server
-    // is currently at or about the client received stepId + latency/2. And we need to
-    // add `latencyRoundTrip/2` so the predicted stepId isn't too old
-    // when it finally reaches the server.
-    //
-    // TL;DR: the optimal count is round trip latency in ticks rounded up.
-    size_t latencyInTicksRoundedUp = (unsignedLatency / self->expectedTickDurationMs) + 1U;
-    size_t optimalSendPredictionTickCount = latencyInTicksRoundedUp;
-
-    // Buffer delta is certainly useful, but it is possible to make an estimation
-    // without any buffer delta from the server.
-    // We need to offset the latency calculation with the delta buffer information that is received from the server.
-    bool hasBufferDeltaAverage = self->authoritativeBufferDeltaStat.avgIsSet;
-    const size_t maximumBufferDeltaInfluenceInTicks = 5;
-
-    int bufferDeltaAverage = 0;
-
-    if (hasBufferDeltaAverage) {
-        bufferDeltaAverage = self->authoritativeBufferDeltaStat.avg;
-    } else {
-        if (self->loggingTickCount % 4 == 0) {
-            CLOG_C_VERBOSE(&self->log, "no buffer delta average determined yet.")
-        }
-    }
-
-    const int minimumBufferDelta = 2;
-    size_t bufferDeltaAddTickCount = 0;
-    if (bufferDeltaAverage < minimumBufferDelta) {
-        bufferDeltaAddTickCount = (size_t) (minimumBufferDelta - bufferDeltaAverage);
-        if (bufferDeltaAddTickCount > maximumBufferDeltaInfluenceInTicks) {
-            bufferDeltaAddTickCount = maximumBufferDeltaInfluenceInTicks;
-        }
-    }
-
-    optimalSendPredictionTickCount += bufferDeltaAddTickCount;
+    StepId optimalStepId = serverStepId + (StepId) depth->targetTickCount;
+    StepId lastReceivedAuthoritativeStepId = self->authoritativeStepsFromServer.expectedWriteId;
+    size_t diff = optimalStepId > lastReceivedAuthoritativeStepId ? optimalStepId - lastReceivedAuthoritativeStepId
+                                                                   : 0;
 
     if (self->loggingTickCount % 60 == 0) {
-        CLOG_C_VERBOSE(&self->log, "latency: %zu ms (count:%zu). bufferDelta:%d (count:%zu). totalTickCount:%zu",
-                     unsignedLatency, latencyInTicksRoundedUp, bufferDeltaAverage, bufferDeltaAddTickCount,
-                     optimalSendPredictionTickCount)
+        CLOG_C_VERBOSE(&self->log, "one-way delay p%zu: %" PRIu64 " ms. depth:%zu (required:%zu). server step:%08X "
+                                   "ahead of authoritative:%zu",
+                       depth->percentile, (uint64_t) depth->oneWayDelayPercentileMs, depth->targetTickCount,
+                       depth->requiredTickCount, serverStepId, diff)
     }
 
-    *outDiff = optimalSendPredictionTickCount;
+    *outStepId = optimalStepId;
+    *outDiff = diff;
 
     return true;
 }
 
-/// Calculates the optimal stepId (tickId) that should be sent to the server right now
-/// @param self nimbleClient
-/// @param[out] outStepId the stepId that should be sent
-/// @retval true if an optimal StepId could be calculated
-/// @retval false an optimal StepId could not be determined
-bool nimbleClientOptimalStepIdToSend(const NimbleClient* self, StepId* outStepId, size_t* outDiff)
+/// Estimates the step id that the server is at, using the clock synchronization of the game step responses.
+/// Unlike the last received authoritative step id it keeps advancing between the responses.
+/// @param self nimble client
+/// @param now the time to estimate the server step id for
+/// @param[out] outStepId the estimated server step id
+/// @return true if there was an estimate, false if no game step response has been received yet
+bool nimbleClientEstimatedServerStepId(const NimbleClient* self, MonotonicTimeMs now, StepId* outStepId)
 {
-    bool worked = calculateOptimalSendPredictionTickCount(self, outDiff);
-    if (!worked) {
-        *outStepId = NIMBLE_STEP_MAX;
-        return false;
-    }
+    return nimbleClientClockSyncServerStepId(&self->clockSync, now, outStepId);
+}
 
-    StepId lastReceivedAuthoritativeStepId = self->authoritativeStepsFromServer.expectedWriteId;
-    *outStepId = lastReceivedAuthoritativeStepId + (StepId) *outDiff;
+/// Recommends a multiplier for the local tick rate, so the predicted steps drift smoothly towards arriving the
+/// target number of steps ahead on the server (see nimbleClientSetTimeDilationTarget()). Apply it to the tick
+/// duration of the simulation, instead of skipping or repeating ticks when the server buffer runs too full or empty.
+/// @param self nimble client
+/// @return tick rate multiplier between 0.98 and 1.02, above one means tick faster
+float nimbleClientRecommendedTickRateMultiplier(const NimbleClient* self)
+{
+    return nimbleClientTimeDilationMultiplier(&self->timeDilation);
+}
+
+/// Checks if the datagrams should carry the flood debug markers.
+/// The connect request and response always carry them, since debug streams are not negotiated at that point.
+/// After that the setting negotiated in the connect response decides.
+/// @param self nimble protocol client
+/// @return true if debug markers should be written and checked
+bool nimbleClientWireUsesDebugInfo(const NimbleClient* self)
+{
+    switch (self->state) {
+        case NimbleClientStateIdle:
+        case NimbleClientStateRequestingConnect:
+            return true;
+        case NimbleClientStateConnected:
+        case NimbleClientStateJoiningRequestingState:
+        case NimbleClientStateJoiningDownloadingState:
+        case NimbleClientStateSynced:
+        case NimbleClientStateDisconnected:
+            return self->useDebugStreams;
+    }
 
     return true;
 }
@@ -0,0 +1,31 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <nimble-client/clock.h>
+
+static MonotonicTimeMs monotonicNow(void* self)
+{
+    (void) self;
+    return monotonicTimeMsNow();
+}
+
+/// Creates a clock that reads the operating system monotonic time
+/// @return the clock
+NimbleClientClock nimbleClientClockMonotonic(void)
+{
+    NimbleClientClock clock;
+
+    clock.self = 0;
+    clock.now = monotonicNow;
+
+    return clock;
+}
+
+/// Reads the current time from the clock
+/// @param self clock
+/// @return current time in milliseconds
+MonotonicTimeMs nimbleClientClockNow(const NimbleClientClock* self)
+{
+    return self->now(self->self);
+}
@@ -0,0 +1,161 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <nimble-client/clock_sync.h>
+
+/// Moves an offset that was valid at `from` forward to `to`, using the tracked drift
+static int64_t projectOffset(const NimbleClientClockSync* self, int64_t offsetUs, MonotonicTimeMs from,
+                             MonotonicTimeMs to)
+{
+    int64_t elapsedMs = (int64_t) to - (int64_t) from;
+
+    // parts per million of the elapsed microseconds
+    return offsetUs + self->driftPpm * elapsedMs / 1000;
+}
+
+static int64_t absInt64(int64_t v)
+{
+    return v < 0 ? -v : v;
+}
+
+static void clearSamples(NimbleClientClockSync* self)
+{
+    self->window->sampleCount = 0;
+    self->window->writeIndex = 0;
+    self->hasEstimate = false;
+    self->driftPpm = 0;
+    self->hasDriftReference = false;
+    self->outlierCount = 0;
+}
+
+/// Picks the sample with the lowest round trip time, it has the least queuing delay in it
+static const NimbleClientClockSyncSample* selectSample(const NimbleClientClockSync* self)
+{
+    const NimbleClientClockSyncWindow* window = self->window;
+    const NimbleClientClockSyncSample* best = &window->samples[0];
+
+    for (size_t i = 1; i < window->sampleCount; ++i) {
+        const NimbleClientClockSyncSample* sample = &window->samples[i];
+        if (sample->rttMs < best->rttMs || (sample->rttMs == best->rttMs && sample->receivedAt > best->receivedAt)) {
+            best = sample;
+        }
+    }
+
+    return best;
+}
+
+/// Measures the drift from how the offset of the selected sample moves between selections. The raw sample offsets
+/// are used, since the estimated offset is already projected with the drift that is being measured.
+static void updateDrift(NimbleClientClockSync* self, const NimbleClientClockSyncSample* selected)
+{
+    if (!self->hasDriftReference) {
+        self->driftReferenceOffsetUs = selected->offsetUs;
+        self->driftReferenceAt = selected->receivedAt;
+        self->hasDriftReference = true;
+        return;
+    }
+
+    if (selected->receivedAt < self->driftReferenceAt + NIMBLE_CLIENT_CLOCK_SYNC_DRIFT_INTERVAL_MS) {
+        return;
+    }
+
+    int64_t elapsedMs = (int64_t) selected->receivedAt - (int64_t) self->driftReferenceAt;
+    int64_t measuredPpm = (selected->offsetUs - self->driftReferenceOffsetUs) * 1000 / elapsedMs;
+    self->driftPpm = (3 * self->driftPpm + measuredPpm) / 4;
+
+    if (self->driftPpm > NIMBLE_CLIENT_CLOCK_SYNC_MAXIMUM_DRIFT_PPM) {
+        self->driftPpm = NIMBLE_CLIENT_CLOCK_SYNC_MAXIMUM_DRIFT_PPM;
+    } else if (self->driftPpm < -NIMBLE_CLIENT_CLOCK_SYNC_MAXIMUM_DRIFT_PPM) {
+        self->driftPpm = -NIMBLE_CLIENT_CLOCK_SYNC_MAXIMUM_DRIFT_PPM;
+    }
+
+    self->driftReferenceOffsetUs = selected->offsetUs;
+    self->driftReferenceAt = selected->receivedAt;
+}
+
+/// Initializes the clock synchronization, there is no estimate until the first sample is added
+/// @param self clock synchronization
+/// @param window memory for the sample window, kept outside of self so self is small enough to stay with the
+/// fields that are read on every update
+/// @param tickDurationUs duration of a step on the server in microseconds
+void nimbleClientClockSyncInit(NimbleClientClockSync* self, NimbleClientClockSyncWindow* window,
+                               size_t tickDurationUs)
+{
+    self->window = window;
+    self->tickDurationUs = tickDurationUs;
+    self->offsetUs = 0;
+    self->offsetAt = 0;
+    self->rttMs = 0;
+    clearSamples(self);
+}
+
+/// Adds a sample from a game step response
+/// @param self clock synchronization
+/// @param stepId the newest authoritative step id in the response
+/// @param receivedAt the time the response was received
+/// @param rttMs round trip time measured by the pong in the same datagram
+void nimbleClientClockSyncAddSample(NimbleClientClockSync* self, StepId stepId, MonotonicTimeMs receivedAt,
+                                    MonotonicTimeMs rttMs)
+{
+    // The server sent the step some time during the tick that followed it, and it took about half of
+    // the round trip to get here
+    int64_t serverTimeUs = (int64_t) ((uint64_t) stepId * self->tickDurationUs + self->tickDurationUs / 2U) +
+                           (int64_t) rttMs * 500;
+    int64_t offsetUs = serverTimeUs - (int64_t) receivedAt * 1000;
+
+    if (self->hasEstimate) {
+        // A sample that is further off than its own uncertainty, several times in a row, means that the server
+        // clock has jumped (e.g. the server stalled), so start over instead of slowly drifting towards it
+        int64_t expectedOffsetUs = projectOffset(self, self->offsetUs, self->offsetAt, receivedAt);
+        int64_t toleranceUs = (int64_t) rttMs * 500 + (int64_t) self->tickDurationUs;
+        if (absInt64(offsetUs - expectedOffsetUs) > toleranceUs) {
+            self->outlierCount++;
+            if (self->outlierCount >= NIMBLE_CLIENT_CLOCK_SYNC_STEP_OUT_COUNT) {
+                clearSamples(self);
+            }
+        } else {
+            self->outlierCount = 0;
+        }
+    }
+
+    NimbleClientClockSyncWindow* window = self->window;
+    NimbleClientClockSyncSample* sample = &window->samples[window->writeIndex];
+    sample->receivedAt = receivedAt;
+    sample->rttMs = rttMs;
+    sample->offsetUs = offsetUs;
+    window->writeIndex = (window->writeIndex + 1) % NIMBLE_CLIENT_CLOCK_SYNC_SAMPLE_COUNT;
+    if (window->sampleCount < NIMBLE_CLIENT_CLOCK_SYNC_SAMPLE_COUNT) {
+        window->sampleCount++;
+    }
+
+    const NimbleClientClockSyncSample* selected = selectSample(self);
+    self->offsetUs = projectOffset(self, selected->offsetUs, selected->receivedAt, receivedAt);
+    self->offsetAt = receivedAt;
+    self->rttMs = selected->rttMs;
+    self->hasEstimate = true;
+
+    updateDrift(self, selected);
+}
+
+/// Estimates the step id that the server is at
+/// @param self clock synchronization
+/// @param now the time to estimate the server step id for
+/// @param[out] outStepId the estimated server step id
+/// @return true if there was an estimate
+bool nimbleClientClockSyncServerStepId(const NimbleClientClockSync* self, MonotonicTimeMs now, StepId* outStepId)
+{
+    if (!self->hasEstimate) {
+        *outStepId = NIMBLE_STEP_MAX;
+        return false;
+    }
+
+    int64_t serverTimeUs = (int64_t) now * 1000 + projectOffset(self, self->offsetUs, self->offsetAt, now);
+    if (serverTimeUs < 0) {
+        serverTimeUs = 0;
+    }
+
+    *outStepId = (StepId) ((uint64_t) serverTimeUs / self->tickDurationUs);
+
+    return true;
+}
@@ -7,7 +7,8 @@
 #include <nimble-client/connect_response.h>
 #include <nimble-serialize/client_in.h>
 
-/// Handle join game response (NimbleSerializeCmdJoinGameResponse) from server.
+/// Handle connect response (NimbleSerializeCmdConnectResponse) from server.
+/// With a pipelined join it goes directly to requesting the game state, otherwise to connected.
 /// @param self nimble protocol client
 /// @param inStream stream to read from
 /// @return negative on error
@@ -21,7 +22,14 @@ int nimbleClientOnConnectResponse(NimbleClient* self, FldInStream* inStream)
     }
 
     if (self->state == NimbleClientStateRequestingConnect) {
-        self->state = NimbleClientStateConnected;
+        if (self->usePipelinedJoin) {
+            // The download game state request was sent together with the connect request, so it is already
+            // in flight and keeps the resend schedule of the connect request
+            self->state = NimbleClientStateJoiningRequestingState;
+        } else {
+            self->state = NimbleClientStateConnected;
+            nimbleClientRequestTimerReset(&self->requestTimer);
+        }
         self->useDebugStreams = response.useDebugStreams;
         self->remoteConnectionId = response.connectionId;
         CLOG_ASSERT(self->remoteConnectionId != 0, "remote connection assigned can not be zero")
@@ -0,0 +1,142 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <flood/in_stream.h>
+#include <flood/out_stream.h>
+#include <nimble-client/datagram_command.h>
+#include <stdint.h>
+#include <tiny-libc/tiny_libc.h>
+
+/// Starts the commands of a datagram that can have more than one command, by writing
+/// NIMBLE_CLIENT_DATAGRAM_COMMAND_LIST. Each command is then written between nimbleClientDatagramCommandBegin() and
+/// nimbleClientDatagramCommandEnd().
+/// @param outStream datagram stream, positioned after the datagram header
+/// @return the position to pass to nimbleClientDatagramCommandsEnd() when all commands are written
+size_t nimbleClientDatagramCommandsBegin(FldOutStream* outStream)
+{
+    size_t listStart = outStream->pos;
+    fldOutStreamWriteUInt8(outStream, NIMBLE_CLIENT_DATAGRAM_COMMAND_LIST);
+
+    return listStart;
+}
+
+/// Ends the commands that were started with nimbleClientDatagramCommandsBegin(). If only one command was written,
+/// the command list octet and the octet count are removed again, so the datagram has the same layout as one that
+/// was written for a single command. If nothing was written, the command list octet is removed.
+/// @param outStream datagram stream
+/// @param listStart position returned by nimbleClientDatagramCommandsBegin()
+/// @return negative on error
+int nimbleClientDatagramCommandsEnd(FldOutStream* outStream, size_t listStart)
+{
+    size_t firstCommandStart = listStart + 1;
+    if (outStream->pos <= firstCommandStart) {
+        outStream->pos = listStart;
+        outStream->p = outStream->octets + listStart;
+        return 0;
+    }
+
+    FldInStream firstCommandOctetCountStream;
+    fldInStreamInit(&firstCommandOctetCountStream, outStream->octets + firstCommandStart,
+                    outStream->pos - firstCommandStart);
+    uint16_t firstCommandOctetCount;
+    int err = fldInStreamReadUInt16(&firstCommandOctetCountStream, &firstCommandOctetCount);
+    if (err < 0) {
+        return err;
+    }
+
+    size_t firstCommandEnd = firstCommandStart + 2 + firstCommandOctetCount;
+    if (firstCommandEnd > outStream->pos) {
+        return -2;
+    }
+    if (firstCommandEnd < outStream->pos) {
+        return 0;
+    }
+
+    tc_memmove_octets(outStream->octets + listStart, outStream->octets + firstCommandStart + 2,
+                      firstCommandOctetCount);
+    outStream->pos = listStart + firstCommandOctetCount;
+    outStream->p = outStream->octets + outStream->pos;
+
+    return 0;
+}
+
+/// Reserves the octet count in front of a command, in a datagram that starts with
+/// NIMBLE_CLIENT_DATAGRAM_COMMAND_LIST.
+/// @param outStream datagram stream
+/// @return the position to pass to nimbleClientDatagramCommandEnd() when the command is written
+size_t nimbleClientDatagramCommandBegin(FldOutStream* outStream)
+{
+    size_t commandStart = outStream->pos;
+    fldOutStreamWriteUInt16(outStream, 0);
+
+    return commandStart;
+}
+
+/// Fills in the octet count of the command that was written after nimbleClientDatagramCommandBegin().
+/// If nothing was written, the reserved octet count is removed again.
+/// @param outStream datagram stream
+/// @param commandStart position returned by nimbleClientDatagramCommandBegin()
+/// @return negative on error
+int nimbleClientDatagramCommandEnd(FldOutStream* outStream, size_t commandStart)
+{
+    if (outStream->pos < commandStart + 2) {
+        return -2;
+    }
+
+    size_t commandOctetCount = outStream->pos - commandStart - 2;
+    if (commandOctetCount > UINT16_MAX) {
+        return -3;
+    }
+
+    if (commandOctetCount == 0) {
+        outStream->pos = commandStart;
+        outStream->p = outStream->octets + commandStart;
+        return 0;
+    }
+
+    size_t endPos = outStream->pos;
+    outStream->pos = commandStart;
+    outStream->p = outStream->octets + commandStart;
+    fldOutStreamWriteUInt16(outStream, (uint16_t) commandOctetCount);
+    outStream->pos = endPos;
+    outStream->p = outStream->octets + endPos;
+
+    return 0;
+}
+
+/// Reads the octet count in front of a command and sets up a stream that ends where the command ends.
+/// inStream is moved past the command, so the next command is read from the right position even if the command
+/// handler did not read all of it.
+/// @param inStream datagram stream
+/// @param[out] commandStream stream for the command, with the same debug marker setting as inStream
+/// @return negative on error
+int nimbleClientDatagramCommandRead(FldInStream* inStream, FldInStream* commandStream)
+{
+    uint16_t commandOctetCount;
+    int err = fldInStreamReadUInt16(inStream, &commandOctetCount);
+    if (err < 0) {
+        return err;
+    }
+
+    if (commandOctetCount == 0 || commandOctetCount > inStream->size - inStream->pos) {
+        return -2;
+    }
+
+    fldInStreamInit(commandStream, inStream->p, commandOctetCount);
+    commandStream->readDebugInfo = inStream->readDebugInfo;
+
+    inStream->p += commandOctetCount;
+    inStream->pos += commandOctetCount;
+
+    return 0;
+}
+
+/// Skips the rest of a command that is ignored. The command stream always ends where the command ends, either from
+/// nimbleClientDatagramCommandRead() or because it is the only command in the datagram.
+/// @param commandStream stream for the command
+void nimbleClientDatagramCommandSkip(FldInStream* commandStream)
+{
+    commandStream->p = commandStream->octets + commandStream->size;
+    commandStream->pos = commandStream->size;
+}
@@ -2,32 +2,156 @@
  *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
  *  Licensed under the MIT License. See LICENSE in the project root for license information.
  *--------------------------------------------------------------------------------------------------------*/
+#include <bit-array/bit_array.h>
 #include <flood/in_stream.h>
+#include <imprint/allocator.h>
 #include <nimble-client/client.h>
+#include <nimble-client/datagram_command.h>
 #include <nimble-client/download_state_part.h>
+#include <nimble-client/outgoing.h>
 #include <nimble-serialize/serialize.h>
 
-static void trySetInitialGameState(NimbleClient* self)
+static size_t completedInOrderOctetCount(const BlobStreamIn* blobStream)
+{
+    if (blobStreamInIsComplete(blobStream)) {
+        return blobStream->octetCount;
+    }
+
+    int firstMissingChunk = bitArrayFirstUnset(&blobStream->bitArray);
+    if (firstMissingChunk < 0) {
+        return 0;
+    }
+
+    return (size_t) firstMissingChunk * blobStream->fixedChunkSize;
+}
+
+static bool isCompressed(const NimbleClient* self)
+{
+    return self->gameStateCodec != NimbleClientGameStateCodecNone;
+}
+
+static void deliverCompletedChunks(NimbleClient* self, const uint8_t* gameState, size_t availableOctetCount,
+                                   size_t totalOctetCount)
+{
+    if (availableOctetCount <= self->gameStateDeliveredOctetCount) {
+        return;
+    }
+
+    size_t offset = self->gameStateDeliveredOctetCount;
+    self->gameStateReceiver.receiveChunk(self->gameStateReceiver.self, self->joinStateId, offset, gameState + offset,
+                                         availableOctetCount - offset, totalOctetCount);
+    self->gameStateDeliveredOctetCount = availableOctetCount;
+}
+
+static int handleCompletedChunks(NimbleClient* self)
+{
+    size_t completedOctetCount = completedInOrderOctetCount(&self->blobStreamIn);
+
+    if (!isCompressed(self)) {
+        if (self->gameStateReceiver.receiveChunk != 0) {
+            deliverCompletedChunks(self, self->blobStreamIn.blob, completedOctetCount, self->blobStreamIn.octetCount);
+        }
+        return 0;
+    }
+
+    NimbleClientGameStateDecoder* decoder = &self->gameStateDecoder;
+    int err = nimbleClientGameStateDecoderFeed(decoder, self->blobStreamIn.blob, completedOctetCount);
+    if (err < 0) {
+        return err;
+    }
+
+    if (self->gameStateReceiver.receiveChunk != 0) {
+        deliverCompletedChunks(self, decoder->target, decoder->writeOffset, decoder->targetOctetCount);
+    }
+
+    return 0;
+}
+
+/// Requests the complete game state, e.g. when the downloaded delta did not match the cached game state
+static void requestCompleteGameState(NimbleClient* self)
+{
+    nimbleClientGameStateCacheDestroy(&self->gameStateCache);
+    self->gameStateDelta.isDelta = false;
+    self->downloadStateClientRequestId++;
+    self->state = NimbleClientStateJoiningRequestingState;
+    nimbleClientRequestTimerReset(&self->requestTimer);
+}
+
+static int trySetInitialGameState(NimbleClient* self)
 {
     if (self->state == NimbleClientStateSynced) {
         CLOG_C_NOTICE(&self->log, "we are already synced, ignoring that state is ready")
-        return;
+        return 0;
     }
+
+    // The decoded game state replaces the downloaded blob
+    uint8_t* gameState = self->blobStreamIn.blob;
+    size_t gameStateOctetCount = self->blobStreamIn.octetCount;
+    if (isCompressed(self)) {
+        if (!nimbleClientGameStateDecoderIsComplete(&self->gameStateDecoder)) {
+            CLOG_C_SOFT_ERROR(&self->log, "compressed game state did not decode to the expected size")
+            return -1;
+        }
+        gameState = self->gameStateDecoder.target;
+        gameStateOctetCount = self->gameStateDecoder.targetOctetCount;
+        self->gameStateDecoder.target = 0;
+        blobStreamInDestroy(&self->blobStreamIn);
+    } else {
+        // The game state takes over the blob, the rest of the blob stream is released
+        self->blobStreamIn.blob = 0;
+        blobStreamInDestroy(&self->blobStreamIn);
+    }
+    self->blobStreamInIsAllocated = false;
+
+    if (self->gameStateDelta.isDelta) {
+        uint8_t* completeGameState;
+        int err = nimbleClientGameStateCacheApplyDelta(&self->gameStateCache, &self->gameStateDelta, gameState,
+                                                       gameStateOctetCount, &completeGameState);
+        IMPRINT_FREE(self->blobStreamAllocator, gameState);
+        if (err < 0) {
+            requestCompleteGameState(self);
+            return 0;
+        }
+        CLOG_C_DEBUG(&self->log, "game state delta of %zu octets applied, game state is %zu octets",
+                     gameStateOctetCount, self->gameStateDelta.gameStateOctetCount)
+        gameState = completeGameState;
+        gameStateOctetCount = self->gameStateDelta.gameStateOctetCount;
+        self->gameStateDelta.isDelta = false;
+    } else {
+        // The server sent the complete game state, so the cached one is not needed anymore
+        nimbleClientGameStateCacheDestroy(&self->gameStateCache);
+    }
+
     CLOG_C_INFO(&self->log, "=====================================================================")
     CLOG_C_INFO(&self->log, "we have downloaded the game state %04X", self->joinedGameState.stepId)
     self->state = NimbleClientStateSynced;
-    nimbleClientGameStateInit(&self->joinedGameState, self->blobStreamAllocator, self->joinStateId,
-                              self->blobStreamIn.blob, self->blobStreamIn.octetCount);
+    if (self->joinedGameState.gameState != 0) {
+        nimbleClientGameStateDestroy(&self->joinedGameState);
+    }
+    if (self->gameStateReceiver.receiveChunk != 0) {
+        // The application already has all of the game state
+        self->joinedGameState.stepId = self->joinStateId;
+        self->joinedGameState.gameState = 0;
+        self->joinedGameState.gameStateOctetCount = gameStateOctetCount;
+        IMPRINT_FREE(self->blobStreamAllocator, gameState);
+    } else {
+        // The game state takes over the buffer, so the state is never held twice in memory
+        nimbleClientGameStateAdopt(&self->joinedGameState, self->blobStreamAllocator, self->joinStateId, gameState,
+                                   gameStateOctetCount);
+    }
     nbsPendingStepsReset(&self->authoritativePendingStepsFromServer, self->joinedGameState.stepId);
     nbsStepsReInit(&self->authoritativeStepsFromServer, self->joinedGameState.stepId);
     // we should start predicting from this stepId as well
     nbsStepsReInit(&self->outSteps, self->joinedGameState.stepId);
 
+    return 0;
 }
 
 /// Handle incoming message NimbleSerializeCmdGameStatePart
-/// Receives a blob stream chunk. If the blob stream is completed, it sets the game state to joinedGameState
-/// and goes to NimbleClientStatePlaying.
+/// Receives a blob stream chunk. A compressed game state is decoded as far as the chunks are complete and in order.
+/// If a game state receiver is set, the game state octets that are now available are handed to it.
+/// The received chunks are acked right away when the ack pacing says so (see nimbleClientSetBlobStreamAckPacing()).
+/// If the blob stream is completed, it sets the game state to joinedGameState and goes to NimbleClientStatePlaying.
 /// @param self nimble protocol client
 /// @param inStream stream to read download game state part from
 /// @return negative numbers on error.
@@ -38,18 +162,36 @@ int nimbleClientOnDownloadGameStatePart(NimbleClient* self, FldInStream* inStrea
     nimbleSerializeInBlobStreamChannelId(inStream, &channelId);
     if (channelId != self->joinStateChannel) {
         CLOG_SOFT_ERROR("we received response from wrong channel %04X", self->joinStateChannel)
+        nimbleClientDatagramCommandSkip(inStream);
         return 0;
     }
 
     self->joinStateChannel = channelId;
 
+    if (!self->blobStreamInIsAllocated) {
+        CLOG_C_VERBOSE(&self->log, "received game state part when not downloading, ignoring")
+        nimbleClientDatagramCommandSkip(inStream);
+        return 0;
+    }
+
     int result = blobStreamLogicInReceive(&self->blobStreamInLogic, inStream);
     if (result < 0) {
         return result;
     }
+    self->blobStreamChunksSinceAck++;
+
+    result = handleCompletedChunks(self);
+    if (result < 0) {
+        return result;
+    }
+
+    result = nimbleClientSendBlobStreamAckIfDue(self);
+    if (result < 0) {
+        return result;
+    }
 
     if (blobStreamInIsComplete(&self->blobStreamIn)) {
-        trySetInitialGameState(self);
+        return trySetInitialGameState(self);
     }
 
     return 0;
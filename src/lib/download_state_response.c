@@ -3,13 +3,16 @@
  *  Licensed under the MIT License. See LICENSE in the project root for license information.
  *--------------------------------------------------------------------------------------------------------*/
 #include <flood/in_stream.h>
+#include <imprint/allocator.h>
+#include <imprint/linear_allocator.h>
 #include <nimble-client/client.h>
 #include <nimble-client/download_state_response.h>
 #include <nimble-serialize/serialize.h>
 
 /// Handle incoming game state response (NimbleSerializeCmdGameStateResponse) from server.
-/// If response haven't been received before, it sets the joinStateChannel and
-/// sets the state to NimbleClientStateJoiningDownloadingState, to start receiving the game state.
+/// If response haven't been received before, it sets the joinStateChannel, prepares the blob stream (and the
+/// decoder if the server chose to compress the game state) and sets the state to NimbleClientStateJoiningDownloadingState, to start receiving
+/// the game state.
 /// @param self nimble protocol client
 /// @param inStream stream to read from
 /// @return negative on error
@@ -29,6 +32,59 @@ int nimbleClientOnDownloadGameStateResponse(NimbleClient* self, FldInStream* inS
         return errorCode;
     }
 
+    // Missing if the server does not support the download options, which is reported below
+    uint8_t options = 0;
+    if (inStream->pos < inStream->size) {
+        errorCode = fldInStreamReadUInt8(inStream, &options);
+        if (errorCode < 0) {
+            return errorCode;
+        }
+    }
+    if ((options & ~self->downloadStateRequestOptions) != 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "server used download options %02X that we did not ask for", options)
+        return -1;
+    }
+
+    uint32_t blobOctetCount = 0;
+    if ((options & NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_OCTET_COUNT) != 0) {
+        errorCode = fldInStreamReadUInt32(inStream, &blobOctetCount);
+        if (errorCode < 0) {
+            return errorCode;
+        }
+    }
+    NimbleClientGameStateCodec codec = NimbleClientGameStateCodecNone;
+    uint32_t gameStateOctetCount = blobOctetCount;
+    if ((options & NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_LZ) != 0) {
+        codec = NimbleClientGameStateCodecLz;
+        errorCode = fldInStreamReadUInt32(inStream, &gameStateOctetCount);
+        if (errorCode < 0) {
+            return errorCode;
+        }
+    }
+
+    NimbleClientGameStateDelta delta;
+    delta.isDelta = (options & NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_DELTA) != 0;
+    delta.gameStateOctetCount = 0;
+    delta.changedSegmentMask = 0;
+    if (delta.isDelta) {
+        uint32_t fullGameStateOctetCount;
+        errorCode = fldInStreamReadUInt32(inStream, &fullGameStateOctetCount);
+        if (errorCode < 0) {
+            return errorCode;
+        }
+        delta.gameStateOctetCount = fullGameStateOctetCount;
+        errorCode = fldInStreamReadUInt64(inStream, &delta.changedSegmentMask);
+        if (errorCode < 0) {
+            return errorCode;
+        }
+    }
+
+    if (self->state == NimbleClientStateRequestingConnect) {
+        // Can happen with a pipelined join if the connect response was lost. It is sent again on the resend.
+        CLOG_C_NOTICE(&self->log, "got download game state reply before the connect response, ignoring")
+        return 0;
+    }
+
     if (clientRequestId != self->downloadStateClientRequestId) {
         CLOG_C_NOTICE(&self->log, "got download game state reply for another request, ignoring")
         return 0;
@@ -39,17 +95,64 @@ int nimbleClientOnDownloadGameStateResponse(NimbleClient* self, FldInStream* inS
         return 0;
     }
 
+    if ((options & NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_OCTET_COUNT) == 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "server does not support the download game state options, can not receive the "
+                                      "game state without its octet count")
+        return -1;
+    }
+
+    if (delta.isDelta && !nimbleClientGameStateCacheIsSet(&self->gameStateCache)) {
+        CLOG_C_SOFT_ERROR(&self->log, "server sent a game state delta, but we have no cached game state")
+        return -1;
+    }
+
+    if (self->usesArena &&
+        blobOctetCount > nimbleClientGameStateEncodeMaxOctetCount(self->maximumGameStateOctetCount)) {
+        CLOG_C_SOFT_ERROR(&self->log, "game state blob %u is too big for the arena (max game state %zu)",
+                          blobOctetCount, self->maximumGameStateOctetCount)
+        return -1;
+    }
+
     self->joinStateChannel = channelId;
 
     CLOG_C_VERBOSE(&self->log, "rejoin answer: stateId: %04X channel:%02X", stateId,channelId)
 
 
+    struct ImprintAllocator* blobStreamInMemory = self->memory;
+    if (self->blobStreamInIsAllocated) {
+        blobStreamInDestroy(&self->blobStreamIn);
+    }
+    if (self->usesArena) {
+        // The chunk bits of the previous download are not used anymore, so the same memory is reused
+        imprintLinearAllocatorReset(&self->blobStreamInMemory);
+        blobStreamInMemory = &self->blobStreamInMemory.info;
+    }
+    blobStreamInInit(&self->blobStreamIn, blobStreamInMemory, self->blobStreamAllocator, blobOctetCount,
+                     NIMBLE_CLIENT_GAME_STATE_CHUNK_SIZE, self->log);
+    blobStreamLogicInInit(&self->blobStreamInLogic, &self->blobStreamIn);
+    self->blobStreamInIsAllocated = true;
+    self->gameStateDeliveredOctetCount = 0;
+    self->blobStreamChunksSinceAck = 0;
+    self->lastBlobStreamAckAt = self->now;
+
+    self->gameStateDelta = delta;
+    self->gameStateCodec = codec;
+    if (self->gameStateDecoder.target != 0) {
+        IMPRINT_FREE(self->blobStreamAllocator, self->gameStateDecoder.target);
+        self->gameStateDecoder.target = 0;
+    }
+    if (self->gameStateCodec != NimbleClientGameStateCodecNone) {
+        // Decoded straight into the buffer that becomes the joined game state
+        uint8_t* decoded = IMPRINT_ALLOC((ImprintAllocator*) self->blobStreamAllocator, gameStateOctetCount,
+                                         "decoded game state");
+        nimbleClientGameStateDecoderInit(&self->gameStateDecoder, decoded, gameStateOctetCount);
+    }
+
     self->joinedGameState.stepId = stateId;
     self->joinStateId = stateId;
     CLOG_C_DEBUG(&self->log, "start predicting from %08X", stateId)
     nbsStepsReInit(&self->outSteps, stateId);
     self->state = NimbleClientStateJoiningDownloadingState;
-    self->waitTime = 0;
 
     return 0;
 }
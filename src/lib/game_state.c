@@ -22,6 +22,22 @@ void nimbleClientGameStateInit(NimbleClientGameState* self, struct ImprintAlloca
     tc_memcpy_octets((void*) self->gameState, gameState, gameStateOctetCount);
 }
 
+/// Initializes the Game State by taking over an already allocated buffer, no copy is made.
+/// The buffer is freed in nimbleClientGameStateDestroy().
+/// @param self nimble client game state
+/// @param blobAllocator the allocator that allocated gameState
+/// @param stepId the tickId where it was captured
+/// @param gameState application specific game state, allocated from blobAllocator
+/// @param gameStateOctetCount octet size of gameState
+void nimbleClientGameStateAdopt(NimbleClientGameState* self, struct ImprintAllocatorWithFree* blobAllocator,
+                                StepId stepId, uint8_t* gameState, size_t gameStateOctetCount)
+{
+    self->stepId = stepId;
+    self->gameState = gameState;
+    self->gameStateOctetCount = gameStateOctetCount;
+    self->blobAllocator = blobAllocator;
+}
+
 /// Free the memory allocated on initialize.
 /// @param self nimble client game state
 void nimbleClientGameStateDestroy(NimbleClientGameState* self)
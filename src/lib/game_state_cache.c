@@ -0,0 +1,192 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <clog/clog.h>
+#include <flood/out_stream.h>
+#include <imprint/allocator.h>
+#include <nimble-client/game_state_cache.h>
+
+/// Calculates the hash that the client and the server use to compare game state segments (64-bit FNV-1a)
+/// @param octets octets to hash
+/// @param octetCount number of octets
+/// @return the hash
+uint64_t nimbleClientGameStateHash(const uint8_t* octets, size_t octetCount)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < octetCount; ++i) {
+        hash ^= octets[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+/// Calculates the segment size for a game state, so it is split into at most
+/// NIMBLE_CLIENT_GAME_STATE_CACHE_MAX_SEGMENT_COUNT segments.
+/// @param gameStateOctetCount the size of the game state
+/// @return the octet count of each segment, the last segment can be smaller
+size_t nimbleClientGameStateSegmentOctetCount(size_t gameStateOctetCount)
+{
+    size_t segmentOctetCount = NIMBLE_CLIENT_GAME_STATE_CACHE_MIN_SEGMENT_OCTET_COUNT;
+
+    while (segmentOctetCount * NIMBLE_CLIENT_GAME_STATE_CACHE_MAX_SEGMENT_COUNT < gameStateOctetCount) {
+        segmentOctetCount *= 2;
+    }
+
+    return segmentOctetCount;
+}
+
+/// Initializes an empty game state cache
+/// @param self game state cache
+void nimbleClientGameStateCacheInit(NimbleClientGameStateCache* self)
+{
+    self->gameState.gameState = 0;
+    self->gameState.gameStateOctetCount = 0;
+    self->segmentOctetCount = 0;
+    self->segmentCount = 0;
+}
+
+/// Takes over the buffer of the game state and calculates the segment hashes.
+/// The game state is cleared, so it no longer owns the buffer.
+/// @param self game state cache
+/// @param gameState the game state to keep
+void nimbleClientGameStateCacheAdopt(NimbleClientGameStateCache* self, NimbleClientGameState* gameState)
+{
+    nimbleClientGameStateCacheDestroy(self);
+
+    self->gameState = *gameState;
+    gameState->gameState = 0;
+    gameState->gameStateOctetCount = 0;
+
+    size_t octetCount = self->gameState.gameStateOctetCount;
+    self->segmentOctetCount = nimbleClientGameStateSegmentOctetCount(octetCount);
+    self->segmentCount = 0;
+    for (size_t offset = 0; offset < octetCount; offset += self->segmentOctetCount) {
+        size_t segmentOctetCount = octetCount - offset;
+        if (segmentOctetCount > self->segmentOctetCount) {
+            segmentOctetCount = self->segmentOctetCount;
+        }
+        self->segmentHashes[self->segmentCount++] = nimbleClientGameStateHash(self->gameState.gameState + offset,
+                                                                              segmentOctetCount);
+    }
+}
+
+/// Frees the cached game state
+/// @param self game state cache
+void nimbleClientGameStateCacheDestroy(NimbleClientGameStateCache* self)
+{
+    if (self->gameState.gameState != 0) {
+        nimbleClientGameStateDestroy(&self->gameState);
+    }
+    self->segmentCount = 0;
+}
+
+/// Checks if there is a cached game state to download a delta against
+/// @param self game state cache
+/// @return true if there is a cached game state
+bool nimbleClientGameStateCacheIsSet(const NimbleClientGameStateCache* self)
+{
+    return self->gameState.gameState != 0 && self->segmentCount > 0;
+}
+
+/// Writes the segment size and the segment hashes, in the format of the download game state request
+/// @param self game state cache
+/// @param stream stream to write to
+/// @return negative on error
+int nimbleClientGameStateCacheWriteHashes(const NimbleClientGameStateCache* self, FldOutStream* stream)
+{
+    fldOutStreamWriteUInt8(stream, (uint8_t) self->segmentCount);
+    fldOutStreamWriteUInt32(stream, (uint32_t) self->gameState.gameStateOctetCount);
+    fldOutStreamWriteUInt32(stream, (uint32_t) self->segmentOctetCount);
+    for (size_t i = 0; i < self->segmentCount; ++i) {
+        int err = fldOutStreamWriteUInt64(stream, self->segmentHashes[i]);
+        if (err < 0) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+static bool segmentIsSent(const NimbleClientGameStateCache* self, const NimbleClientGameStateDelta* delta,
+                          size_t segmentIndex)
+{
+    if (segmentIndex >= self->segmentCount) {
+        return true;
+    }
+
+    return ((delta->changedSegmentMask >> segmentIndex) & 1U) != 0;
+}
+
+/// Builds the complete game state from the cached game state and the downloaded segments.
+/// If the size is unchanged, the cached buffer is patched in place and handed over, otherwise a new buffer is
+/// allocated. The cache is empty afterwards, also on error.
+/// @param self game state cache
+/// @param delta describes which segments that were sent
+/// @param octets the sent segments
+/// @param octetCount octet count of octets
+/// @param gameState the complete game state, allocated from the blob allocator of the cached game state
+/// @return negative on error
+int nimbleClientGameStateCacheApplyDelta(NimbleClientGameStateCache* self, const NimbleClientGameStateDelta* delta,
+                                         const uint8_t* octets, size_t octetCount, uint8_t** gameState)
+{
+    size_t targetOctetCount = delta->gameStateOctetCount;
+    size_t cachedOctetCount = self->gameState.gameStateOctetCount;
+    bool patchInPlace = targetOctetCount == cachedOctetCount;
+
+    uint8_t* target = self->gameState.gameState;
+    if (!patchInPlace) {
+        target = IMPRINT_ALLOC((ImprintAllocator*) self->gameState.blobAllocator, targetOctetCount,
+                               "delta game state");
+    }
+
+    size_t readOffset = 0;
+    size_t segmentIndex = 0;
+    int result = 0;
+    for (size_t offset = 0; offset < targetOctetCount; offset += self->segmentOctetCount, segmentIndex++) {
+        size_t segmentOctetCount = targetOctetCount - offset;
+        if (segmentOctetCount > self->segmentOctetCount) {
+            segmentOctetCount = self->segmentOctetCount;
+        }
+
+        if (segmentIsSent(self, delta, segmentIndex)) {
+            if (readOffset + segmentOctetCount > octetCount) {
+                result = -2;
+                break;
+            }
+            tc_memcpy_octets(target + offset, octets + readOffset, segmentOctetCount);
+            readOffset += segmentOctetCount;
+        } else if (!patchInPlace) {
+            if (offset + segmentOctetCount > cachedOctetCount) {
+                result = -3;
+                break;
+            }
+            tc_memcpy_octets(target + offset, self->gameState.gameState + offset, segmentOctetCount);
+        }
+    }
+
+    if (result == 0 && readOffset != octetCount) {
+        result = -4;
+    }
+
+    if (result < 0) {
+        CLOG_SOFT_ERROR("game state delta does not match the cached game state (%d)", result)
+        if (!patchInPlace) {
+            IMPRINT_FREE(self->gameState.blobAllocator, target);
+        }
+        nimbleClientGameStateCacheDestroy(self);
+        return result;
+    }
+
+    if (patchInPlace) {
+        // The buffer is handed over, so it must not be freed with the cache
+        self->gameState.gameState = 0;
+    }
+    nimbleClientGameStateCacheDestroy(self);
+
+    *gameState = target;
+
+    return 0;
+}
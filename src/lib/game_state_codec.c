@@ -0,0 +1,326 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <clog/clog.h>
+#include <nimble-client/game_state_codec.h>
+
+// The compressed game state is a sequence of blocks:
+//   uint16 raw octet count, uint16 compressed octet count (zero if the block is stored uncompressed),
+//   followed by the block octets. Compressed blocks use the LZ4 block format.
+
+#define NIMBLE_CLIENT_CODEC_HASH_BITS (12)
+#define NIMBLE_CLIENT_CODEC_MIN_MATCH (4)
+#define NIMBLE_CLIENT_CODEC_MAX_OFFSET (65535)
+// LZ4 requires that the last match starts at least 12 octets before the end and the last 5 octets are literals
+#define NIMBLE_CLIENT_CODEC_MATCH_START_MARGIN (12)
+#define NIMBLE_CLIENT_CODEC_LAST_LITERALS (5)
+
+static uint32_t readUInt32(const uint8_t* p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static size_t readUInt16(const uint8_t* p)
+{
+    return (size_t) p[0] | ((size_t) p[1] << 8);
+}
+
+static void writeUInt16(uint8_t* p, size_t value)
+{
+    p[0] = (uint8_t) (value & 0xff);
+    p[1] = (uint8_t) ((value >> 8) & 0xff);
+}
+
+static size_t hashSequence(uint32_t sequence)
+{
+    return (size_t) ((sequence * 2654435761U) >> (32 - NIMBLE_CLIENT_CODEC_HASH_BITS));
+}
+
+static size_t writeLengthExtension(uint8_t* target, size_t length)
+{
+    size_t count = 0;
+    while (length >= 255) {
+        target[count++] = 255;
+        length -= 255;
+    }
+    target[count++] = (uint8_t) length;
+
+    return count;
+}
+
+static size_t sequenceMaxOctetCount(size_t literalLength, size_t matchLength)
+{
+    return 1 + literalLength / 255 + 1 + literalLength + 2 + matchLength / 255 + 1;
+}
+
+static size_t writeLiterals(uint8_t* target, uint8_t* token, const uint8_t* literals, size_t literalLength)
+{
+    size_t count = 0;
+    if (literalLength >= 15) {
+        *token = 0xf0;
+        count += writeLengthExtension(target, literalLength - 15);
+    } else {
+        *token = (uint8_t) (literalLength << 4);
+    }
+    tc_memcpy_octets(target + count, literals, literalLength);
+
+    return count + literalLength;
+}
+
+/// Greedy LZ4 block encoder. Only references octets within the block.
+/// @return compressed octet count, or negative if it does not fit in the target
+static ssize_t encodeBlock(const uint8_t* source, size_t sourceOctetCount, uint8_t* target, size_t targetOctetCount)
+{
+    uint32_t positionPlusOne[1 << NIMBLE_CLIENT_CODEC_HASH_BITS];
+    tc_mem_clear_type_n(positionPlusOne, 1 << NIMBLE_CLIENT_CODEC_HASH_BITS);
+
+    size_t matchStartLimit = sourceOctetCount > NIMBLE_CLIENT_CODEC_MATCH_START_MARGIN
+                                 ? sourceOctetCount - NIMBLE_CLIENT_CODEC_MATCH_START_MARGIN
+                                 : 0;
+    size_t matchEndLimit = sourceOctetCount - NIMBLE_CLIENT_CODEC_LAST_LITERALS;
+    size_t anchor = 0;
+    size_t pos = 0;
+    size_t out = 0;
+
+    while (pos < matchStartLimit) {
+        uint32_t sequence = readUInt32(source + pos);
+        size_t hash = hashSequence(sequence);
+        size_t candidatePlusOne = positionPlusOne[hash];
+        positionPlusOne[hash] = (uint32_t) (pos + 1);
+
+        if (candidatePlusOne == 0 || pos - (candidatePlusOne - 1) > NIMBLE_CLIENT_CODEC_MAX_OFFSET ||
+            readUInt32(source + candidatePlusOne - 1) != sequence) {
+            pos++;
+            continue;
+        }
+
+        size_t reference = candidatePlusOne - 1;
+        size_t matchLength = NIMBLE_CLIENT_CODEC_MIN_MATCH;
+        while (pos + matchLength < matchEndLimit && source[reference + matchLength] == source[pos + matchLength]) {
+            matchLength++;
+        }
+
+        size_t literalLength = pos - anchor;
+        size_t extraMatchLength = matchLength - NIMBLE_CLIENT_CODEC_MIN_MATCH;
+        if (out + sequenceMaxOctetCount(literalLength, extraMatchLength) > targetOctetCount) {
+            return -1;
+        }
+
+        uint8_t* token = &target[out++];
+        out += writeLiterals(target + out, token, source + anchor, literalLength);
+
+        size_t offset = pos - reference;
+        writeUInt16(target + out, offset);
+        out += 2;
+
+        if (extraMatchLength >= 15) {
+            *token |= 0x0f;
+            out += writeLengthExtension(target + out, extraMatchLength - 15);
+        } else {
+            *token |= (uint8_t) extraMatchLength;
+        }
+
+        pos += matchLength;
+        anchor = pos;
+    }
+
+    size_t literalLength = sourceOctetCount - anchor;
+    if (out + sequenceMaxOctetCount(literalLength, 0) > targetOctetCount) {
+        return -1;
+    }
+    uint8_t* token = &target[out++];
+    out += writeLiterals(target + out, token, source + anchor, literalLength);
+
+    return (ssize_t) out;
+}
+
+static int readLengthExtension(const uint8_t* source, size_t sourceOctetCount, size_t* pos, size_t* length)
+{
+    uint8_t value;
+    do {
+        if (*pos >= sourceOctetCount) {
+            return -1;
+        }
+        value = source[(*pos)++];
+        *length += value;
+    } while (value == 255);
+
+    return 0;
+}
+
+/// Decodes a LZ4 block. Matches can reference anything that has been decoded before the block.
+/// @return decoded octet count, or negative if the block is corrupt
+static ssize_t decodeBlock(const uint8_t* source, size_t sourceOctetCount, uint8_t* target, size_t writeOffset,
+                           size_t writeEnd)
+{
+    size_t pos = 0;
+    size_t out = writeOffset;
+
+    while (pos < sourceOctetCount) {
+        uint8_t token = source[pos++];
+
+        size_t literalLength = (size_t) (token >> 4);
+        if (literalLength == 15 && readLengthExtension(source, sourceOctetCount, &pos, &literalLength) < 0) {
+            return -1;
+        }
+        if (literalLength > sourceOctetCount - pos || literalLength > writeEnd - out) {
+            return -2;
+        }
+        tc_memcpy_octets(target + out, source + pos, literalLength);
+        pos += literalLength;
+        out += literalLength;
+
+        // The last sequence of a block only has literals
+        if (pos == sourceOctetCount) {
+            break;
+        }
+
+        if (sourceOctetCount - pos < 2) {
+            return -3;
+        }
+        size_t offset = readUInt16(source + pos);
+        pos += 2;
+        if (offset == 0 || offset > out) {
+            return -4;
+        }
+
+        size_t matchLength = (size_t) (token & 0x0f);
+        if (matchLength == 15 && readLengthExtension(source, sourceOctetCount, &pos, &matchLength) < 0) {
+            return -1;
+        }
+        matchLength += NIMBLE_CLIENT_CODEC_MIN_MATCH;
+        if (matchLength > writeEnd - out) {
+            return -5;
+        }
+
+        // Octet by octet, since the match is allowed to overlap the octets it produces
+        const uint8_t* match = target + out - offset;
+        for (size_t i = 0; i < matchLength; ++i) {
+            target[out + i] = match[i];
+        }
+        out += matchLength;
+    }
+
+    return (ssize_t) (out - writeOffset);
+}
+
+/// Initializes the decoder
+/// @param self decoder
+/// @param target buffer that receives the decoded game state
+/// @param targetOctetCount the decoded game state octet count
+void nimbleClientGameStateDecoderInit(NimbleClientGameStateDecoder* self, uint8_t* target, size_t targetOctetCount)
+{
+    self->target = target;
+    self->targetOctetCount = targetOctetCount;
+    self->writeOffset = 0;
+    self->readOffset = 0;
+}
+
+/// Decodes all blocks that are completely available
+/// @param self decoder
+/// @param compressed the compressed game state, only the start of it has to be valid
+/// @param availableOctetCount the number of valid octets from the start of compressed
+/// @return negative if the compressed game state is corrupt
+int nimbleClientGameStateDecoderFeed(NimbleClientGameStateDecoder* self, const uint8_t* compressed,
+                                     size_t availableOctetCount)
+{
+    while (availableOctetCount - self->readOffset >= NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_HEADER_OCTET_COUNT) {
+        const uint8_t* header = compressed + self->readOffset;
+        size_t rawOctetCount = readUInt16(header);
+        size_t compressedOctetCount = readUInt16(header + 2);
+        size_t payloadOctetCount = compressedOctetCount == 0 ? rawOctetCount : compressedOctetCount;
+
+        if (availableOctetCount - self->readOffset - NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_HEADER_OCTET_COUNT <
+            payloadOctetCount) {
+            break;
+        }
+
+        if (rawOctetCount > self->targetOctetCount - self->writeOffset) {
+            CLOG_SOFT_ERROR("game state decoder: block is larger than the game state")
+            return -1;
+        }
+
+        const uint8_t* payload = header + NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_HEADER_OCTET_COUNT;
+        if (compressedOctetCount == 0) {
+            tc_memcpy_octets(self->target + self->writeOffset, payload, rawOctetCount);
+        } else {
+            ssize_t decodedOctetCount = decodeBlock(payload, compressedOctetCount, self->target, self->writeOffset,
+                                                    self->writeOffset + rawOctetCount);
+            if (decodedOctetCount != (ssize_t) rawOctetCount) {
+                CLOG_SOFT_ERROR("game state decoder: corrupt block %zd", decodedOctetCount)
+                return -2;
+            }
+        }
+
+        self->writeOffset += rawOctetCount;
+        self->readOffset += NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_HEADER_OCTET_COUNT + payloadOctetCount;
+    }
+
+    return 0;
+}
+
+/// Checks if the whole game state has been decoded
+/// @param self decoder
+/// @return true if complete
+bool nimbleClientGameStateDecoderIsComplete(const NimbleClientGameStateDecoder* self)
+{
+    return self->writeOffset == self->targetOctetCount;
+}
+
+/// Calculates the worst case size of an encoded game state
+/// @param rawOctetCount game state octet count
+/// @return maximum encoded octet count
+size_t nimbleClientGameStateEncodeMaxOctetCount(size_t rawOctetCount)
+{
+    size_t blockCount = (rawOctetCount + NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_OCTET_COUNT - 1) /
+                        NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_OCTET_COUNT;
+
+    return rawOctetCount + blockCount * NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_HEADER_OCTET_COUNT;
+}
+
+/// Encodes a game state with NimbleClientGameStateCodecLz. Used by servers and tools.
+/// Blocks that do not compress are stored as they are.
+/// @param raw game state
+/// @param rawOctetCount game state octet count
+/// @param target target buffer, at least nimbleClientGameStateEncodeMaxOctetCount() octets
+/// @param targetOctetCount size of target buffer
+/// @return encoded octet count, or negative on error
+ssize_t nimbleClientGameStateEncode(const uint8_t* raw, size_t rawOctetCount, uint8_t* target,
+                                    size_t targetOctetCount)
+{
+    size_t out = 0;
+
+    for (size_t offset = 0; offset < rawOctetCount; offset += NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_OCTET_COUNT) {
+        size_t blockOctetCount = rawOctetCount - offset;
+        if (blockOctetCount > NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_OCTET_COUNT) {
+            blockOctetCount = NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_OCTET_COUNT;
+        }
+
+        if (targetOctetCount - out < NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_HEADER_OCTET_COUNT + blockOctetCount) {
+            return -1;
+        }
+
+        uint8_t* header = target + out;
+        uint8_t* payload = header + NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_HEADER_OCTET_COUNT;
+        writeUInt16(header, blockOctetCount);
+
+        // Only keep the compressed block if it is smaller than the raw block
+        ssize_t compressedOctetCount = -1;
+        if (blockOctetCount > NIMBLE_CLIENT_CODEC_LAST_LITERALS) {
+            compressedOctetCount = encodeBlock(raw + offset, blockOctetCount, payload, blockOctetCount - 1);
+        }
+
+        if (compressedOctetCount <= 0) {
+            writeUInt16(header + 2, 0);
+            tc_memcpy_octets(payload, raw + offset, blockOctetCount);
+            compressedOctetCount = (ssize_t) blockOctetCount;
+        } else {
+            writeUInt16(header + 2, (size_t) compressedOctetCount);
+        }
+
+        out += NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_HEADER_OCTET_COUNT + (size_t) compressedOctetCount;
+    }
+
+    return (ssize_t) out;
+}
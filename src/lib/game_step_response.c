@@ -7,7 +7,109 @@
 #include <nimble-client/client.h>
 #include <nimble-client/pong.h>
 #include <nimble-client/game_step_response.h>
-#include <nimble-steps-serialize/pending_in_serialize.h>
+
+/// Points into the stream instead of copying the octets out of it.
+static int borrowOctets(FldInStream* inStream, size_t octetCount, const uint8_t** octets)
+{
+    if (inStream->pos + octetCount > inStream->size) {
+        return -1;
+    }
+
+    *octets = inStream->p;
+    inStream->p += octetCount;
+    inStream->pos += octetCount;
+
+    return 0;
+}
+
+static int bufferOutOfOrderStep(NimbleClient* self, StepId stepId, const uint8_t* payload, size_t octetCount,
+                                bool* pendingIsBehind)
+{
+    NbsPendingSteps* pending = &self->authoritativePendingStepsFromServer;
+
+    if (*pendingIsBehind) {
+        nbsPendingStepsReset(pending, self->authoritativeStepsFromServer.expectedWriteId);
+        *pendingIsBehind = false;
+    }
+
+    return nbsPendingStepsTrySet(pending, stepId, payload, octetCount);
+}
+
+/// Reads the authoritative step ranges in place, using the same layout as nbsPendingStepsSerializeOutRanges().
+/// A step that is the next expected one, with no earlier gap waiting to be filled, is copied straight from the
+/// datagram into the authoritative steps buffer. Only steps that arrive ahead of a gap take the detour through
+/// the pending steps.
+/// @param self nimble protocol client
+/// @param inStream stream positioned at the step ranges
+/// @param[out] newestStepId the highest step id in the ranges, or NIMBLE_STEP_MAX if there were no steps
+/// @return number of steps that were new to the client, or negative on error
+static ssize_t readAuthoritativeStepsInPlace(NimbleClient* self, FldInStream* inStream, StepId* newestStepId)
+{
+    NbsSteps* steps = &self->authoritativeStepsFromServer;
+    NbsPendingSteps* pending = &self->authoritativePendingStepsFromServer;
+
+    StepId pendingExpectedStepId;
+    bool hasBufferedSteps = nbsPendingStepsReceiveMask(pending, &pendingExpectedStepId) != 0;
+    bool pendingIsBehind = !hasBufferedSteps && pendingExpectedStepId != steps->expectedWriteId;
+    size_t newStepCount = 0;
+    *newestStepId = NIMBLE_STEP_MAX;
+
+    uint8_t rangeCount;
+    fldInStreamReadUInt8(inStream, &rangeCount);
+
+    for (size_t rangeIndex = 0; rangeIndex < rangeCount; ++rangeIndex) {
+        StepId startStepId;
+        fldInStreamReadUInt32(inStream, &startStepId);
+        uint8_t stepCountInRange;
+        int err = fldInStreamReadUInt8(inStream, &stepCountInRange);
+        if (err < 0) {
+            return err;
+        }
+
+        for (size_t i = 0; i < stepCountInRange; ++i) {
+            StepId stepId = startStepId + (StepId) i;
+            uint8_t octetCount;
+            fldInStreamReadUInt8(inStream, &octetCount);
+            const uint8_t* payload;
+            err = borrowOctets(inStream, octetCount, &payload);
+            if (err < 0) {
+                return err;
+            }
+
+            if (*newestStepId == NIMBLE_STEP_MAX || stepId > *newestStepId) {
+                *newestStepId = stepId;
+            }
+
+            if (stepId < steps->expectedWriteId) {
+                continue;
+            }
+
+            if (stepId == steps->expectedWriteId && !hasBufferedSteps) {
+                err = nbsStepsWrite(steps, stepId, payload, octetCount);
+                pendingIsBehind = true;
+            } else {
+                err = bufferOutOfOrderStep(self, stepId, payload, octetCount, &pendingIsBehind);
+                hasBufferedSteps = true;
+            }
+            if (err < 0) {
+                return err;
+            }
+            newStepCount++;
+        }
+    }
+
+    if (hasBufferedSteps) {
+        int copyResult = nbsPendingStepsCopy(steps, pending);
+        if (copyResult < 0) {
+            CLOG_C_ERROR(&self->log, "nbsPendingStepsCopy failed: %d", copyResult)
+        }
+    } else if (pendingIsBehind) {
+        // Keep the receive mask and expected step id that are reported back to the server in sync
+        nbsPendingStepsReset(pending, steps->expectedWriteId);
+    }
+
+    return (ssize_t) newStepCount;
+}
 
 /// Handle game step response (`NimbleSerializeCmdGameStepResponse`) from server.
 /// Stream contains authoritative Steps from the server.
@@ -26,13 +128,15 @@ ssize_t nimbleClientOnGameStepResponse(NimbleClient* self, FldInStream* inStream
     int8_t deltaAgainstServerAuthoritativeBuffer;
     fldInStreamReadInt8(inStream, &deltaAgainstServerAuthoritativeBuffer);
 
+    nimbleClientPredictionDepthAddBufferDelta(&self->predictionDepth, deltaAgainstServerAuthoritativeBuffer);
+    nimbleClientTimeDilationAddBufferDelta(&self->timeDilation, deltaAgainstServerAuthoritativeBuffer);
+
     if (self->useStats) {
         statsIntAdd(&self->authoritativeBufferDeltaStat, deltaAgainstServerAuthoritativeBuffer);
+        LagometerPacket packet = {LagometerPacketStatusReceived, self->latencyMs, inStream->size};
+        lagometerAddPacket(&self->lagometer, packet);
     }
 
-    LagometerPacket packet = {LagometerPacketStatusReceived, self->latencyMs, inStream->size};
-    lagometerAddPacket(&self->lagometer, packet);
-
     uint32_t serverReceivedPredictedStepId;
     fldInStreamReadUInt32(inStream, &serverReceivedPredictedStepId);
     if (serverReceivedPredictedStepId != self->receivedStepIdByServerOnlyForDebug) {
@@ -43,25 +147,25 @@ ssize_t nimbleClientOnGameStepResponse(NimbleClient* self, FldInStream* inStream
 
     nbsStepsDiscardUpTo(&self->outSteps, serverReceivedPredictedStepId + 1);
 
-    ssize_t stepCount = nbsPendingStepsInSerialize(inStream, &self->authoritativePendingStepsFromServer);
+    StepId newestStepId;
+    ssize_t stepCount = readAuthoritativeStepsInPlace(self, inStream, &newestStepId);
     if (stepCount < 0) {
-        CLOG_C_SOFT_ERROR(&self->log, "GameStepResponse: nbsPendingStepsInSerialize() failed %zd", stepCount)
+        CLOG_C_SOFT_ERROR(&self->log, "GameStepResponse: readAuthoritativeStepsInPlace() failed %zd", stepCount)
         return stepCount;
     }
 
-    int copyResult = nbsPendingStepsCopy(&self->authoritativeStepsFromServer,
-                                         &self->authoritativePendingStepsFromServer);
-    if (copyResult < 0) {
-        CLOG_C_ERROR(&self->log, "nbsPendingStepsCopy failed: %d", copyResult)
-        // return copyResult;
+    if (newestStepId != NIMBLE_STEP_MAX) {
+        // The pong in the header of this datagram has just measured the round trip time
+        nimbleClientClockSyncAddSample(&self->clockSync, newestStepId, self->datagramReceivedAt,
+                                       (MonotonicTimeMs) self->latencyMs);
     }
 
-    statsIntAdd(&self->waitingStepsFromServer, (int) self->authoritativeStepsFromServer.stepsCount);
-
-    //if (stepCount > 0) {
-        nimbleClientConnectionQualityReceivedAuthoritativeSteps(&self->quality, (size_t) stepCount);
+    if (self->useStats) {
+        statsIntAdd(&self->waitingStepsFromServer, (int) self->authoritativeStepsFromServer.stepsCount);
         statsIntPerSecondAdd(&self->simulationStepsPerSecond, (int) stepCount);
-    //}
+    }
+
+    nimbleClientConnectionQualityReceivedAuthoritativeSteps(&self->quality, (size_t) stepCount);
 
 #if 1
     nbsStepsDebugOutput(&self->authoritativeStepsFromServer, "authoritative steps from server after in serialize", 0);
@@ -7,6 +7,7 @@
 #include <imprint/allocator.h>
 #include <nimble-client/client.h>
 #include <nimble-client/connect_response.h>
+#include <nimble-client/datagram_command.h>
 #include <nimble-client/download_state_part.h>
 #include <nimble-client/download_state_response.h>
 #include <nimble-client/game_step_response.h>
@@ -14,6 +15,8 @@
 #include <nimble-client/join_game_participants_full.h>
 #include <nimble-client/join_game_response.h>
 #include <nimble-client/pong.h>
+#include <nimble-client/utils.h>
+#include <nimble-serialize/client_in.h>
 #include <nimble-serialize/debug.h>
 
 static int readAndCheckOrderedDatagram(OrderedDatagramInLogic* inLogic, FldInStream* inStream, Clog* log)
@@ -29,16 +32,137 @@ static int readAndCheckOrderedDatagram(OrderedDatagramInLogic* inLogic, FldInStr
     return idDelta;
 }
 
+/// Reads the rest of the datagram as a connect response with debug markers, without moving inStream.
+/// The server sends the connect response with markers, since debug streams are not negotiated before it, so it can
+/// not be read in the negotiated mode if it arrives after the client has switched the markers off.
+static bool peekConnectResponseWithDebugInfo(const FldInStream* inStream, NimbleSerializeConnectResponse* response)
+{
+    FldInStream peekStream = *inStream;
+    peekStream.readDebugInfo = true;
+
+    // Compared by hand, a failed fldInStreamCheckMarker() is logged as an error
+    uint8_t pongMarker;
+    uint16_t pong;
+    uint8_t cmd;
+    if (fldInStreamReadUInt8(&peekStream, &pongMarker) < 0 || pongMarker != 0xdd ||
+        fldInStreamReadUInt16(&peekStream, &pong) < 0 || fldInStreamReadUInt8(&peekStream, &cmd) < 0 ||
+        cmd != NimbleSerializeCmdConnectResponse) {
+        return false;
+    }
+
+    // The connect response is always alone in its datagram
+    return nimbleSerializeClientInConnectResponse(&peekStream, response) >= 0 && peekStream.pos == peekStream.size;
+}
+
+/// Checks if the datagram must be ignored, since it is not in the debug marker mode that the client reads in
+/// @param self nimble protocol client
+/// @param inStream datagram stream, positioned after the ordered datagram id
+/// @return true if the datagram should be ignored
+static bool shouldIgnoreDatagram(NimbleClient* self, const FldInStream* inStream)
+{
+    NimbleSerializeConnectResponse response;
+
+    if (self->state == NimbleClientStateRequestingConnect) {
+        // The marker mode of everything after the connect response is unknown until it has been received. If the
+        // connect response was lost, the requests are resent after it.
+        if (!peekConnectResponseWithDebugInfo(inStream, &response)) {
+            CLOG_C_VERBOSE(&self->log, "ignoring datagram received before the connect response")
+            return true;
+        }
+        return false;
+    }
+
+    // A connect request that was resent before the connect response arrived is answered again
+    if (!inStream->readDebugInfo && peekConnectResponseWithDebugInfo(inStream, &response) &&
+        response.connectionId == self->remoteConnectionId) {
+        CLOG_C_VERBOSE(&self->log, "ignoring resent connect response")
+        return true;
+    }
+
+    return false;
+}
+
+static int handleCommand(NimbleClient* self, uint8_t cmd, FldInStream* inStream)
+{
+    CLOG_C_VERBOSE(&self->log, "incoming command: %s", nimbleSerializeCmdToString(cmd))
+
+    switch (cmd) {
+        case NimbleSerializeCmdConnectResponse:
+            return nimbleClientOnConnectResponse(self, inStream);
+        case NimbleSerializeCmdServerOutBlobStream:
+            return nimbleClientOnDownloadGameStatePart(self, inStream);
+        case NimbleSerializeCmdGameStepResponse:
+            return (int) nimbleClientOnGameStepResponse(self, inStream);
+        case NimbleSerializeCmdJoinGameResponse:
+            return nimbleClientOnJoinGameResponse(self, inStream);
+        case NimbleSerializeCmdGameStateResponse:
+            return nimbleClientOnDownloadGameStateResponse(self, inStream);
+        case NimbleSerializeCmdJoinGameOutOfParticipantSlotsResponse:
+            return nimbleClientOnJoinGameParticipantOutOfSpaceResponse(self, inStream);
+        default:
+            CLOG_C_SOFT_ERROR(&self->log, "unknown message %02X", cmd)
+            return -1;
+    }
+}
+
+static int readAndHandleCommand(NimbleClient* self, FldInStream* inStream)
+{
+    uint8_t cmd;
+    int readErr = fldInStreamReadUInt8(inStream, &cmd);
+    if (readErr < 0) {
+        return readErr;
+    }
+
+    return handleCommand(self, cmd, inStream);
+}
+
+/// Reads the commands of a datagram that starts with NIMBLE_CLIENT_DATAGRAM_COMMAND_LIST. Each command is read from
+/// a stream of its own, so a handler that ignores a command (or only reads a part of it) does not leave the next
+/// command misaligned.
+static int readAndHandleCommandList(NimbleClient* self, FldInStream* inStream)
+{
+    int result = -1;
+    do {
+        FldInStream commandStream;
+        int readErr = nimbleClientDatagramCommandRead(inStream, &commandStream);
+        if (readErr < 0) {
+            return readErr;
+        }
+
+        result = readAndHandleCommand(self, &commandStream);
+        if (result < 0) {
+            return result;
+        }
+    } while (inStream->pos < inStream->size);
+
+    return result;
+}
+
 /// Acts on the incoming octets received from the server
+/// The datagram can contain one or more commands (see NIMBLE_CLIENT_DATAGRAM_COMMAND_LIST).
 /// @param self nimble protocol client
 /// @param data received octet payload
 /// @param len octet length of data
 /// @return negative on error.
 int nimbleClientFeed(NimbleClient* self, const uint8_t* data, size_t len)
 {
+    return nimbleClientFeedReceivedAt(self, data, len, self->now);
+}
+
+/// Same as nimbleClientFeed(), but for a datagram that arrived before now, e.g. according to a kernel receive
+/// timestamp. The round trip time and clock samples are then measured from when it arrived.
+/// @param self nimble protocol client
+/// @param data received octet payload
+/// @param len octet length of data
+/// @param receivedAt when the datagram arrived, not later than now
+/// @return negative on error.
+int nimbleClientFeedReceivedAt(NimbleClient* self, const uint8_t* data, size_t len, MonotonicTimeMs receivedAt)
+{
+    self->datagramReceivedAt = receivedAt;
+
     FldInStream inStream;
     fldInStreamInit(&inStream, data, len);
-    inStream.readDebugInfo = true;
+    inStream.readDebugInfo = nimbleClientWireUsesDebugInfo(self);
 
     if (len < 1) {
         return -1;
@@ -54,59 +178,33 @@ int nimbleClientFeed(NimbleClient* self, const uint8_t* data, size_t len)
         return delta;
     }
     if (delta > 1) {
-        LagometerPacket droppedPacket = {LagometerPacketStatusDropped, 0, 0};
-        for (int i = 0; i < delta - 1; ++i) {
-            lagometerAddPacket(&self->lagometer, droppedPacket);
+        if (self->useStats) {
+            LagometerPacket droppedPacket = {LagometerPacketStatusDropped, 0, 0};
+            for (int i = 0; i < delta - 1; ++i) {
+                lagometerAddPacket(&self->lagometer, droppedPacket);
+            }
         }
         nimbleClientConnectionQualityDroppedDatagrams(&self->quality, (size_t) (delta - 1));
     }
 
+    if (shouldIgnoreDatagram(self, &inStream)) {
+        return 0;
+    }
+
     int err = nimbleClientReceivePong(self, &inStream);
     if (err < 0) {
         return err;
     }
 
     uint8_t cmd;
-    fldInStreamReadUInt8(&inStream, &cmd);
-    CLOG_C_VERBOSE(&self->log, "incoming command: %s", nimbleSerializeCmdToString(cmd))
-
-    int result = -1;
-    switch (cmd) {
-        case NimbleSerializeCmdConnectResponse:
-            result = nimbleClientOnConnectResponse(self, &inStream);
-            break;
-        case NimbleSerializeCmdServerOutBlobStream:
-            result = nimbleClientOnDownloadGameStatePart(self, &inStream);
-            break;
-        case NimbleSerializeCmdGameStepResponse:
-            result = (int) nimbleClientOnGameStepResponse(self, &inStream);
-            break;
-        case NimbleSerializeCmdJoinGameResponse:
-            result = nimbleClientOnJoinGameResponse(self, &inStream);
-            break;
-        case NimbleSerializeCmdGameStateResponse:
-            result = nimbleClientOnDownloadGameStateResponse(self, &inStream);
-            break;
-        case NimbleSerializeCmdJoinGameOutOfParticipantSlotsResponse:
-            result = nimbleClientOnJoinGameParticipantOutOfSpaceResponse(self, &inStream);
-            break;
-        default:
-            CLOG_C_SOFT_ERROR(&self->log, "unknown message %02X", cmd)
-            return -1;
+    err = fldInStreamReadUInt8(&inStream, &cmd);
+    if (err < 0) {
+        return err;
     }
 
-    if (result >= 0) {
-        if (inStream.pos != inStream.size) {
-            CLOG_C_ERROR(&self->log, "did not read all of it")
-        }
+    if (cmd == NIMBLE_CLIENT_DATAGRAM_COMMAND_LIST) {
+        return readAndHandleCommandList(self, &inStream);
     }
 
-    return result;
+    return handleCommand(self, cmd, &inStream);
 }
-
-/* TODO:
-  blobStreamInInit(&self->blobStreamIn, self->memory, self->blobStreamAllocator, octetCount, BLOB_STREAM_CHUNK_SIZE,
-self->log);
-blobStreamLogicInInit(&self->blobStreamInLogic, &self->blobStreamIn);
-
- */
@@ -43,8 +43,6 @@ int nimbleClientOnJoinGameResponse(NimbleClient* self, FldInStream* inStream)
                  self->localParticipantCount)
 
     self->joinParticipantPhase = NimbleJoiningStateJoinedParticipant;
-    self->waitTime = 0;
-    self->joinStateChannel = 0;
 
     return 0;
 }
@@ -8,7 +8,7 @@
 #include <nimble-client/debug.h>
 #include <nimble-client/network_realizer.h>
 
-/// Initializes the state machine
+/// Initializes the state machine. If settings has an arena, the client takes its memory from it instead of memory.
 /// @param self client realize
 /// @param settings settings
 void nimbleClientRealizeInit(NimbleClientRealize* self, const NimbleClientRealizeSettings* settings)
@@ -16,9 +16,16 @@ void nimbleClientRealizeInit(NimbleClientRealize* self, const NimbleClientRealiz
     self->targetState = NimbleClientRealizeStateInit;
     self->state = NimbleClientRealizeStateInit;
     self->settings = *settings;
-    nimbleClientInit(&self->client, settings->memory, settings->blobMemory, &self->settings.transport,
-                     settings->maximumSingleParticipantStepOctetCount, settings->maximumNumberOfParticipants,
-                     settings->applicationVersion, settings->wantsDebugStreams, settings->log);
+    if (settings->arena != 0) {
+        nimbleClientInitFromArena(&self->client, settings->arena, settings->arenaOctetCount, settings->blobMemory,
+                                  &self->settings.transport, settings->maximumSingleParticipantStepOctetCount,
+                                  settings->maximumNumberOfParticipants, settings->maximumGameStateOctetCount,
+                                  settings->applicationVersion, settings->wantsDebugStreams, settings->log);
+    } else {
+        nimbleClientInit(&self->client, settings->memory, settings->blobMemory, &self->settings.transport,
+                         settings->maximumSingleParticipantStepOctetCount, settings->maximumNumberOfParticipants,
+                         settings->applicationVersion, settings->wantsDebugStreams, settings->log);
+    }
 }
 
 void nimbleClientRealizeReInit(NimbleClientRealize* self, const NimbleClientRealizeSettings* settings)
@@ -54,6 +61,7 @@ void nimbleClientRealizeJoinGame(NimbleClientRealize* self, NimbleSerializeJoinG
                  request.players[0].participantId)
     self->targetState = NimbleClientRealizeStateSynced;
     self->client.joinParticipantPhase = NimbleJoiningStateJoiningParticipant;
+    nimbleClientRequestTimerReset(&self->client.joinGameRequestTimer);
 }
 
 void nimbleClientRealizeQuitGame(NimbleClientRealize* self)
@@ -104,16 +112,15 @@ void nimbleClientRealizeUpdate(NimbleClientRealize* self, MonotonicTimeMs now)
             switch (self->client.state) {
                 case NimbleClientStateIdle:
                     self->client.state = NimbleClientStateRequestingConnect;
-                    self->client.waitTime = 0;
+                    nimbleClientRequestTimerReset(&self->client.requestTimer);
                     break;
                 case NimbleClientStateConnected:
                     self->client.state = NimbleClientStateJoiningRequestingState;
                     self->client.joinParticipantPhase = NimbleJoiningStateJoiningParticipant;
-                    self->client.waitTime = 0;
+                    nimbleClientRequestTimerReset(&self->client.requestTimer);
                     break;
                 case NimbleClientStateSynced:
                     self->state = NimbleClientRealizeStateSynced;
-                    self->client.waitTime = 0;
                     break;
 
                 // If there is something in progress, do not do anything
@@ -127,3 +134,36 @@ void nimbleClientRealizeUpdate(NimbleClientRealize* self, MonotonicTimeMs now)
             break;
     }
 }
+
+/// Receives all waiting datagrams without sending. Call it when the transport poll handle is readable.
+/// @param self client realizer
+/// @param now current time
+void nimbleClientRealizeReceive(NimbleClientRealize* self, MonotonicTimeMs now)
+{
+    if (self->state == NimbleClientRealizeStateCleared || self->targetState == NimbleClientRealizeStateInit) {
+        return;
+    }
+
+    nimbleClientReceive(&self->client, now);
+}
+
+/// Calculates when nimbleClientRealizeUpdate() must be called next
+/// @param self client realizer
+/// @param deadline the time of the next update
+/// @return false if there is nothing scheduled
+bool nimbleClientRealizeNextDeadline(const NimbleClientRealize* self, MonotonicTimeMs* deadline)
+{
+    bool clientIsDisconnected = self->client.state == NimbleClientStateDisconnected;
+    if (clientIsDisconnected && self->state != NimbleClientRealizeStateDisconnected) {
+        *deadline = self->client.now;
+        return true;
+    }
+
+    if (self->targetState != self->state && !clientIsDisconnected) {
+        // Transitions are driven by the update, so it should keep ticking until they are done
+        *deadline = nimbleClientNextTickAt(&self->client);
+        return true;
+    }
+
+    return nimbleClientNextDeadline(&self->client, deadline);
+}
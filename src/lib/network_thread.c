@@ -0,0 +1,231 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <imprint/allocator.h>
+#include <nimble-client/atomic.h>
+#include <nimble-client/network_thread.h>
+#include <nimble-steps-serialize/out_serialize.h>
+
+#if !defined _WIN32
+#include <poll.h>
+#endif
+
+// Upper bound of a single wait, so a stop request is noticed even when there is no deadline
+#define NIMBLE_CLIENT_NETWORK_THREAD_MAX_WAIT_MS (100)
+
+static void waitForWork(NimbleClientNetworkThread* self, MonotonicTimeMs now)
+{
+    int timeoutMs = NIMBLE_CLIENT_NETWORK_THREAD_MAX_WAIT_MS;
+    MonotonicTimeMs deadline;
+    if (nimbleClientRealizeNextDeadline(self->realize, &deadline)) {
+        MonotonicTimeMs untilDeadline = deadline > now ? deadline - now : 0;
+        if (untilDeadline < timeoutMs) {
+            timeoutMs = (int) untilDeadline;
+        }
+    }
+
+    if (timeoutMs == 0) {
+        return;
+    }
+
+#if defined _WIN32
+    Sleep((DWORD) timeoutMs);
+#else
+    int handle = nimbleClientTransportPollHandle(&self->realize->client);
+    if (handle < 0) {
+        poll(0, 0, timeoutMs);
+        return;
+    }
+
+    struct pollfd pollFd;
+    pollFd.fd = handle;
+    pollFd.events = POLLIN;
+    pollFd.revents = 0;
+    int readyCount = poll(&pollFd, 1, timeoutMs);
+    if (readyCount > 0 && (pollFd.revents & POLLIN)) {
+        nimbleClientRealizeReceive(self->realize, nimbleClientClockNow(&self->realize->client.clock));
+    }
+#endif
+}
+
+static void moveInPredictedSteps(NimbleClientNetworkThread* self)
+{
+    NbsSteps* outSteps = &self->realize->client.outSteps;
+
+    while (nbsStepsAllowedToAdd(outSteps)) {
+        StepId stepId;
+        int octetCount = nimbleClientStepQueueRead(&self->predictedSteps, &stepId, self->stepBuffer,
+                                                   self->stepBufferOctetCount);
+        if (octetCount <= 0) {
+            if (octetCount < 0) {
+                CLOG_C_SOFT_ERROR(&self->log, "could not read predicted step from queue %d", octetCount)
+            }
+            return;
+        }
+
+        int err = nbsStepsWrite(outSteps, stepId, self->stepBuffer, (size_t) octetCount);
+        if (err < 0) {
+            CLOG_C_SOFT_ERROR(&self->log, "could not add predicted step %08X: %d", stepId, err)
+        }
+    }
+}
+
+static void moveOutAuthoritativeSteps(NimbleClientNetworkThread* self)
+{
+    // A step that did not fit in the queue last time is kept in the second half of the step buffer
+    uint8_t* pendingPayload = self->stepBuffer + self->stepBufferOctetCount;
+
+    while (1) {
+        if (!self->hasPendingAuthoritativeStep) {
+            int octetCount = nimbleClientReadStep(&self->realize->client, pendingPayload, self->stepBufferOctetCount,
+                                                  &self->pendingAuthoritativeStepId);
+            if (octetCount <= 0) {
+                return;
+            }
+            self->pendingAuthoritativeStepOctetCount = (size_t) octetCount;
+            self->hasPendingAuthoritativeStep = true;
+        }
+
+        int err = nimbleClientStepQueueWrite(&self->authoritativeSteps, self->pendingAuthoritativeStepId,
+                                             pendingPayload, self->pendingAuthoritativeStepOctetCount);
+        if (err < 0) {
+            // Queue is full, the game thread is behind. Try again next update.
+            return;
+        }
+        self->hasPendingAuthoritativeStep = false;
+    }
+}
+
+static void networkThreadUpdate(NimbleClientNetworkThread* self)
+{
+    MonotonicTimeMs now = nimbleClientClockNow(&self->realize->client.clock);
+
+    moveInPredictedSteps(self);
+    nimbleClientRealizeUpdate(self->realize, now);
+    moveOutAuthoritativeSteps(self);
+
+    nimbleClientAtomicStoreRelease(&self->publishedRealizeState, (size_t) self->realize->state);
+
+    waitForWork(self, nimbleClientClockNow(&self->realize->client.clock));
+}
+
+#if defined _WIN32
+static DWORD WINAPI networkThreadMain(LPVOID arg)
+#else
+static void* networkThreadMain(void* arg)
+#endif
+{
+    NimbleClientNetworkThread* self = (NimbleClientNetworkThread*) arg;
+
+    while (nimbleClientAtomicLoadAcquire(&self->isRunning)) {
+        networkThreadUpdate(self);
+    }
+
+    return 0;
+}
+
+/// Prepares a network thread for the client realizer. Allocates the step queues up front.
+/// @param self network thread
+/// @param realize client realizer that has been initialized, the thread takes over updating it
+/// @param memory allocator for the queues
+/// @param queueCapacity number of steps in each queue, must be a power of two
+/// @return negative on error
+int nimbleClientNetworkThreadInit(NimbleClientNetworkThread* self, NimbleClientRealize* realize,
+                                  struct ImprintAllocator* memory, size_t queueCapacity)
+{
+    const NimbleClient* client = &realize->client;
+    size_t combinedStepOctetCount = nbsStepsOutSerializeCalculateCombinedSize(
+        client->maximumNumberOfParticipants, client->maximumSingleParticipantStepOctetCount);
+
+    self->realize = realize;
+    self->log = client->log;
+    self->isRunning = 0;
+    self->hasPendingAuthoritativeStep = false;
+    self->publishedRealizeState = (size_t) realize->state;
+    self->stepBufferOctetCount = combinedStepOctetCount;
+    // one half for predicted steps, one half for an authoritative step waiting for room in the queue
+    self->stepBuffer = IMPRINT_ALLOC(memory, combinedStepOctetCount * 2, "network thread step buffer");
+
+    int err = nimbleClientStepQueueInit(&self->predictedSteps, memory, queueCapacity, combinedStepOctetCount);
+    if (err < 0) {
+        return err;
+    }
+
+    return nimbleClientStepQueueInit(&self->authoritativeSteps, memory, queueCapacity, combinedStepOctetCount);
+}
+
+/// Starts the network thread. The realizer must not be updated by the game thread after this.
+/// @param self network thread
+/// @return negative on error
+int nimbleClientNetworkThreadStart(NimbleClientNetworkThread* self)
+{
+    nimbleClientAtomicStoreRelease(&self->isRunning, 1);
+
+#if defined _WIN32
+    self->thread = CreateThread(0, 0, networkThreadMain, self, 0, 0);
+    if (self->thread == 0) {
+        self->isRunning = 0;
+        return -1;
+    }
+#else
+    int err = pthread_create(&self->thread, 0, networkThreadMain, self);
+    if (err != 0) {
+        self->isRunning = 0;
+        CLOG_C_SOFT_ERROR(&self->log, "could not create network thread %d", err)
+        return -err;
+    }
+#endif
+
+    return 0;
+}
+
+/// Stops the network thread and waits for it to finish. The realizer can be used from the game thread afterwards.
+/// @param self network thread
+void nimbleClientNetworkThreadStop(NimbleClientNetworkThread* self)
+{
+    if (!self->isRunning) {
+        return;
+    }
+
+    nimbleClientAtomicStoreRelease(&self->isRunning, 0);
+
+#if defined _WIN32
+    WaitForSingleObject(self->thread, INFINITE);
+    CloseHandle(self->thread);
+#else
+    pthread_join(self->thread, 0);
+#endif
+}
+
+/// Hands a predicted (local) step over to the network thread. Called from the game thread.
+/// @param self network thread
+/// @param stepId step id of the predicted step
+/// @param payload combined step
+/// @param octetCount octet count of payload
+/// @return negative if the queue is full
+int nimbleClientNetworkThreadAddPredictedStep(NimbleClientNetworkThread* self, StepId stepId, const uint8_t* payload,
+                                              size_t octetCount)
+{
+    return nimbleClientStepQueueWrite(&self->predictedSteps, stepId, payload, octetCount);
+}
+
+/// Reads an authoritative step that the network thread has received. Called from the game thread.
+/// @param self network thread
+/// @param target target buffer that receives the combined authoritative step
+/// @param maxTarget maximum number of octets in target buffer
+/// @param outStepId the step id of the authoritative step
+/// @return octet count of the step, zero if there is none, negative on error
+int nimbleClientNetworkThreadReadStep(NimbleClientNetworkThread* self, uint8_t* target, size_t maxTarget,
+                                      StepId* outStepId)
+{
+    return nimbleClientStepQueueRead(&self->authoritativeSteps, outStepId, target, maxTarget);
+}
+
+/// Gets the realizer state as last published by the network thread. Called from the game thread.
+/// @param self network thread
+/// @return realizer state
+NimbleClientRealizeState nimbleClientNetworkThreadState(const NimbleClientNetworkThread* self)
+{
+    return (NimbleClientRealizeState) nimbleClientAtomicLoadAcquire(&self->publishedRealizeState);
+}
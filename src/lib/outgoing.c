@@ -7,26 +7,57 @@
 #include <flood/out_stream.h>
 #include <monotonic-time/lower_bits.h>
 #include <nimble-client/client.h>
+#include <nimble-client/datagram_command.h>
 #include <nimble-client/debug.h>
+#include <nimble-client/download_state_response.h>
 #include <nimble-client/outgoing.h>
 #include <nimble-client/prepare_header.h>
 #include <nimble-client/send_steps.h>
+#include <nimble-client/utils.h>
 #include <nimble-serialize/debug.h>
 #include <nimble-serialize/serialize.h>
 
+/// Checks if the datagrams can have more than one command (see NIMBLE_CLIENT_DATAGRAM_COMMAND_LIST). Without
+/// packed datagrams or a pipelined join there is only one command in each datagram, so it is written without
+/// the command list and the octet count, the same as the original protocol.
+static bool usesCommandList(const NimbleClient* self)
+{
+    return self->usePackedDatagrams || self->usePipelinedJoin;
+}
+
+static size_t commandBegin(const NimbleClient* self, FldOutStream* stream)
+{
+    if (!usesCommandList(self)) {
+        return stream->pos;
+    }
+
+    return nimbleClientDatagramCommandBegin(stream);
+}
+
+static int commandEnd(const NimbleClient* self, FldOutStream* stream, size_t commandStart)
+{
+    if (!usesCommandList(self)) {
+        return 0;
+    }
+
+    return nimbleClientDatagramCommandEnd(stream, commandStart);
+}
+
 static int sendBlobStreamCommands(NimbleClient* self, FldOutStream* stream)
 {
     CLOG_C_VERBOSE(&self->log, "game state ack to server on channel %04X. Game State is downloading to the client",
                    self->joinStateChannel)
 
+    size_t commandStart = commandBegin(self, stream);
     nimbleSerializeWriteCommand(stream, NimbleSerializeCmdClientOutBlobStream, &self->log);
     int errorCode = blobStreamLogicInSend(&self->blobStreamInLogic, stream);
     if (errorCode < 0) {
         return errorCode;
     }
-    self->waitTime = 0;
+    self->blobStreamChunksSinceAck = 0;
+    self->lastBlobStreamAckAt = self->now;
 
-    return 0;
+    return commandEnd(self, stream, commandStart);
 }
 
 static int sendConnectRequest(NimbleClient* self, FldOutStream* stream)
@@ -42,41 +73,129 @@ static int sendConnectRequest(NimbleClient* self, FldOutStream* stream)
                  nimbleSerializeVersionToString(&connectRequest.applicationVersion, buf, 32),
                  nimbleSerializeVersionToString(&g_nimbleProtocolVersion, buf2, 32), self->wantsDebugStreams)
 
+    size_t commandStart = commandBegin(self, stream);
     nimbleSerializeClientOutConnectRequest(stream, &connectRequest, &self->log);
 
-    self->waitTime = 4;
-
-    return 0;
+    return commandEnd(self, stream, commandStart);
 }
 
 static int sendStartDownloadStateRequest(NimbleClient* self, FldOutStream* stream)
 {
     CLOG_C_VERBOSE(&self->log, "request downloading of state from server")
 
+    size_t commandStart = commandBegin(self, stream);
     nimbleSerializeWriteCommand(stream, NimbleSerializeCmdDownloadGameStateRequest, &self->log);
     fldOutStreamWriteUInt8(stream, self->downloadStateClientRequestId);
+    // The blob stream has no header of its own, so the octet count is needed to receive it
+    uint8_t options = NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_OCTET_COUNT;
+    if (self->wantsCompressedGameState) {
+        options |= NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_LZ;
+    }
+    // A game state receiver does not leave a copy of the game state in the client to apply a delta on
+    bool canUseDelta = self->useDeltaResync && self->gameStateReceiver.receiveChunk == 0 &&
+                       nimbleClientGameStateCacheIsSet(&self->gameStateCache);
+    if (canUseDelta) {
+        options |= NIMBLE_CLIENT_DOWNLOAD_STATE_OPTION_DELTA;
+    }
+    fldOutStreamWriteUInt8(stream, options);
+    self->downloadStateRequestOptions = options;
 
-    self->waitTime = 4;
+    if (canUseDelta) {
+        int err = nimbleClientGameStateCacheWriteHashes(&self->gameStateCache, stream);
+        if (err < 0) {
+            return err;
+        }
+    }
 
-    return 0;
+    return commandEnd(self, stream, commandStart);
 }
 
-static int sendJoinGameRequest(NimbleClient* self, FldOutStream* stream)
+/// Sends the participant join request, if it has not been answered and the resend timer says so
+static int sendJoinGameRequestIfDue(NimbleClient* self, FldOutStream* stream)
 {
+    if (self->joinParticipantPhase != NimbleJoiningStateJoiningParticipant ||
+        !nimbleClientRequestTimerIsDue(&self->joinGameRequestTimer, self->now)) {
+        return 0;
+    }
+
     CLOG_C_VERBOSE(&self->log, "--------------------- send join game request")
 
+    size_t commandStart = commandBegin(self, stream);
     nimbleSerializeClientOutJoinGameRequest(stream, &self->joinGameRequest, &self->log);
-    self->waitTime = 4;
+    nimbleClientRequestTimerSent(&self->joinGameRequestTimer, &self->rto, self->now);
+
+    return commandEnd(self, stream, commandStart);
+}
+
+/// Adds the participant join request to the handshake datagrams, so the participants are joined
+/// while the game state is requested and downloaded.
+static int writePipelinedJoinGameRequest(NimbleClient* self, FldOutStream* stream)
+{
+    if (!self->usePipelinedJoin) {
+        return 0;
+    }
+
+    return sendJoinGameRequestIfDue(self, stream);
+}
+
+/// Sends the connect request. With a pipelined join, the download game state request and the participant
+/// join request follow in the same datagram, in the order that the server must handle them.
+static int sendHandshakeRequests(NimbleClient* self, FldOutStream* stream)
+{
+    if (!nimbleClientRequestTimerIsDue(&self->requestTimer, self->now)) {
+        return 0;
+    }
+
+    int result = sendConnectRequest(self, stream);
+    if (result < 0) {
+        return result;
+    }
+
+    if (self->usePipelinedJoin) {
+        result = sendStartDownloadStateRequest(self, stream);
+        if (result < 0) {
+            return result;
+        }
+        result = writePipelinedJoinGameRequest(self, stream);
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    nimbleClientRequestTimerSent(&self->requestTimer, &self->rto, self->now);
 
     return 0;
 }
 
+static int sendJoiningRequests(NimbleClient* self, FldOutStream* stream)
+{
+    if (nimbleClientRequestTimerIsDue(&self->requestTimer, self->now)) {
+        int result = sendStartDownloadStateRequest(self, stream);
+        if (result < 0) {
+            return result;
+        }
+        nimbleClientRequestTimerSent(&self->requestTimer, &self->rto, self->now);
+    }
+
+    return writePipelinedJoinGameRequest(self, stream);
+}
+
+static int sendDownloadingCommands(NimbleClient* self, FldOutStream* stream)
+{
+    int result = writePipelinedJoinGameRequest(self, stream);
+    if (result < 0) {
+        return result;
+    }
+
+    return sendBlobStreamCommands(self, stream);
+}
+
 static int updateSyncedSubState(NimbleClient* self, FldOutStream* outStream)
 {
     // CLOG_C_VERBOSE(&self->log, "participant phase: %d", self->joinParticipantPhase)
     switch (self->joinParticipantPhase) {
         case NimbleJoiningStateJoiningParticipant:
-            return sendJoinGameRequest(self, outStream);
+            return sendJoinGameRequestIfDue(self, outStream);
         case NimbleJoiningStateJoinedParticipant:
             return 0;
         case NimbleJoiningStateOutOfParticipantSlots:
@@ -88,13 +207,13 @@ static TC_FORCE_INLINE int sendMessageUsingStream(NimbleClient* self, FldOutStre
 {
     switch (self->state) {
         case NimbleClientStateRequestingConnect:
-            return sendConnectRequest(self, outStream);
+            return sendHandshakeRequests(self, outStream);
         case NimbleClientStateConnected:
             return 0;
         case NimbleClientStateJoiningRequestingState:
-            return sendStartDownloadStateRequest(self, outStream);
+            return sendJoiningRequests(self, outStream);
         case NimbleClientStateJoiningDownloadingState:
-            return sendBlobStreamCommands(self, outStream);
+            return sendDownloadingCommands(self, outStream);
         case NimbleClientStateIdle:
             return 0;
         case NimbleClientStateDisconnected:
@@ -104,6 +223,96 @@ static TC_FORCE_INLINE int sendMessageUsingStream(NimbleClient* self, FldOutStre
     }
 }
 
+/// Writes the datagram header, followed by the command list octet if the datagram can have more than one command
+/// @return the position to pass to sendStream()
+static size_t prepareOutStream(NimbleClient* self, FldOutStream* outStream, uint8_t* buf)
+{
+    fldOutStreamInit(outStream, buf, DATAGRAM_TRANSPORT_MAX_SIZE);
+    outStream->writeDebugInfo = nimbleClientWireUsesDebugInfo(self);
+    nimbleClientWriteHeader(self, outStream);
+    if (!usesCommandList(self)) {
+        return outStream->pos;
+    }
+
+    // E.g. a pipelined join or control commands packed with the steps
+    return nimbleClientDatagramCommandsBegin(outStream);
+}
+
+static int sendStream(NimbleClient* self, DatagramTransportOut* transportOut, FldOutStream* outStream,
+                      size_t commandsStart)
+{
+    if (usesCommandList(self)) {
+        // A datagram that only got one command is sent without the command list
+        int err = nimbleClientDatagramCommandsEnd(outStream, commandsStart);
+        if (err < 0) {
+            return err;
+        }
+    }
+
+    nimbleClientCommitHeader(self);
+    if (self->useStats) {
+        statsIntPerSecondAdd(&self->packetsPerSecondOut, 1);
+    }
+    return transportOut->send(transportOut->self, outStream->octets, outStream->pos);
+}
+
+/// Writes the control commands followed by the predicted steps into a single datagram.
+/// The steps command is always last, so the server can read the commands in order.
+static int sendPackedSynced(NimbleClient* self, DatagramTransportOut* transportOut)
+{
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    FldOutStream outStream;
+
+    size_t commandsStart = prepareOutStream(self, &outStream, buf);
+    size_t headerOctetCount = outStream.pos;
+    NimbleClientRequestTimer joinGameRequestTimerBefore = self->joinGameRequestTimer;
+
+    int result = updateSyncedSubState(self, &outStream);
+    if (result < 0) {
+        return result;
+    }
+
+    bool hasControlCommands = outStream.pos > headerOctetCount;
+
+    size_t stepsCommandStart = commandBegin(self, &outStream);
+    ssize_t stepsWritten = nimbleClientWriteStepsToStream(self, &outStream);
+    if (stepsWritten >= 0) {
+        result = commandEnd(self, &outStream, stepsCommandStart);
+        if (result < 0) {
+            return result;
+        }
+    }
+    if (stepsWritten < 0) {
+        if (!hasControlCommands) {
+            return (int) stepsWritten;
+        }
+        CLOG_C_VERBOSE(&self->log, "steps did not fit together with the control commands, sending them separately")
+        commandsStart = prepareOutStream(self, &outStream, buf);
+        // The control commands are written again, so they must be due again
+        self->joinGameRequestTimer = joinGameRequestTimerBefore;
+        result = updateSyncedSubState(self, &outStream);
+        if (result < 0) {
+            return result;
+        }
+        result = sendStream(self, transportOut, &outStream, commandsStart);
+        if (result < 0) {
+            return result;
+        }
+        return nimbleClientSendStepsToServer(self, transportOut);
+    }
+
+    // Same as the unpacked path, no datagram when there is nothing to send
+    if (stepsWritten == 0 && !hasControlCommands) {
+        return 0;
+    }
+
+    if (self->useStats) {
+        statsIntPerSecondAdd(&self->sentStepsDatagramCountPerSecond, 1);
+    }
+
+    return sendStream(self, transportOut, &outStream, commandsStart);
+}
+
 static int handleState(NimbleClient* self, DatagramTransportOut* transportOut)
 {
     uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
@@ -121,6 +330,10 @@ static int handleState(NimbleClient* self, DatagramTransportOut* transportOut)
         case NimbleClientStateJoiningRequestingState:
         case NimbleClientStateJoiningDownloadingState:
         case NimbleClientStateSynced: {
+            if (self->state == NimbleClientStateSynced && self->usePackedDatagrams) {
+                return sendPackedSynced(self, transportOut);
+            }
+
             if (self->state == NimbleClientStateSynced) {
                 int sendStepsError = nimbleClientSendStepsToServer(self, transportOut);
                 if (sendStepsError < 0) {
@@ -129,23 +342,20 @@ static int handleState(NimbleClient* self, DatagramTransportOut* transportOut)
             }
 
             FldOutStream outStream;
-            fldOutStreamInit(&outStream, buf, DATAGRAM_TRANSPORT_MAX_SIZE);
-            outStream.writeDebugInfo = true; // self->useDebugStreams;
-            nimbleClientWriteHeader(self, &outStream);
+            size_t commandsStart = prepareOutStream(self, &outStream, buf);
+            size_t headerOctetCount = outStream.pos;
 
             int result = sendMessageUsingStream(self, &outStream);
             if (result < 0) {
                 return result;
             }
 
-            nimbleClientCommitHeader(self);
-
-            if (outStream.pos <= 10) {
+            // Nothing is due, e.g. a request that is waiting for its resend timer
+            if (outStream.pos == headerOctetCount) {
                 return 0;
             }
 
-            statsIntPerSecondAdd(&self->packetsPerSecondOut, 1);
-            return transportOut->send(transportOut->self, outStream.octets, outStream.pos);
+            return sendStream(self, transportOut, &outStream, commandsStart);
         }
     }
 }
@@ -169,3 +379,67 @@ int nimbleClientOutgoing(NimbleClient* self, DatagramTransportOut* transportOut)
 
     return 0;
 }
+
+static bool blobStreamAckIsDue(const NimbleClient* self)
+{
+    if (self->blobStreamChunksSinceAck == 0) {
+        return false;
+    }
+
+    // The last chunk is acked right away, so the server knows that it can stop sending
+    if (blobStreamInIsComplete(&self->blobStreamIn)) {
+        return true;
+    }
+
+    if (self->blobStreamAckChunkWindow != 0 && self->blobStreamChunksSinceAck >= self->blobStreamAckChunkWindow) {
+        return true;
+    }
+
+    return self->blobStreamAckIntervalMs != 0 && self->now - self->lastBlobStreamAckAt >= self->blobStreamAckIntervalMs;
+}
+
+/// Acks the received game state chunks in a datagram of its own, if the ack pacing says that it is due.
+/// Lets the server advance its send window without waiting for the next nimbleClientUpdate().
+/// @param self nimble protocol client
+/// @return negative on error
+int nimbleClientSendBlobStreamAckIfDue(NimbleClient* self)
+{
+    if (self->state != NimbleClientStateJoiningDownloadingState || !self->blobStreamInIsAllocated) {
+        return 0;
+    }
+
+    if (!blobStreamAckIsDue(self)) {
+        return 0;
+    }
+
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    FldOutStream outStream;
+    size_t commandsStart = prepareOutStream(self, &outStream, buf);
+
+    int result = sendBlobStreamCommands(self, &outStream);
+    if (result < 0) {
+        return result;
+    }
+
+    DatagramTransportOut transportOut;
+    transportOut.self = self->transport.self;
+    transportOut.send = self->transport.send;
+
+    return sendStream(self, &transportOut, &outStream, commandsStart);
+}
+
+/// Calculates when the chunks that have not been acked yet must be acked at the latest
+/// @param self nimble protocol client
+/// @param deadline the time of the ack
+/// @return false if no ack is pending
+bool nimbleClientBlobStreamAckDeadline(const NimbleClient* self, MonotonicTimeMs* deadline)
+{
+    if (self->state != NimbleClientStateJoiningDownloadingState || self->blobStreamChunksSinceAck == 0 ||
+        self->blobStreamAckIntervalMs == 0) {
+        return false;
+    }
+
+    *deadline = self->lastBlobStreamAckAt + self->blobStreamAckIntervalMs;
+
+    return true;
+}
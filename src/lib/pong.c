@@ -5,7 +5,6 @@
 #include <nimble-client/pong.h>
 #include <nimble-client/client.h>
 #include <flood/in_stream.h>
-#include <monotonic-time/monotonic_time.h>
 #include <monotonic-time/lower_bits.h>
 
 int nimbleClientReceivePong(NimbleClient* self, FldInStream* inStream)
@@ -17,13 +16,16 @@ int nimbleClientReceivePong(NimbleClient* self, FldInStream* inStream)
         return readResult;
     }
 
-    MonotonicTimeMs now = monotonicTimeMsNow();
+    // Measured from when the datagram arrived, so time spent waiting to be read is not counted as latency
+    MonotonicTimeMs now = self->datagramReceivedAt;
     MonotonicTimeMs sentAt = monotonicTimeMsFromLowerBits(now, monotonicTimeShortMs);
 
     if (now < sentAt) {
         CLOG_C_NOTICE(&self->log, "time problems in lower bits")
     } else {
         self->latencyMs = (size_t) (now - sentAt);
+        nimbleClientRtoAddSample(&self->rto, now - sentAt);
+        nimbleClientPredictionDepthAddRtt(&self->predictionDepth, now - sentAt);
     }
 
     nimbleClientConnectionQualityGameStepLatency(&self->quality, self->latencyMs);
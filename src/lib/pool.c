@@ -0,0 +1,605 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <imprint/allocator.h>
+#include <nimble-client/atomic.h>
+#include <nimble-client/pool.h>
+#include <tiny-libc/tiny_libc.h>
+
+#define NIMBLE_CLIENT_POOL_NO_DATAGRAM ((size_t) -1)
+
+#if defined _WIN32
+static void mutexInit(NimbleClientPoolMutex* mutex)
+{
+    InitializeCriticalSection(mutex);
+}
+
+static void mutexDestroy(NimbleClientPoolMutex* mutex)
+{
+    DeleteCriticalSection(mutex);
+}
+
+static void mutexLock(NimbleClientPoolMutex* mutex)
+{
+    EnterCriticalSection(mutex);
+}
+
+static void mutexUnlock(NimbleClientPoolMutex* mutex)
+{
+    LeaveCriticalSection(mutex);
+}
+
+static void conditionInit(NimbleClientPoolCondition* condition)
+{
+    InitializeConditionVariable(condition);
+}
+
+static void conditionDestroy(NimbleClientPoolCondition* condition)
+{
+    (void) condition;
+}
+
+static void conditionWait(NimbleClientPoolCondition* condition, NimbleClientPoolMutex* mutex)
+{
+    SleepConditionVariableCS(condition, mutex, INFINITE);
+}
+
+static void conditionBroadcast(NimbleClientPoolCondition* condition)
+{
+    WakeAllConditionVariable(condition);
+}
+#else
+static void mutexInit(NimbleClientPoolMutex* mutex)
+{
+    pthread_mutex_init(mutex, 0);
+}
+
+static void mutexDestroy(NimbleClientPoolMutex* mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+static void mutexLock(NimbleClientPoolMutex* mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+static void mutexUnlock(NimbleClientPoolMutex* mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+static void conditionInit(NimbleClientPoolCondition* condition)
+{
+    pthread_cond_init(condition, 0);
+}
+
+static void conditionDestroy(NimbleClientPoolCondition* condition)
+{
+    pthread_cond_destroy(condition);
+}
+
+static void conditionWait(NimbleClientPoolCondition* condition, NimbleClientPoolMutex* mutex)
+{
+    pthread_cond_wait(condition, mutex);
+}
+
+static void conditionBroadcast(NimbleClientPoolCondition* condition)
+{
+    pthread_cond_broadcast(condition);
+}
+#endif
+
+static uint64_t makeRange(size_t begin, size_t end)
+{
+    return ((uint64_t) end << 32) | (uint64_t) begin;
+}
+
+static bool takeFromFront(volatile uint64_t* range, size_t* entryIndex)
+{
+    uint64_t current = nimbleClientAtomicLoadAcquire64(range);
+    while (1) {
+        size_t begin = (size_t) (current & 0xffffffffU);
+        size_t end = (size_t) (current >> 32);
+        if (begin >= end) {
+            return false;
+        }
+        if (nimbleClientAtomicCompareExchange64(range, &current, makeRange(begin + 1, end))) {
+            *entryIndex = begin;
+            return true;
+        }
+    }
+}
+
+static bool stealFromBack(volatile uint64_t* range, size_t* entryIndex)
+{
+    uint64_t current = nimbleClientAtomicLoadAcquire64(range);
+    while (1) {
+        size_t begin = (size_t) (current & 0xffffffffU);
+        size_t end = (size_t) (current >> 32);
+        if (begin >= end) {
+            return false;
+        }
+        if (nimbleClientAtomicCompareExchange64(range, &current, makeRange(begin, end - 1))) {
+            *entryIndex = end - 1;
+            return true;
+        }
+    }
+}
+
+static void writeConnectionDatagram(NimbleClientPoolDatagram* datagram, NimbleClientPoolConnectionId connectionId,
+                                    const uint8_t* octets, size_t octetCount)
+{
+    datagram->octets[0] = (uint8_t) (connectionId >> 8);
+    datagram->octets[1] = (uint8_t) (connectionId & 0xff);
+    tc_memcpy_octets(datagram->octets + NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT, octets, octetCount);
+    datagram->octetCount = NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT + octetCount;
+}
+
+static int flushWorkerDatagrams(NimbleClientPool* self, NimbleClientPoolWorker* worker)
+{
+    int result = 0;
+
+    mutexLock(&self->sendMutex);
+    for (size_t i = 0; i < worker->outDatagramCount; ++i) {
+        const NimbleClientPoolDatagram* datagram = &worker->outDatagrams[i];
+        int err = datagramTransportSend(&self->sharedTransport, datagram->octets, datagram->octetCount);
+        if (err < 0) {
+            result = err;
+        }
+    }
+    mutexUnlock(&self->sendMutex);
+
+    worker->outDatagramCount = 0;
+
+    return result;
+}
+
+static int entrySend(void* _self, const uint8_t* data, size_t size)
+{
+    NimbleClientPoolEntry* entry = (NimbleClientPoolEntry*) _self;
+    NimbleClientPool* pool = entry->pool;
+
+    if (size > DATAGRAM_TRANSPORT_MAX_SIZE) {
+        CLOG_C_SOFT_ERROR(&pool->log, "datagram is too big for the shared transport %zu", size)
+        return -1;
+    }
+
+    if (!pool->isUpdating) {
+        // Sent outside of nimbleClientPoolUpdate(), e.g. by nimbleClientFlushSteps()
+        NimbleClientPoolDatagram datagram;
+        writeConnectionDatagram(&datagram, entry->connectionId, data, size);
+        mutexLock(&pool->sendMutex);
+        int err = datagramTransportSend(&pool->sharedTransport, datagram.octets, datagram.octetCount);
+        mutexUnlock(&pool->sendMutex);
+        return err;
+    }
+
+    // Collected per worker, so the workers do not have to take the send lock for every datagram
+    NimbleClientPoolWorker* worker = &pool->workers[entry->workerIndex];
+    if (worker->outDatagramCount == NIMBLE_CLIENT_POOL_WORKER_OUT_DATAGRAM_CAPACITY) {
+        int err = flushWorkerDatagrams(pool, worker);
+        if (err < 0) {
+            return err;
+        }
+    }
+
+    writeConnectionDatagram(&worker->outDatagrams[worker->outDatagramCount++], entry->connectionId, data, size);
+
+    return 0;
+}
+
+static ssize_t entryReceive(void* _self, uint8_t* data, size_t size)
+{
+    NimbleClientPoolEntry* entry = (NimbleClientPoolEntry*) _self;
+    NimbleClientPool* pool = entry->pool;
+    size_t entryIndex = (size_t) (entry - pool->entries);
+
+    size_t datagramIndex = pool->inHeadIndices[entryIndex];
+    if (datagramIndex == NIMBLE_CLIENT_POOL_NO_DATAGRAM) {
+        return 0;
+    }
+
+    const NimbleClientPoolDatagram* datagram = &pool->inDatagrams[datagramIndex];
+    pool->inHeadIndices[entryIndex] = datagram->nextIndex;
+
+    size_t octetCount = datagram->octetCount - NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT;
+    if (octetCount > size) {
+        return -1;
+    }
+    tc_memcpy_octets(data, datagram->octets + NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT, octetCount);
+
+    return (ssize_t) octetCount;
+}
+
+/// Reads the datagrams that are waiting on the shared transport and queues them for the client with the connection id
+static int receiveFromSharedTransport(NimbleClientPool* self)
+{
+    for (size_t i = 0; i < self->entryCount; ++i) {
+        self->inHeadIndices[i] = NIMBLE_CLIENT_POOL_NO_DATAGRAM;
+    }
+    self->inDatagramCount = 0;
+
+    // Datagrams that do not fit are left in the socket buffer until the next update
+    while (self->inDatagramCount < self->inDatagramCapacity) {
+        NimbleClientPoolDatagram* datagram = &self->inDatagrams[self->inDatagramCount];
+        ssize_t octetCount = datagramTransportReceive(&self->sharedTransport, datagram->octets,
+                                                      sizeof(datagram->octets));
+        if (octetCount < 0) {
+            CLOG_C_SOFT_ERROR(&self->log, "could not receive from shared transport %zd", octetCount)
+            return (int) octetCount;
+        }
+        if (octetCount == 0) {
+            break;
+        }
+
+        NimbleClientPoolConnectionId connectionId = (NimbleClientPoolConnectionId) ((datagram->octets[0] << 8) |
+                                                                                    datagram->octets[1]);
+        size_t entryIndex = (size_t) connectionId - 1;
+        bool isForClient = octetCount > NIMBLE_CLIENT_POOL_CONNECTION_HEADER_OCTET_COUNT && connectionId != 0 &&
+                           entryIndex < self->entryCount && self->entries[entryIndex].isUsed &&
+                           self->entries[entryIndex].usesSharedTransport;
+        if (!isForClient) {
+            self->stats.droppedDatagramCount++;
+            continue;
+        }
+
+        datagram->octetCount = (size_t) octetCount;
+        datagram->nextIndex = NIMBLE_CLIENT_POOL_NO_DATAGRAM;
+        if (self->inHeadIndices[entryIndex] == NIMBLE_CLIENT_POOL_NO_DATAGRAM) {
+            self->inHeadIndices[entryIndex] = self->inDatagramCount;
+        } else {
+            self->inDatagrams[self->inTailIndices[entryIndex]].nextIndex = self->inDatagramCount;
+        }
+        self->inTailIndices[entryIndex] = self->inDatagramCount;
+        self->inDatagramCount++;
+        self->stats.receivedDatagramCount++;
+    }
+
+    return 0;
+}
+
+static void updateEntry(NimbleClientPoolWorker* worker, size_t entryIndex)
+{
+    NimbleClientPoolEntry* entry = &worker->pool->entries[entryIndex];
+    if (!entry->isUsed) {
+        return;
+    }
+
+    entry->workerIndex = worker->index;
+    nimbleClientRealizeUpdate(&entry->realize, worker->pool->now);
+    worker->updatedCount++;
+}
+
+static void runWorker(NimbleClientPoolWorker* self)
+{
+    NimbleClientPool* pool = self->pool;
+    size_t entryIndex;
+
+    while (takeFromFront(&self->range, &entryIndex)) {
+        updateEntry(self, entryIndex);
+    }
+
+    // Done with the own clients, help the workers that are behind
+    for (size_t offset = 1; offset < pool->workerCount; ++offset) {
+        NimbleClientPoolWorker* victim = &pool->workers[(self->index + offset) % pool->workerCount];
+        while (stealFromBack(&victim->range, &entryIndex)) {
+            updateEntry(self, entryIndex);
+            self->stolenCount++;
+        }
+    }
+}
+
+#if defined _WIN32
+static DWORD WINAPI workerThreadMain(LPVOID arg)
+#else
+static void* workerThreadMain(void* arg)
+#endif
+{
+    NimbleClientPoolWorker* self = (NimbleClientPoolWorker*) arg;
+    NimbleClientPool* pool = self->pool;
+    size_t handledGeneration = 0;
+
+    mutexLock(&pool->mutex);
+    while (1) {
+        while (pool->isRunning && pool->generation == handledGeneration) {
+            conditionWait(&pool->startCondition, &pool->mutex);
+        }
+        if (!pool->isRunning) {
+            break;
+        }
+        handledGeneration = pool->generation;
+        mutexUnlock(&pool->mutex);
+
+        runWorker(self);
+
+        mutexLock(&pool->mutex);
+        pool->activeWorkerCount--;
+        if (pool->activeWorkerCount == 0) {
+            conditionBroadcast(&pool->doneCondition);
+        }
+    }
+    mutexUnlock(&pool->mutex);
+
+    return 0;
+}
+
+static int startWorkerThread(NimbleClientPoolWorker* worker)
+{
+#if defined _WIN32
+    worker->thread = CreateThread(0, 0, workerThreadMain, worker, 0, 0);
+    if (worker->thread == 0) {
+        return -1;
+    }
+#else
+    int err = pthread_create(&worker->thread, 0, workerThreadMain, worker);
+    if (err != 0) {
+        return -err;
+    }
+#endif
+
+    return 0;
+}
+
+static void joinWorkerThread(NimbleClientPoolWorker* worker)
+{
+#if defined _WIN32
+    WaitForSingleObject(worker->thread, INFINITE);
+    CloseHandle(worker->thread);
+#else
+    pthread_join(worker->thread, 0);
+#endif
+}
+
+static void stopWorkerThreads(NimbleClientPool* self, size_t startedThreadCount)
+{
+    mutexLock(&self->mutex);
+    self->isRunning = false;
+    conditionBroadcast(&self->startCondition);
+    mutexUnlock(&self->mutex);
+
+    for (size_t i = 1; i <= startedThreadCount; ++i) {
+        joinWorkerThread(&self->workers[i]);
+    }
+}
+
+/// Initializes the pool and starts the worker threads. All memory for the entries and the datagram buffers is
+/// allocated up front.
+/// @param self client pool
+/// @param settings pool settings
+/// @return negative on error
+int nimbleClientPoolInit(NimbleClientPool* self, const NimbleClientPoolSettings* settings)
+{
+    self->log = settings->log;
+
+    if (settings->workerCount == 0 || settings->workerCount > NIMBLE_CLIENT_POOL_MAX_WORKER_COUNT) {
+        CLOG_C_SOFT_ERROR(&self->log, "worker count must be between 1 and %d, not %zu",
+                          NIMBLE_CLIENT_POOL_MAX_WORKER_COUNT, settings->workerCount)
+        return -1;
+    }
+
+    // Zero is not a valid connection id
+    if (settings->clientCapacity == 0 || settings->clientCapacity >= 0xffff) {
+        CLOG_C_SOFT_ERROR(&self->log, "client capacity must be between 1 and %d, not %zu", 0xffff - 1,
+                          settings->clientCapacity)
+        return -1;
+    }
+
+    self->clientCapacity = settings->clientCapacity;
+    self->entryCount = 0;
+    self->entries = IMPRINT_ALLOC_TYPE_COUNT(settings->memory, NimbleClientPoolEntry, settings->clientCapacity);
+    for (size_t i = 0; i < settings->clientCapacity; ++i) {
+        NimbleClientPoolEntry* entry = &self->entries[i];
+        entry->pool = self;
+        entry->connectionId = (NimbleClientPoolConnectionId) (i + 1);
+        entry->workerIndex = 0;
+        entry->isUsed = false;
+        entry->usesSharedTransport = false;
+    }
+
+    self->clientSettings = settings->clientSettings;
+    // The clients take their memory from the memory allocator, an arena can not be shared between them
+    self->clientSettings.arena = 0;
+    self->clientSettings.arenaOctetCount = 0;
+
+    self->sharedTransport = settings->sharedTransport;
+    self->inDatagramCount = 0;
+    self->inDatagramCapacity = 0;
+    self->inDatagrams = 0;
+    self->inHeadIndices = 0;
+    self->inTailIndices = 0;
+    bool hasSharedTransport = self->sharedTransport.send != 0;
+    if (hasSharedTransport) {
+        self->inDatagramCapacity = settings->inDatagramCapacity;
+        self->inDatagrams = IMPRINT_ALLOC_TYPE_COUNT(settings->memory, NimbleClientPoolDatagram,
+                                                     settings->inDatagramCapacity);
+        self->inHeadIndices = IMPRINT_ALLOC_TYPE_COUNT(settings->memory, size_t, settings->clientCapacity);
+        self->inTailIndices = IMPRINT_ALLOC_TYPE_COUNT(settings->memory, size_t, settings->clientCapacity);
+    }
+
+    self->workerCount = settings->workerCount;
+    self->isUpdating = false;
+    self->now = 0;
+    self->generation = 0;
+    self->activeWorkerCount = 0;
+    self->isRunning = true;
+    tc_mem_clear_type(&self->stats);
+
+    mutexInit(&self->mutex);
+    mutexInit(&self->sendMutex);
+    conditionInit(&self->startCondition);
+    conditionInit(&self->doneCondition);
+
+    for (size_t i = 0; i < self->workerCount; ++i) {
+        NimbleClientPoolWorker* worker = &self->workers[i];
+        worker->range = 0;
+        worker->pool = self;
+        worker->index = i;
+        worker->outDatagramCount = 0;
+        worker->updatedCount = 0;
+        worker->stolenCount = 0;
+        worker->outDatagrams = 0;
+        if (hasSharedTransport) {
+            worker->outDatagrams = IMPRINT_ALLOC_TYPE_COUNT(settings->memory, NimbleClientPoolDatagram,
+                                                            NIMBLE_CLIENT_POOL_WORKER_OUT_DATAGRAM_CAPACITY);
+        }
+    }
+
+    // The thread that calls nimbleClientPoolUpdate() is the first worker
+    for (size_t i = 1; i < self->workerCount; ++i) {
+        int err = startWorkerThread(&self->workers[i]);
+        if (err < 0) {
+            CLOG_C_SOFT_ERROR(&self->log, "could not start pool worker thread %zu: %d", i, err)
+            stopWorkerThreads(self, i - 1);
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+/// Stops the worker threads and destroys the clients
+/// @param self client pool
+void nimbleClientPoolDestroy(NimbleClientPool* self)
+{
+    stopWorkerThreads(self, self->workerCount - 1);
+
+    for (size_t i = 0; i < self->entryCount; ++i) {
+        if (self->entries[i].isUsed) {
+            nimbleClientRealizeDestroy(&self->entries[i].realize);
+            self->entries[i].isUsed = false;
+        }
+    }
+
+    conditionDestroy(&self->startCondition);
+    conditionDestroy(&self->doneCondition);
+    mutexDestroy(&self->mutex);
+    mutexDestroy(&self->sendMutex);
+}
+
+/// Adds a client to the pool. A free slot that has been used before is reinitialized, so it does not allocate again.
+/// Must not be called while nimbleClientPoolUpdate() is running.
+/// @param self client pool
+/// @param transport transport for the client, or NULL to use the shared transport
+/// @return the client, or NULL if the pool is full
+NimbleClientRealize* nimbleClientPoolAdd(NimbleClientPool* self, const DatagramTransport* transport)
+{
+    if (transport == 0 && self->sharedTransport.send == 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "client needs a transport, since the pool has no shared transport")
+        return 0;
+    }
+
+    size_t entryIndex = self->entryCount;
+    for (size_t i = 0; i < self->entryCount; ++i) {
+        if (!self->entries[i].isUsed) {
+            entryIndex = i;
+            break;
+        }
+    }
+
+    if (entryIndex == self->clientCapacity) {
+        CLOG_C_SOFT_ERROR(&self->log, "client pool is full (%zu clients)", self->clientCapacity)
+        return 0;
+    }
+
+    NimbleClientPoolEntry* entry = &self->entries[entryIndex];
+    NimbleClientRealizeSettings settings = self->clientSettings;
+    if (transport != 0) {
+        settings.transport = *transport;
+    } else {
+        settings.transport.self = entry;
+        settings.transport.send = entrySend;
+        settings.transport.receive = entryReceive;
+        self->inHeadIndices[entryIndex] = NIMBLE_CLIENT_POOL_NO_DATAGRAM;
+    }
+    entry->usesSharedTransport = transport == 0;
+    entry->workerIndex = 0;
+
+    if (entryIndex == self->entryCount) {
+        nimbleClientRealizeInit(&entry->realize, &settings);
+        self->entryCount++;
+    } else {
+        nimbleClientRealizeReInit(&entry->realize, &settings);
+    }
+    entry->isUsed = true;
+
+    return &entry->realize;
+}
+
+/// Removes a client from the pool. The slot is reused by the next nimbleClientPoolAdd().
+/// Must not be called while nimbleClientPoolUpdate() is running.
+/// @param self client pool
+/// @param realize a client that was returned from nimbleClientPoolAdd()
+void nimbleClientPoolRemove(NimbleClientPool* self, NimbleClientRealize* realize)
+{
+    NimbleClientPoolEntry* entry = (NimbleClientPoolEntry*) realize;
+    size_t entryIndex = (size_t) (entry - self->entries);
+    if (entryIndex >= self->entryCount || !entry->isUsed) {
+        CLOG_C_SOFT_ERROR(&self->log, "client is not in the pool")
+        return;
+    }
+
+    nimbleClientRealizeDestroy(&entry->realize);
+    entry->isUsed = false;
+}
+
+/// Updates all clients in the pool, spread over the worker threads. Receives from the shared transport before the
+/// clients are updated and sends what they have written to it afterwards.
+/// @param self client pool
+/// @param now current time
+/// @return negative on error
+int nimbleClientPoolUpdate(NimbleClientPool* self, MonotonicTimeMs now)
+{
+    int result = 0;
+
+    if (self->sharedTransport.send != 0 && self->sharedTransport.receive != 0) {
+        result = receiveFromSharedTransport(self);
+    }
+
+    self->now = now;
+
+    size_t entriesPerWorker = (self->entryCount + self->workerCount - 1) / self->workerCount;
+    for (size_t i = 0; i < self->workerCount; ++i) {
+        size_t begin = i * entriesPerWorker;
+        if (begin > self->entryCount) {
+            begin = self->entryCount;
+        }
+        size_t end = begin + entriesPerWorker;
+        if (end > self->entryCount) {
+            end = self->entryCount;
+        }
+        nimbleClientAtomicStoreRelease64(&self->workers[i].range, makeRange(begin, end));
+    }
+
+    mutexLock(&self->mutex);
+    self->isUpdating = true;
+    self->activeWorkerCount = self->workerCount - 1;
+    self->generation++;
+    conditionBroadcast(&self->startCondition);
+    mutexUnlock(&self->mutex);
+
+    runWorker(&self->workers[0]);
+
+    mutexLock(&self->mutex);
+    while (self->activeWorkerCount > 0) {
+        conditionWait(&self->doneCondition, &self->mutex);
+    }
+    self->isUpdating = false;
+    mutexUnlock(&self->mutex);
+
+    for (size_t i = 0; i < self->workerCount; ++i) {
+        NimbleClientPoolWorker* worker = &self->workers[i];
+        if (worker->outDatagramCount > 0) {
+            int err = flushWorkerDatagrams(self, worker);
+            if (err < 0) {
+                result = err;
+            }
+        }
+        self->stats.stolenCount += worker->stolenCount;
+        worker->stolenCount = 0;
+    }
+    self->stats.updateCount++;
+
+    return result;
+}
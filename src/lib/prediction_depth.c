@@ -0,0 +1,122 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <nimble-client/prediction_depth.h>
+
+static MonotonicTimeMs oneWayDelayPercentile(const NimbleClientPredictionDepth* self)
+{
+    const NimbleClientPredictionDepthWindow* window = self->window;
+    MonotonicTimeMs sorted[NIMBLE_CLIENT_PREDICTION_DEPTH_SAMPLE_COUNT];
+
+    // Insertion sort, the window is small
+    for (size_t i = 0; i < window->sampleCount; ++i) {
+        MonotonicTimeMs v = window->roundTripTimesMs[i];
+        size_t j = i;
+        while (j > 0 && sorted[j - 1] > v) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+    }
+
+    size_t index = (window->sampleCount - 1) * self->percentile / 100;
+    MonotonicTimeMs lowestRttMs = sorted[0];
+    MonotonicTimeMs jitterMs = sorted[index] - lowestRttMs;
+
+    return lowestRttMs / 2 + jitterMs;
+}
+
+static size_t tickCountForDelay(const NimbleClientPredictionDepth* self, MonotonicTimeMs delayMs)
+{
+    // Rounded up, and one more since the server composes the step after the one it is at
+    return ((size_t) delayMs * 1000U + self->tickDurationUs - 1) / self->tickDurationUs + 1;
+}
+
+/// Initializes the prediction depth controller
+/// @param self prediction depth controller
+/// @param window memory for the round trip time window, kept outside of self so self is small enough to stay with
+/// the fields that are read on every update
+/// @param tickDurationUs duration of a step in microseconds
+/// @param percentile percentile (0-100) of the one-way delays that the depth should cover
+/// @param safetyMarginMs added to the one-way delay percentile
+void nimbleClientPredictionDepthInit(NimbleClientPredictionDepth* self, NimbleClientPredictionDepthWindow* window,
+                                     size_t tickDurationUs, size_t percentile, MonotonicTimeMs safetyMarginMs)
+{
+    self->window = window;
+    self->tickDurationUs = tickDurationUs;
+    self->percentile = percentile > 100 ? 100 : percentile;
+    self->safetyMarginMs = safetyMarginMs;
+    nimbleClientPredictionDepthReset(self);
+}
+
+/// Forgets all samples, e.g. when connecting to a server again. Keeps the settings.
+/// @param self prediction depth controller
+void nimbleClientPredictionDepthReset(NimbleClientPredictionDepth* self)
+{
+    self->window->sampleCount = 0;
+    self->window->writeIndex = 0;
+    self->oneWayDelayPercentileMs = 0;
+    self->requiredTickCount = 0;
+    self->targetTickCount = 0;
+    self->hasTarget = false;
+    self->aboveRequiredCount = 0;
+}
+
+/// Adds a measured round trip time and updates the target depth
+/// @param self prediction depth controller
+/// @param rttMs measured round trip time
+void nimbleClientPredictionDepthAddRtt(NimbleClientPredictionDepth* self, MonotonicTimeMs rttMs)
+{
+    NimbleClientPredictionDepthWindow* window = self->window;
+    window->roundTripTimesMs[window->writeIndex] = rttMs;
+    window->writeIndex = (window->writeIndex + 1) % NIMBLE_CLIENT_PREDICTION_DEPTH_SAMPLE_COUNT;
+    if (window->sampleCount < NIMBLE_CLIENT_PREDICTION_DEPTH_SAMPLE_COUNT) {
+        window->sampleCount++;
+    }
+
+    self->oneWayDelayPercentileMs = oneWayDelayPercentile(self);
+    self->requiredTickCount = tickCountForDelay(self, self->oneWayDelayPercentileMs + self->safetyMarginMs);
+
+    if (!self->hasTarget || self->requiredTickCount > self->targetTickCount) {
+        self->targetTickCount = self->requiredTickCount;
+        self->hasTarget = true;
+        self->aboveRequiredCount = 0;
+        return;
+    }
+
+    if (self->requiredTickCount == self->targetTickCount) {
+        self->aboveRequiredCount = 0;
+        return;
+    }
+
+    self->aboveRequiredCount++;
+    if (self->aboveRequiredCount >= NIMBLE_CLIENT_PREDICTION_DEPTH_LOWER_AFTER_SAMPLE_COUNT) {
+        // One tick at a time, each lowering has to be confirmed again
+        self->targetTickCount--;
+        self->aboveRequiredCount = 0;
+    }
+}
+
+/// Adds the buffer delta that the server reported for the predicted steps. A negative delta means that the steps
+/// arrived too late, and the depth is raised right away by that many ticks on top of what the delays require.
+/// @param self prediction depth controller
+/// @param bufferDelta number of ticks the predicted steps arrived ahead of when they were needed
+void nimbleClientPredictionDepthAddBufferDelta(NimbleClientPredictionDepth* self, int bufferDelta)
+{
+    if (!self->hasTarget || bufferDelta >= 0) {
+        return;
+    }
+
+    size_t lateTickCount = (size_t) -bufferDelta;
+    if (lateTickCount > NIMBLE_CLIENT_PREDICTION_DEPTH_MAXIMUM_LATE_TICK_COUNT) {
+        lateTickCount = NIMBLE_CLIENT_PREDICTION_DEPTH_MAXIMUM_LATE_TICK_COUNT;
+    }
+
+    // Relative to the required depth, so the reports that arrive before the raise has had an effect do not add up
+    size_t raisedTickCount = self->requiredTickCount + lateTickCount;
+    if (raisedTickCount > self->targetTickCount) {
+        self->targetTickCount = raisedTickCount;
+        self->aboveRequiredCount = 0;
+    }
+}
@@ -9,11 +9,21 @@
 
 
 int nimbleClientWriteHeader(NimbleClient* self, FldOutStream* outStream)
+{
+    return nimbleClientWriteHeaderAt(self, outStream, self->now);
+}
+
+/// Same as nimbleClientWriteHeader(), but for a datagram that is sent at another time than the time of the client,
+/// e.g. between two updates. The server echoes the time back, so the round trip time is measured from sentAt.
+/// @param self nimble protocol client
+/// @param outStream datagram stream
+/// @param sentAt when the datagram is sent
+/// @return negative on error
+int nimbleClientWriteHeaderAt(NimbleClient* self, FldOutStream* outStream, MonotonicTimeMs sentAt)
 {
     CLOG_ASSERT(self->remoteConnectionId != 0, "must have a valid remote conneciton ID")
     orderedDatagramOutLogicPrepare(&self->orderedDatagramOut, outStream);
-    MonotonicTimeMs now = monotonicTimeMsNow();
-    MonotonicTimeLowerBitsMs lowerBitsMs = monotonicTimeMsToLowerBits(now);
+    MonotonicTimeLowerBitsMs lowerBitsMs = monotonicTimeMsToLowerBits(sentAt);
     return fldOutStreamWriteUInt16(outStream, lowerBitsMs);
 }
 
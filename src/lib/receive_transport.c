@@ -8,28 +8,124 @@
 #include <nimble-client/receive_transport.h>
 #include <nimble-serialize/debug.h>
 
+static MonotonicTimeMs datagramReceivedAt(const NimbleClient* self, size_t datagramIndex)
+{
+    if (self->transportTimestamp.receivedAt == 0) {
+        return self->now;
+    }
+
+    MonotonicTimeMs receivedAt;
+    if (!self->transportTimestamp.receivedAt(self->transportTimestamp.self, datagramIndex, &receivedAt) ||
+        receivedAt > self->now) {
+        return self->now;
+    }
+
+    return receivedAt;
+}
+
+static int feedDatagram(NimbleClient* self, const uint8_t* octets, size_t octetCount, size_t datagramIndex)
+{
+    if (self->useStats) {
+        statsIntPerSecondAdd(&self->packetsPerSecondIn, 1);
+    }
+#if defined NIMBLE_CLIENT_LOG_VERBOSE
+    nimbleSerializeDebugHex("received", octets, octetCount);
+#endif
+    int err = nimbleClientFeedReceivedAt(self, octets, octetCount, datagramReceivedAt(self, datagramIndex));
+    if (err < 0) {
+        return err;
+    }
+    nimbleClientConnectionQualityReceivedUsableDatagram(&self->quality);
+
+    return 0;
+}
+
+static ssize_t receiveAllDatagramsInBatches(NimbleClient* self)
+{
+    uint8_t receiveBuf[NIMBLE_CLIENT_RECEIVE_BATCH_MAX_COUNT * DATAGRAM_TRANSPORT_MAX_SIZE];
+    size_t octetCounts[NIMBLE_CLIENT_RECEIVE_BATCH_MAX_COUNT];
+    size_t count = 0;
+
+    while (1) {
+        ssize_t datagramCount = self->transportBatch.receiveBatch(self->transportBatch.self, receiveBuf,
+                                                                  DATAGRAM_TRANSPORT_MAX_SIZE, octetCounts,
+                                                                  NIMBLE_CLIENT_RECEIVE_BATCH_MAX_COUNT);
+        if (datagramCount < 0) {
+            CLOG_SOFT_ERROR("nimbleClientReceiveAllDatagramsFromTransport: batch error: %zd", datagramCount)
+            return datagramCount;
+        }
+
+        for (size_t i = 0; i < (size_t) datagramCount; ++i) {
+            if (octetCounts[i] == 0) {
+                continue;
+            }
+            int err = feedDatagram(self, &receiveBuf[i * DATAGRAM_TRANSPORT_MAX_SIZE], octetCounts[i], i);
+            if (err < 0) {
+                return err;
+            }
+            count++;
+        }
+
+        // A batch that is not full means that the transport has been drained
+        if ((size_t) datagramCount < NIMBLE_CLIENT_RECEIVE_BATCH_MAX_COUNT) {
+            break;
+        }
+    }
+
+    return (ssize_t) count;
+}
+
+static ssize_t receiveAllLentDatagrams(NimbleClient* self)
+{
+    size_t count = 0;
+
+    while (1) {
+        const uint8_t* octets;
+        ssize_t octetCount = self->transportLend.lend(self->transportLend.self, &octets);
+        if (octetCount < 0) {
+            CLOG_SOFT_ERROR("nimbleClientReceiveAllDatagramsFromTransport: lend error: %zd", octetCount)
+            return octetCount;
+        }
+        if (octetCount == 0) {
+            break;
+        }
+
+        int err = feedDatagram(self, octets, (size_t) octetCount, 0);
+        self->transportLend.release(self->transportLend.self);
+        if (err < 0) {
+            return err;
+        }
+        count++;
+    }
+
+    return (ssize_t) count;
+}
+
 /// Reads from the unreliable datagram transport and feeds to the nimble client.
-/// Feeds it to nimbleClientFeed().
+/// Feeds it to nimbleClientFeedReceivedAt(), with the arrival time from the receive timestamp extension if it is
+/// set. Prefers parsing datagrams in place from buffers lent by the transport,
+/// then the batch receive of the transport if it is set.
 /// @param self nimble protocol client
 /// @return the number of datagrams received, or negative on error
 ssize_t nimbleClientReceiveAllDatagramsFromTransport(NimbleClient* self)
 {
+    if (self->transportLend.lend != 0) {
+        return receiveAllLentDatagrams(self);
+    }
+
+    if (self->transportBatch.receiveBatch != 0) {
+        return receiveAllDatagramsInBatches(self);
+    }
+
     uint8_t receiveBuf[DATAGRAM_TRANSPORT_MAX_SIZE];
     size_t count = 0;
     while (1) {
         ssize_t octetCount = datagramTransportReceive(&self->transport, receiveBuf, DATAGRAM_TRANSPORT_MAX_SIZE);
         if (octetCount > 0) {
-            if (self->useStats) {
-                statsIntPerSecondAdd(&self->packetsPerSecondIn, 1);
-            }
-#if defined NIMBLE_CLIENT_LOG_VERBOSE
-            nimbleSerializeDebugHex("received", receiveBuf, octetCount);
-#endif
-            int err = nimbleClientFeed(self, receiveBuf, (size_t) octetCount);
+            int err = feedDatagram(self, receiveBuf, (size_t) octetCount, 0);
             if (err < 0) {
                 return err;
             }
-            nimbleClientConnectionQualityReceivedUsableDatagram(&self->quality);
             count++;
         } else if (octetCount < 0) {
             CLOG_SOFT_ERROR("nimbleClientReceiveAllDatagramsFromTransport: error: %zd", octetCount)
@@ -0,0 +1,110 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <nimble-client/retransmit.h>
+
+static uint64_t randomNext(NimbleClientRto* self)
+{
+    // xorshift64
+    uint64_t x = self->randomState;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    self->randomState = x;
+
+    return x;
+}
+
+static MonotonicTimeMs clampRto(MonotonicTimeMs rtoMs)
+{
+    if (rtoMs < NIMBLE_CLIENT_RTO_MINIMUM_MS) {
+        return NIMBLE_CLIENT_RTO_MINIMUM_MS;
+    }
+    if (rtoMs > NIMBLE_CLIENT_RTO_MAXIMUM_MS) {
+        return NIMBLE_CLIENT_RTO_MAXIMUM_MS;
+    }
+
+    return rtoMs;
+}
+
+/// Initializes the estimator, it uses NIMBLE_CLIENT_RTO_INITIAL_MS until the first round trip time is measured
+/// @param self retransmission timeout estimator
+/// @param seed random seed for the jitter, must not be zero
+void nimbleClientRtoInit(NimbleClientRto* self, uint64_t seed)
+{
+    self->hasSample = false;
+    self->smoothedRttMs = 0;
+    self->rttVariationMs = 0;
+    self->rtoMs = NIMBLE_CLIENT_RTO_INITIAL_MS;
+    self->randomState = seed != 0 ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+/// Adds a measured round trip time and recalculates the retransmission timeout
+/// @param self retransmission timeout estimator
+/// @param rttMs measured round trip time
+void nimbleClientRtoAddSample(NimbleClientRto* self, MonotonicTimeMs rttMs)
+{
+    if (!self->hasSample) {
+        self->smoothedRttMs = rttMs;
+        self->rttVariationMs = rttMs / 2;
+        self->hasSample = true;
+    } else {
+        MonotonicTimeMs deviation = self->smoothedRttMs > rttMs ? self->smoothedRttMs - rttMs
+                                                                : rttMs - self->smoothedRttMs;
+        self->rttVariationMs = (3 * self->rttVariationMs + deviation) / 4;
+        self->smoothedRttMs = (7 * self->smoothedRttMs + rttMs) / 8;
+    }
+
+    self->rtoMs = clampRto(self->smoothedRttMs + 4 * self->rttVariationMs);
+}
+
+/// Makes the request due right away, e.g. when a new request is started
+/// @param self request timer
+void nimbleClientRequestTimerReset(NimbleClientRequestTimer* self)
+{
+    self->isSent = false;
+    self->resendAt = 0;
+    self->resendCount = 0;
+}
+
+/// Checks if the request should be sent (again)
+/// @param self request timer
+/// @param now current time
+/// @return true if the request should be sent
+bool nimbleClientRequestTimerIsDue(const NimbleClientRequestTimer* self, MonotonicTimeMs now)
+{
+    return !self->isSent || now >= self->resendAt;
+}
+
+/// Gets the time when the request should be sent (again)
+/// @param self request timer
+/// @param now current time
+/// @return the time of the next send
+MonotonicTimeMs nimbleClientRequestTimerDeadline(const NimbleClientRequestTimer* self, MonotonicTimeMs now)
+{
+    return self->isSent ? self->resendAt : now;
+}
+
+/// Schedules the next resend after the request has been sent
+/// @param self request timer
+/// @param rto retransmission timeout estimator
+/// @param now the time the request was sent
+void nimbleClientRequestTimerSent(NimbleClientRequestTimer* self, NimbleClientRto* rto, MonotonicTimeMs now)
+{
+    if (self->isSent) {
+        self->resendCount++;
+    }
+
+    MonotonicTimeMs timeoutMs = rto->rtoMs;
+    for (size_t i = 0; i < self->resendCount && timeoutMs < NIMBLE_CLIENT_RTO_MAXIMUM_MS; ++i) {
+        timeoutMs *= 2;
+    }
+    timeoutMs = clampRto(timeoutMs);
+
+    // Up to a quarter extra, so clients that lost their connection at the same time do not resend in lockstep
+    MonotonicTimeMs jitterMs = (MonotonicTimeMs) (randomNext(rto) % (uint64_t) (timeoutMs / 4 + 1));
+
+    self->isSent = true;
+    self->resendAt = now + timeoutMs + jitterMs;
+}
@@ -8,6 +8,7 @@
 #include <nimble-client/client.h>
 #include <nimble-client/prepare_header.h>
 #include <nimble-client/send_steps.h>
+#include <nimble-client/utils.h>
 #include <nimble-serialize/serialize.h>
 #include <nimble-steps-serialize/out_serialize.h>
 #include <nimble-steps-serialize/pending_out_serialize.h>
@@ -44,27 +45,48 @@ static ssize_t sendStepsToStream(NimbleClient* self, FldOutStream* stream)
     if (stepsInBuffer < 0) {
         stepsInBuffer = 0;
     }
-    statsIntAdd(&self->outgoingStepsInQueue, stepsInBuffer);
+    if (self->useStats) {
+        statsIntAdd(&self->outgoingStepsInQueue, stepsInBuffer);
+    }
 
     // CLOG_VERBOSE("Actually sent %d (%d to %d)", stepsActuallySent,
     // firstStepToSend, firstStepToSend+stepsActuallySent-1);
-    self->waitTime = 0;
 
     return stepsActuallySent;
 }
 
+/// Writes the predicted steps command to a stream, without any datagram header
+/// @param self nimble protocol client
+/// @param stream stream to write to
+/// @return number of steps written or negative on error
+ssize_t nimbleClientWriteStepsToStream(NimbleClient* self, FldOutStream* stream)
+{
+    return sendStepsToStream(self, stream);
+}
+
 /// Sends predicted steps to the server using the unreliable datagram transport
 /// @param self nimble protocol clinet
 /// @param transportOut transport to send on
 /// @return negative on error
 int nimbleClientSendStepsToServer(NimbleClient* self, DatagramTransportOut* transportOut)
+{
+    return nimbleClientSendStepsToServerAt(self, transportOut, self->now);
+}
+
+/// Same as nimbleClientSendStepsToServer(), but for steps that are sent at another time than the time of the
+/// client, e.g. flushed between two updates
+/// @param self nimble protocol client
+/// @param transportOut transport to send on
+/// @param sentAt when the steps are sent
+/// @return negative on error
+int nimbleClientSendStepsToServerAt(NimbleClient* self, DatagramTransportOut* transportOut, MonotonicTimeMs sentAt)
 {
     uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
     FldOutStream outStream;
     fldOutStreamInit(&outStream, buf, DATAGRAM_TRANSPORT_MAX_SIZE);
-    outStream.writeDebugInfo = true;
+    outStream.writeDebugInfo = nimbleClientWireUsesDebugInfo(self);
 
-    nimbleClientWriteHeader(self, &outStream);
+    nimbleClientWriteHeaderAt(self, &outStream, sentAt);
 
     ssize_t stepsSent = sendStepsToStream(self, &outStream);
     if (stepsSent <= 0) {
@@ -72,7 +94,9 @@ int nimbleClientSendStepsToServer(NimbleClient* self, DatagramTransportOut* tran
     }
     nimbleClientCommitHeader(self);
     CLOG_C_VERBOSE(&self->log, "send steps to server octetCount: %zu", outStream.pos)
-    statsIntPerSecondAdd(&self->sentStepsDatagramCountPerSecond, 1);
-    statsIntPerSecondAdd(&self->packetsPerSecondOut, 1);
+    if (self->useStats) {
+        statsIntPerSecondAdd(&self->sentStepsDatagramCountPerSecond, 1);
+        statsIntPerSecondAdd(&self->packetsPerSecondOut, 1);
+    }
     return transportOut->send(transportOut->self, outStream.octets, outStream.pos);
 }
@@ -0,0 +1,110 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <clog/clog.h>
+#include <imprint/allocator.h>
+#include <nimble-client/atomic.h>
+#include <nimble-client/step_queue.h>
+
+/// Initializes the queue. All memory is allocated up front.
+/// @param self step queue
+/// @param memory allocator for the slots and payloads
+/// @param capacity maximum number of steps in the queue, must be a power of two
+/// @param maxOctetCount maximum octet count of a single (combined) step
+/// @return negative on error
+int nimbleClientStepQueueInit(NimbleClientStepQueue* self, struct ImprintAllocator* memory, size_t capacity,
+                              size_t maxOctetCount)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        CLOG_ERROR("nimbleClientStepQueueInit: capacity must be a power of two %zu", capacity)
+        return -1;
+    }
+
+    self->slots = IMPRINT_ALLOC_TYPE_COUNT(memory, NimbleClientStepQueueSlot, capacity);
+    uint8_t* payloads = IMPRINT_ALLOC(memory, capacity * maxOctetCount, "step queue payloads");
+    for (size_t i = 0; i < capacity; ++i) {
+        self->slots[i].payload = payloads + i * maxOctetCount;
+        self->slots[i].octetCount = 0;
+        self->slots[i].stepId = 0;
+    }
+
+    self->capacity = capacity;
+    self->maxOctetCount = maxOctetCount;
+    self->writeCount = 0;
+    self->readCount = 0;
+
+    return 0;
+}
+
+/// Adds a step to the queue. Must only be called from the producer thread.
+/// @param self step queue
+/// @param stepId step id
+/// @param payload step payload
+/// @param octetCount octet count of payload
+/// @return negative if the queue is full or the step is too large
+int nimbleClientStepQueueWrite(NimbleClientStepQueue* self, StepId stepId, const uint8_t* payload, size_t octetCount)
+{
+    if (octetCount > self->maxOctetCount) {
+        return -2;
+    }
+
+    size_t writeCount = self->writeCount;
+    size_t readCount = nimbleClientAtomicLoadAcquire(&self->readCount);
+    if (writeCount - readCount == self->capacity) {
+        return -1;
+    }
+
+    NimbleClientStepQueueSlot* slot = &self->slots[writeCount & (self->capacity - 1)];
+    tc_memcpy_octets(slot->payload, payload, octetCount);
+    slot->octetCount = octetCount;
+    slot->stepId = stepId;
+
+    nimbleClientAtomicStoreRelease(&self->writeCount, writeCount + 1);
+
+    return 0;
+}
+
+/// Removes the oldest step from the queue. Must only be called from the consumer thread.
+/// @param self step queue
+/// @param stepId the id of the step that was read
+/// @param target target buffer for the payload
+/// @param maxTarget size of the target buffer
+/// @return octet count of the step, zero if the queue is empty, negative on error
+int nimbleClientStepQueueRead(NimbleClientStepQueue* self, StepId* stepId, uint8_t* target, size_t maxTarget)
+{
+    size_t readCount = self->readCount;
+    size_t writeCount = nimbleClientAtomicLoadAcquire(&self->writeCount);
+    if (readCount == writeCount) {
+        return 0;
+    }
+
+    const NimbleClientStepQueueSlot* slot = &self->slots[readCount & (self->capacity - 1)];
+    if (slot->octetCount > maxTarget) {
+        return -2;
+    }
+
+    size_t octetCount = slot->octetCount;
+    tc_memcpy_octets(target, slot->payload, octetCount);
+    *stepId = slot->stepId;
+
+    nimbleClientAtomicStoreRelease(&self->readCount, readCount + 1);
+
+    return (int) octetCount;
+}
+
+/// Number of steps in the queue. Exact on the consumer thread, a lower bound on the producer thread.
+/// @param self step queue
+/// @return step count
+size_t nimbleClientStepQueueCount(const NimbleClientStepQueue* self)
+{
+    return nimbleClientAtomicLoadAcquire(&self->writeCount) - nimbleClientAtomicLoadAcquire(&self->readCount);
+}
+
+/// Number of free slots. Exact on the producer thread, a lower bound on the consumer thread.
+/// @param self step queue
+/// @return free slot count
+size_t nimbleClientStepQueueFreeCount(const NimbleClientStepQueue* self)
+{
+    return self->capacity - nimbleClientStepQueueCount(self);
+}
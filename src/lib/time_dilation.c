@@ -0,0 +1,74 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <nimble-client/time_dilation.h>
+
+static int32_t calculateRateAdjustPpm(const NimbleClientTimeDilation* self)
+{
+    int32_t errorMilliSteps = self->filteredBufferDeltaMilliSteps - (int32_t) self->targetBufferDelta * 1000;
+
+    if (errorMilliSteps > NIMBLE_CLIENT_TIME_DILATION_DEAD_BAND_MILLI_STEPS) {
+        errorMilliSteps -= NIMBLE_CLIENT_TIME_DILATION_DEAD_BAND_MILLI_STEPS;
+    } else if (errorMilliSteps < -NIMBLE_CLIENT_TIME_DILATION_DEAD_BAND_MILLI_STEPS) {
+        errorMilliSteps += NIMBLE_CLIENT_TIME_DILATION_DEAD_BAND_MILLI_STEPS;
+    } else {
+        return 0;
+    }
+
+    // Too far ahead of the server slows the local ticks down, too close speeds them up
+    int32_t adjustPpm = -errorMilliSteps * NIMBLE_CLIENT_TIME_DILATION_PPM_PER_STEP / 1000;
+
+    if (adjustPpm > NIMBLE_CLIENT_TIME_DILATION_MAXIMUM_PPM) {
+        return NIMBLE_CLIENT_TIME_DILATION_MAXIMUM_PPM;
+    }
+    if (adjustPpm < -NIMBLE_CLIENT_TIME_DILATION_MAXIMUM_PPM) {
+        return -NIMBLE_CLIENT_TIME_DILATION_MAXIMUM_PPM;
+    }
+
+    return adjustPpm;
+}
+
+/// Initializes the time dilation
+/// @param self time dilation
+/// @param targetBufferDelta number of steps that the predicted steps should arrive ahead on the server
+void nimbleClientTimeDilationInit(NimbleClientTimeDilation* self, int targetBufferDelta)
+{
+    self->targetBufferDelta = targetBufferDelta;
+    nimbleClientTimeDilationReset(self);
+}
+
+/// Forgets the buffer deltas, e.g. when connecting to a server again. Keeps the target.
+/// @param self time dilation
+void nimbleClientTimeDilationReset(NimbleClientTimeDilation* self)
+{
+    self->hasSample = false;
+    self->filteredBufferDeltaMilliSteps = 0;
+    self->rateAdjustPpm = 0;
+}
+
+/// Adds the buffer delta reported in a game step response and recalculates the recommendation
+/// @param self time dilation
+/// @param bufferDelta number of steps the predicted steps arrived ahead on the server, negative if they were late
+void nimbleClientTimeDilationAddBufferDelta(NimbleClientTimeDilation* self, int bufferDelta)
+{
+    int32_t sampleMilliSteps = (int32_t) bufferDelta * 1000;
+
+    if (!self->hasSample) {
+        self->filteredBufferDeltaMilliSteps = sampleMilliSteps;
+        self->hasSample = true;
+    } else {
+        self->filteredBufferDeltaMilliSteps += (sampleMilliSteps - self->filteredBufferDeltaMilliSteps) /
+                                               (1 << NIMBLE_CLIENT_TIME_DILATION_FILTER_SHIFT);
+    }
+
+    self->rateAdjustPpm = calculateRateAdjustPpm(self);
+}
+
+/// Gets the recommended local tick rate multiplier
+/// @param self time dilation
+/// @return multiplier for the tick rate, one if there is nothing to correct (or no buffer delta yet)
+float nimbleClientTimeDilationMultiplier(const NimbleClientTimeDilation* self)
+{
+    return 1.f + (float) self->rateAdjustPpm / 1000000.f;
+}
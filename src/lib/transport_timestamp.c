@@ -0,0 +1,65 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#if defined __linux__
+// SCM_TIMESTAMPNS and clock_gettime() are not part of strict C99
+#define _DEFAULT_SOURCE
+#endif
+
+#include <nimble-client/transport_timestamp.h>
+
+#if defined __linux__
+#include <stdint.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <tiny-libc/tiny_libc.h>
+
+/// Asks the kernel to timestamp each datagram when it arrives (SO_TIMESTAMPNS). The timestamp is then delivered
+/// as a control message with recvmsg() or recvmmsg().
+/// @param socketHandle UDP socket
+/// @return negative on error
+int nimbleClientTransportTimestampEnable(int socketHandle)
+{
+    int enable = 1;
+
+    return setsockopt(socketHandle, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
+}
+
+/// Finds the kernel receive timestamp in the control messages of a received datagram, and converts it to
+/// monotonic time. The kernel timestamp is in real (wall clock) time, so it is converted using how long ago the
+/// datagram arrived.
+/// @param message message filled in by recvmsg(), with room for the control messages
+/// @param now current monotonic time
+/// @param[out] receivedAt monotonic time that the datagram arrived
+/// @return true if the message had a receive timestamp
+bool nimbleClientTransportTimestampFromMessage(struct msghdr* message, MonotonicTimeMs now,
+                                               MonotonicTimeMs* receivedAt)
+{
+    for (struct cmsghdr* control = CMSG_FIRSTHDR(message); control != 0;
+         control = CMSG_NXTHDR(message, control)) {
+        if (control->cmsg_level != SOL_SOCKET || control->cmsg_type != SCM_TIMESTAMPNS) {
+            continue;
+        }
+
+        struct timespec arrivedAt;
+        tc_memcpy_octets(&arrivedAt, CMSG_DATA(control), sizeof(arrivedAt));
+
+        struct timespec realNow;
+        clock_gettime(CLOCK_REALTIME, &realNow);
+
+        int64_t ageMs = ((int64_t) realNow.tv_sec - (int64_t) arrivedAt.tv_sec) * 1000 +
+                        ((int64_t) realNow.tv_nsec - (int64_t) arrivedAt.tv_nsec) / 1000000;
+        if (ageMs < 0) {
+            // The wall clock was adjusted backwards since the datagram arrived
+            ageMs = 0;
+        }
+
+        *receivedAt = now - (MonotonicTimeMs) ageMs;
+
+        return true;
+    }
+
+    return false;
+}
+#endif
@@ -0,0 +1,93 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "test.h"
+#include <clog/clog.h>
+#include <nimble-client/clock_sync.h>
+
+clog_config g_clog;
+
+// Short ticks keep the step id rounding small compared to the drift that is measured
+#define CLOCK_SYNC_TEST_TICK_DURATION_US (1000U)
+#define CLOCK_SYNC_TEST_SAMPLE_INTERVAL_MS (16)
+#define CLOCK_SYNC_TEST_DURATION_MS (30000)
+
+/// Server step id that a response holds, if the server clock runs skewPpm faster than the local clock
+static StepId serverStepIdAt(int64_t localTimeUs, int64_t skewPpm)
+{
+    int64_t serverTimeUs = localTimeUs + localTimeUs * skewPpm / 1000000;
+
+    return (StepId) (serverTimeUs / (int64_t) CLOCK_SYNC_TEST_TICK_DURATION_US);
+}
+
+/// Feeds responses from a server with a fixed clock skew, with round trip times that vary so that older samples
+/// are selected as well
+static void feedSkewedServer(NimbleClientClockSync* clockSync, int64_t skewPpm)
+{
+    for (MonotonicTimeMs receivedAt = 1000; receivedAt <= CLOCK_SYNC_TEST_DURATION_MS;
+         receivedAt += CLOCK_SYNC_TEST_SAMPLE_INTERVAL_MS) {
+        MonotonicTimeMs rttMs = 20 + ((receivedAt / CLOCK_SYNC_TEST_SAMPLE_INTERVAL_MS) * 7 % 11) * 2;
+        int64_t sentAtUs = ((int64_t) receivedAt - (int64_t) rttMs / 2) * 1000;
+        nimbleClientClockSyncAddSample(clockSync, serverStepIdAt(sentAtUs, skewPpm), receivedAt, rttMs);
+    }
+}
+
+static int testDriftFollowsFixedSkew(void)
+{
+    const int64_t skewPpm = 5000;
+
+    NimbleClientClockSyncWindow window;
+    NimbleClientClockSync clockSync;
+    nimbleClientClockSyncInit(&clockSync, &window, CLOCK_SYNC_TEST_TICK_DURATION_US);
+    feedSkewedServer(&clockSync, skewPpm);
+
+    NIMBLE_TEST_ASSERT(clockSync.hasEstimate)
+    NIMBLE_TEST_ASSERT(clockSync.outlierCount == 0)
+    NIMBLE_TEST_ASSERT(clockSync.driftPpm > skewPpm - 500 && clockSync.driftPpm < skewPpm + 500)
+
+    // One second after the last response, the estimate must still follow the server
+    MonotonicTimeMs now = CLOCK_SYNC_TEST_DURATION_MS + 1000;
+    StepId expectedStepId = serverStepIdAt((int64_t) now * 1000, skewPpm);
+    StepId estimatedStepId;
+    NIMBLE_TEST_ASSERT(nimbleClientClockSyncServerStepId(&clockSync, now, &estimatedStepId))
+    NIMBLE_TEST_ASSERT(estimatedStepId + 2 >= expectedStepId && estimatedStepId <= expectedStepId + 2)
+
+    return 0;
+}
+
+static int testNoDriftWithoutSkew(void)
+{
+    NimbleClientClockSyncWindow window;
+    NimbleClientClockSync clockSync;
+    nimbleClientClockSyncInit(&clockSync, &window, CLOCK_SYNC_TEST_TICK_DURATION_US);
+    feedSkewedServer(&clockSync, 0);
+
+    NIMBLE_TEST_ASSERT(clockSync.driftPpm > -500 && clockSync.driftPpm < 500)
+
+    return 0;
+}
+
+static int testNoEstimateBeforeSamples(void)
+{
+    NimbleClientClockSyncWindow window;
+    NimbleClientClockSync clockSync;
+    nimbleClientClockSyncInit(&clockSync, &window, CLOCK_SYNC_TEST_TICK_DURATION_US);
+
+    StepId stepId;
+    NIMBLE_TEST_ASSERT(!nimbleClientClockSyncServerStepId(&clockSync, 1000, &stepId))
+    NIMBLE_TEST_ASSERT(stepId == NIMBLE_STEP_MAX)
+
+    return 0;
+}
+
+int main(void)
+{
+    int failedCount = 0;
+
+    NIMBLE_TEST_RUN(testDriftFollowsFixedSkew, failedCount)
+    NIMBLE_TEST_RUN(testNoDriftWithoutSkew, failedCount)
+    NIMBLE_TEST_RUN(testNoEstimateBeforeSamples, failedCount)
+
+    return failedCount == 0 ? 0 : 1;
+}
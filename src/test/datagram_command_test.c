@@ -0,0 +1,113 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "test.h"
+#include <clog/clog.h>
+#include <flood/in_stream.h>
+#include <flood/out_stream.h>
+#include <nimble-client/datagram_command.h>
+
+clog_config g_clog;
+
+#define DATAGRAM_COMMAND_TEST_HEADER_OCTET_COUNT (4)
+
+static void writeHeader(FldOutStream* outStream)
+{
+    for (size_t i = 0; i < DATAGRAM_COMMAND_TEST_HEADER_OCTET_COUNT; ++i) {
+        fldOutStreamWriteUInt8(outStream, 0xaa);
+    }
+}
+
+static void writeCommand(FldOutStream* outStream, uint8_t cmd, size_t payloadOctetCount)
+{
+    size_t commandStart = nimbleClientDatagramCommandBegin(outStream);
+    fldOutStreamWriteUInt8(outStream, cmd);
+    for (size_t i = 0; i < payloadOctetCount; ++i) {
+        fldOutStreamWriteUInt8(outStream, (uint8_t) i);
+    }
+    nimbleClientDatagramCommandEnd(outStream, commandStart);
+}
+
+/// A single command gets the same layout as a datagram that was written for one command
+static int testSingleCommandHasNoCommandList(void)
+{
+    uint8_t buf[64];
+    FldOutStream outStream;
+    fldOutStreamInit(&outStream, buf, sizeof(buf));
+    writeHeader(&outStream);
+
+    size_t listStart = nimbleClientDatagramCommandsBegin(&outStream);
+    writeCommand(&outStream, 0x01, 3);
+    NIMBLE_TEST_ASSERT(nimbleClientDatagramCommandsEnd(&outStream, listStart) == 0)
+
+    NIMBLE_TEST_ASSERT(outStream.pos == DATAGRAM_COMMAND_TEST_HEADER_OCTET_COUNT + 1 + 3)
+    NIMBLE_TEST_ASSERT(buf[DATAGRAM_COMMAND_TEST_HEADER_OCTET_COUNT] == 0x01)
+    NIMBLE_TEST_ASSERT(buf[DATAGRAM_COMMAND_TEST_HEADER_OCTET_COUNT + 3] == 2)
+
+    return 0;
+}
+
+static int testSeveralCommandsAreReadBack(void)
+{
+    uint8_t buf[64];
+    FldOutStream outStream;
+    fldOutStreamInit(&outStream, buf, sizeof(buf));
+    writeHeader(&outStream);
+
+    size_t listStart = nimbleClientDatagramCommandsBegin(&outStream);
+    writeCommand(&outStream, 0x01, 3);
+    // An empty command leaves nothing behind
+    size_t emptyStart = nimbleClientDatagramCommandBegin(&outStream);
+    nimbleClientDatagramCommandEnd(&outStream, emptyStart);
+    writeCommand(&outStream, 0x02, 5);
+    NIMBLE_TEST_ASSERT(nimbleClientDatagramCommandsEnd(&outStream, listStart) == 0)
+
+    NIMBLE_TEST_ASSERT(outStream.pos == DATAGRAM_COMMAND_TEST_HEADER_OCTET_COUNT + 1 + (2 + 4) + (2 + 6))
+
+    FldInStream inStream;
+    fldInStreamInit(&inStream, buf, outStream.pos);
+    inStream.pos = DATAGRAM_COMMAND_TEST_HEADER_OCTET_COUNT;
+    inStream.p = buf + inStream.pos;
+
+    uint8_t cmd;
+    NIMBLE_TEST_ASSERT(fldInStreamReadUInt8(&inStream, &cmd) == 0)
+    NIMBLE_TEST_ASSERT(cmd == NIMBLE_CLIENT_DATAGRAM_COMMAND_LIST)
+
+    FldInStream commandStream;
+    NIMBLE_TEST_ASSERT(nimbleClientDatagramCommandRead(&inStream, &commandStream) == 0)
+    NIMBLE_TEST_ASSERT(fldInStreamReadUInt8(&commandStream, &cmd) == 0)
+    NIMBLE_TEST_ASSERT(cmd == 0x01 && commandStream.size == 4)
+    // The rest of the first command is not read, the second command must still be found
+    NIMBLE_TEST_ASSERT(nimbleClientDatagramCommandRead(&inStream, &commandStream) == 0)
+    NIMBLE_TEST_ASSERT(fldInStreamReadUInt8(&commandStream, &cmd) == 0)
+    NIMBLE_TEST_ASSERT(cmd == 0x02 && commandStream.size == 6)
+    NIMBLE_TEST_ASSERT(inStream.pos == inStream.size)
+
+    return 0;
+}
+
+static int testNoCommandsRemovesCommandList(void)
+{
+    uint8_t buf[64];
+    FldOutStream outStream;
+    fldOutStreamInit(&outStream, buf, sizeof(buf));
+    writeHeader(&outStream);
+
+    size_t listStart = nimbleClientDatagramCommandsBegin(&outStream);
+    NIMBLE_TEST_ASSERT(nimbleClientDatagramCommandsEnd(&outStream, listStart) == 0)
+    NIMBLE_TEST_ASSERT(outStream.pos == DATAGRAM_COMMAND_TEST_HEADER_OCTET_COUNT)
+
+    return 0;
+}
+
+int main(void)
+{
+    int failedCount = 0;
+
+    NIMBLE_TEST_RUN(testSingleCommandHasNoCommandList, failedCount)
+    NIMBLE_TEST_RUN(testSeveralCommandsAreReadBack, failedCount)
+    NIMBLE_TEST_RUN(testNoCommandsRemovesCommandList, failedCount)
+
+    return failedCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "test.h"
+#include <clog/clog.h>
+#include <nimble-client/game_state_codec.h>
+#include <string.h>
+
+clog_config g_clog;
+
+#define TEST_MAX_GAME_STATE_OCTET_COUNT (3 * NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_OCTET_COUNT + 5)
+
+static uint8_t g_raw[TEST_MAX_GAME_STATE_OCTET_COUNT];
+static uint8_t g_encoded[TEST_MAX_GAME_STATE_OCTET_COUNT + 4 * NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_HEADER_OCTET_COUNT];
+static uint8_t g_decoded[TEST_MAX_GAME_STATE_OCTET_COUNT];
+
+static void fillCompressible(uint8_t* octets, size_t octetCount)
+{
+    for (size_t i = 0; i < octetCount; ++i) {
+        octets[i] = (uint8_t) ((i % 64) ^ (i / 1000));
+    }
+}
+
+static void fillRandom(uint8_t* octets, size_t octetCount)
+{
+    uint32_t state = 0x5eed;
+    for (size_t i = 0; i < octetCount; ++i) {
+        state = state * 1664525U + 1013904223U;
+        octets[i] = (uint8_t) (state >> 24);
+    }
+}
+
+/// Encodes g_raw and decodes it again, feeding the encoded octets in steps as if they were downloading
+static int roundTrip(size_t octetCount, size_t feedStepOctetCount, ssize_t* encodedOctetCount)
+{
+    *encodedOctetCount = nimbleClientGameStateEncode(g_raw, octetCount, g_encoded, sizeof(g_encoded));
+    NIMBLE_TEST_ASSERT(*encodedOctetCount > 0)
+    NIMBLE_TEST_ASSERT((size_t) *encodedOctetCount <= nimbleClientGameStateEncodeMaxOctetCount(octetCount))
+
+    memset(g_decoded, 0, sizeof(g_decoded));
+    NimbleClientGameStateDecoder decoder;
+    nimbleClientGameStateDecoderInit(&decoder, g_decoded, octetCount);
+
+    for (size_t available = 0; available < (size_t) *encodedOctetCount; available += feedStepOctetCount) {
+        NIMBLE_TEST_ASSERT(nimbleClientGameStateDecoderFeed(&decoder, g_encoded, available) == 0)
+    }
+    NIMBLE_TEST_ASSERT(nimbleClientGameStateDecoderFeed(&decoder, g_encoded, (size_t) *encodedOctetCount) == 0)
+
+    NIMBLE_TEST_ASSERT(nimbleClientGameStateDecoderIsComplete(&decoder))
+    NIMBLE_TEST_ASSERT(memcmp(g_raw, g_decoded, octetCount) == 0)
+
+    return 0;
+}
+
+static int testRoundTrip(void)
+{
+    ssize_t encodedOctetCount;
+
+    fillCompressible(g_raw, TEST_MAX_GAME_STATE_OCTET_COUNT);
+    NIMBLE_TEST_ASSERT(roundTrip(TEST_MAX_GAME_STATE_OCTET_COUNT, 1000, &encodedOctetCount) == 0)
+    NIMBLE_TEST_ASSERT((size_t) encodedOctetCount < TEST_MAX_GAME_STATE_OCTET_COUNT / 4)
+
+    // Does not compress, so the blocks are stored as they are
+    fillRandom(g_raw, TEST_MAX_GAME_STATE_OCTET_COUNT);
+    NIMBLE_TEST_ASSERT(roundTrip(TEST_MAX_GAME_STATE_OCTET_COUNT, 777, &encodedOctetCount) == 0)
+    NIMBLE_TEST_ASSERT((size_t) encodedOctetCount ==
+                       nimbleClientGameStateEncodeMaxOctetCount(TEST_MAX_GAME_STATE_OCTET_COUNT))
+
+    // Too short to compress at all
+    fillCompressible(g_raw, 3);
+    NIMBLE_TEST_ASSERT(roundTrip(3, 1, &encodedOctetCount) == 0)
+
+    return 0;
+}
+
+static int testTruncatedInputWaitsForTheRest(void)
+{
+    fillCompressible(g_raw, TEST_MAX_GAME_STATE_OCTET_COUNT);
+    ssize_t encodedOctetCount = nimbleClientGameStateEncode(g_raw, TEST_MAX_GAME_STATE_OCTET_COUNT, g_encoded,
+                                                            sizeof(g_encoded));
+    NIMBLE_TEST_ASSERT(encodedOctetCount > 0)
+
+    // A block is only decoded when all of it is available
+    NimbleClientGameStateDecoder decoder;
+    nimbleClientGameStateDecoderInit(&decoder, g_decoded, TEST_MAX_GAME_STATE_OCTET_COUNT);
+    NIMBLE_TEST_ASSERT(nimbleClientGameStateDecoderFeed(&decoder, g_encoded, (size_t) encodedOctetCount - 1) == 0)
+    NIMBLE_TEST_ASSERT(!nimbleClientGameStateDecoderIsComplete(&decoder))
+    NIMBLE_TEST_ASSERT(decoder.writeOffset == 3 * NIMBLE_CLIENT_GAME_STATE_CODEC_BLOCK_OCTET_COUNT)
+
+    return 0;
+}
+
+static int testTruncatedBlockIsCorrupt(void)
+{
+    // One literal and then the block ends, so it decodes to fewer octets than its header says
+    const uint8_t encoded[] = {8, 0, 2, 0, 0x14, 'a'};
+
+    NimbleClientGameStateDecoder decoder;
+    nimbleClientGameStateDecoderInit(&decoder, g_decoded, 8);
+    NIMBLE_TEST_ASSERT(nimbleClientGameStateDecoderFeed(&decoder, encoded, sizeof(encoded)) < 0)
+
+    // Literal length that is longer than the block
+    const uint8_t tooManyLiterals[] = {8, 0, 2, 0, 0x50, 'a'};
+    nimbleClientGameStateDecoderInit(&decoder, g_decoded, 8);
+    NIMBLE_TEST_ASSERT(nimbleClientGameStateDecoderFeed(&decoder, tooManyLiterals, sizeof(tooManyLiterals)) < 0)
+
+    return 0;
+}
+
+static int testMatchOffsetBeforeTheStart(void)
+{
+    // One literal followed by a match five octets back, but only one octet has been decoded
+    const uint8_t encoded[] = {5, 0, 4, 0, 0x10, 'a', 5, 0};
+
+    NimbleClientGameStateDecoder decoder;
+    nimbleClientGameStateDecoderInit(&decoder, g_decoded, 5);
+    NIMBLE_TEST_ASSERT(nimbleClientGameStateDecoderFeed(&decoder, encoded, sizeof(encoded)) < 0)
+
+    // Zero offset is never valid
+    const uint8_t zeroOffset[] = {5, 0, 4, 0, 0x10, 'a', 0, 0};
+    nimbleClientGameStateDecoderInit(&decoder, g_decoded, 5);
+    NIMBLE_TEST_ASSERT(nimbleClientGameStateDecoderFeed(&decoder, zeroOffset, sizeof(zeroOffset)) < 0)
+
+    // The same match one octet back is fine, and repeats the literal
+    const uint8_t validOffset[] = {5, 0, 4, 0, 0x10, 'a', 1, 0};
+    nimbleClientGameStateDecoderInit(&decoder, g_decoded, 5);
+    NIMBLE_TEST_ASSERT(nimbleClientGameStateDecoderFeed(&decoder, validOffset, sizeof(validOffset)) == 0)
+    NIMBLE_TEST_ASSERT(nimbleClientGameStateDecoderIsComplete(&decoder))
+    NIMBLE_TEST_ASSERT(memcmp(g_decoded, "aaaaa", 5) == 0)
+
+    return 0;
+}
+
+static int testOutputOverflow(void)
+{
+    NimbleClientGameStateDecoder decoder;
+
+    // The block is larger than the decoded game state
+    const uint8_t storedBlock[] = {4, 0, 0, 0, 'a', 'b', 'c', 'd'};
+    nimbleClientGameStateDecoderInit(&decoder, g_decoded, 3);
+    NIMBLE_TEST_ASSERT(nimbleClientGameStateDecoderFeed(&decoder, storedBlock, sizeof(storedBlock)) < 0)
+
+    // The match decodes to more octets than the block header says
+    const uint8_t longMatch[] = {5, 0, 5, 0, 0x1f, 'a', 1, 0, 10};
+    nimbleClientGameStateDecoderInit(&decoder, g_decoded, 5);
+    NIMBLE_TEST_ASSERT(nimbleClientGameStateDecoderFeed(&decoder, longMatch, sizeof(longMatch)) < 0)
+
+    // The encoder does not write past the end of the target
+    fillRandom(g_raw, 100);
+    NIMBLE_TEST_ASSERT(nimbleClientGameStateEncode(g_raw, 100, g_encoded, 50) < 0)
+
+    return 0;
+}
+
+int main(void)
+{
+    int failedCount = 0;
+
+    NIMBLE_TEST_RUN(testRoundTrip, failedCount)
+    NIMBLE_TEST_RUN(testTruncatedInputWaitsForTheRest, failedCount)
+    NIMBLE_TEST_RUN(testTruncatedBlockIsCorrupt, failedCount)
+    NIMBLE_TEST_RUN(testMatchOffsetBeforeTheStart, failedCount)
+    NIMBLE_TEST_RUN(testOutputOverflow, failedCount)
+
+    return failedCount == 0 ? 0 : 1;
+}
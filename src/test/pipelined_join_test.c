@@ -0,0 +1,137 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "common.h"
+#include "loopback_server.h"
+#include "test.h"
+#include <clog/clog.h>
+#include <imprint/default_setup.h>
+#include <nimble-client/client.h>
+#include <nimble-client/network_realizer.h>
+#include <tiny-libc/tiny_libc.h>
+
+clog_config g_clog;
+
+#define PIPELINED_JOIN_TEST_GAME_STATE_OCTET_COUNT (16 * 1024)
+#define PIPELINED_JOIN_TEST_SYNCED_TICK_COUNT (60)
+
+/// Runs a client with a pipelined join against the loopback server. The server answers the download game state
+/// request before the join game request, since that is the order that they are in the datagram, so the join game
+/// response arrives while the game state is downloading.
+static int runPipelinedJoin(bool compressGameState)
+{
+    ImprintDefaultSetup memory;
+    imprintDefaultSetupInit(&memory, 16 * 1024 * 1024);
+
+    Clog serverLog;
+    serverLog.config = &g_clog;
+    serverLog.constantPrefix = "server";
+
+    NimbleLoopbackServer server;
+    nimbleLoopbackServerInit(&server, &memory.tagAllocator.info, &memory.slabAllocator.info,
+                             PIPELINED_JOIN_TEST_GAME_STATE_OCTET_COUNT, NIMBLE_LOOPBACK_DATAGRAM_QUEUE_CAPACITY,
+                             serverLog);
+
+    MonotonicTimeMs now = 0;
+    NimbleClientClock virtualClock;
+    virtualClock.self = &now;
+    virtualClock.now = nimbleBenchVirtualClockNow;
+
+    NimbleClientRealizeSettings settings;
+    settings.memory = &memory.tagAllocator.info;
+    settings.blobMemory = &memory.slabAllocator.info;
+    settings.transport = nimbleLoopbackServerClientTransport(&server);
+    settings.maximumSingleParticipantStepOctetCount = 16;
+    settings.maximumNumberOfParticipants = NIMBLE_LOOPBACK_MAX_PARTICIPANTS;
+    settings.maximumGameStateOctetCount = PIPELINED_JOIN_TEST_GAME_STATE_OCTET_COUNT;
+    settings.arena = 0;
+    settings.arenaOctetCount = 0;
+    settings.applicationVersion.major = 0x10;
+    settings.applicationVersion.minor = 0x20;
+    settings.applicationVersion.patch = 0x30;
+    settings.wantsDebugStreams = false;
+    settings.log.config = &g_clog;
+    settings.log.constantPrefix = "client";
+
+    NimbleClientRealize clientRealize;
+    nimbleClientRealizeInit(&clientRealize, &settings);
+    nimbleClientSetClock(&clientRealize.client, virtualClock);
+    nimbleClientSetCompressedGameState(&clientRealize.client, compressGameState);
+    nimbleClientSetPipelinedJoin(&clientRealize.client, true);
+    nimbleClientRealizeReInit(&clientRealize, &settings);
+
+    NimbleSerializeJoinGameRequest joinGameRequest;
+    tc_mem_clear_type(&joinGameRequest);
+    joinGameRequest.playerCount = 1;
+    joinGameRequest.players[0].localIndex = 0xca;
+    nimbleClientRealizeJoinGame(&clientRealize, joinGameRequest);
+
+    size_t tick = 0;
+    size_t syncedTicks = 0;
+    size_t stepsReceived = 0;
+    int result = 0;
+
+    while (syncedTicks < PIPELINED_JOIN_TEST_SYNCED_TICK_COUNT) {
+        if (tick >= BENCH_MAX_TICKS_TO_SYNC || clientRealize.state == NimbleClientRealizeStateDisconnected) {
+            fprintf(stderr, "client did not reach synced within %zu ticks (client state %d)\n", tick,
+                    clientRealize.client.state);
+            result = -1;
+            break;
+        }
+
+        tick++;
+        now = (MonotonicTimeMs) (tick * BENCH_TICK_DURATION_MS);
+
+        if (nimbleLoopbackServerUpdate(&server, now) < 0) {
+            result = -1;
+            break;
+        }
+
+        if (clientRealize.client.state == NimbleClientStateSynced) {
+            nimbleBenchWritePredictedStep(&clientRealize.client);
+        }
+
+        nimbleClientRealizeUpdate(&clientRealize, now);
+        stepsReceived += nimbleBenchReadAuthoritativeSteps(&clientRealize.client);
+
+        if (clientRealize.state == NimbleClientRealizeStateSynced) {
+            syncedTicks++;
+        }
+    }
+
+    size_t localParticipantCount = clientRealize.client.localParticipantCount;
+    uint8_t participantId = clientRealize.client.localParticipantLookup[0].participantId;
+    NimbleSerializeParticipantId serverParticipantId = server.participantIds[0];
+
+    nimbleClientRealizeDestroy(&clientRealize);
+    nimbleLoopbackServerDestroy(&server);
+    imprintDefaultSetupDestroy(&memory);
+
+    NIMBLE_TEST_ASSERT(result == 0)
+    NIMBLE_TEST_ASSERT(localParticipantCount == 1)
+    NIMBLE_TEST_ASSERT(participantId == serverParticipantId)
+    NIMBLE_TEST_ASSERT(stepsReceived > 0)
+
+    return 0;
+}
+
+static int testPipelinedJoinReachesSynced(void)
+{
+    return runPipelinedJoin(false);
+}
+
+static int testPipelinedJoinReachesSyncedWithCompressedGameState(void)
+{
+    return runPipelinedJoin(true);
+}
+
+int main(void)
+{
+    int failedCount = 0;
+
+    NIMBLE_TEST_RUN(testPipelinedJoinReachesSynced, failedCount)
+    NIMBLE_TEST_RUN(testPipelinedJoinReachesSyncedWithCompressedGameState, failedCount)
+
+    return failedCount == 0 ? 0 : 1;
+}
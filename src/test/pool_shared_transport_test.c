@@ -0,0 +1,174 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "common.h"
+#include "loopback_server.h"
+#include "loopback_shared_transport.h"
+#include "test.h"
+#include <clog/clog.h>
+#include <imprint/default_setup.h>
+#include <nimble-client/client.h>
+#include <nimble-client/network_realizer.h>
+#include <nimble-client/pool.h>
+#include <tiny-libc/tiny_libc.h>
+
+clog_config g_clog;
+
+#define POOL_TEST_CLIENT_COUNT (4)
+#define POOL_TEST_GAME_STATE_OCTET_COUNT (1024)
+#define POOL_TEST_QUEUE_CAPACITY (16)
+#define POOL_TEST_SYNCED_TICK_COUNT (30)
+
+static bool allClientsAreSynced(NimbleClientRealize** clients, size_t clientCount)
+{
+    for (size_t i = 0; i < clientCount; ++i) {
+        if (clients[i]->state != NimbleClientRealizeStateSynced) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// Runs the clients of a pool on one shared transport, each against its own loopback server
+static int testPoolClientsSyncOnSharedTransport(void)
+{
+    ImprintDefaultSetup memory;
+    imprintDefaultSetupInit(&memory, 16 * 1024 * 1024);
+
+    Clog serverLog;
+    serverLog.config = &g_clog;
+    serverLog.constantPrefix = "server";
+
+    MonotonicTimeMs now = 0;
+    NimbleClientClock virtualClock;
+    virtualClock.self = &now;
+    virtualClock.now = nimbleBenchVirtualClockNow;
+
+    NimbleLoopbackServer servers[POOL_TEST_CLIENT_COUNT];
+    for (size_t i = 0; i < POOL_TEST_CLIENT_COUNT; ++i) {
+        nimbleLoopbackServerInit(&servers[i], &memory.tagAllocator.info, &memory.slabAllocator.info,
+                                 POOL_TEST_GAME_STATE_OCTET_COUNT, POOL_TEST_QUEUE_CAPACITY, serverLog);
+    }
+
+    NimbleLoopbackSharedTransport sharedTransport;
+    nimbleLoopbackSharedTransportInit(&sharedTransport, servers, POOL_TEST_CLIENT_COUNT);
+
+    NimbleClientPoolSettings poolSettings;
+    poolSettings.memory = &memory.tagAllocator.info;
+    poolSettings.sharedTransport = nimbleLoopbackSharedTransportTransport(&sharedTransport);
+    poolSettings.clientCapacity = POOL_TEST_CLIENT_COUNT;
+    poolSettings.workerCount = 1;
+    poolSettings.inDatagramCapacity = POOL_TEST_CLIENT_COUNT * POOL_TEST_QUEUE_CAPACITY;
+    poolSettings.log.config = &g_clog;
+    poolSettings.log.constantPrefix = "pool";
+
+    NimbleClientRealizeSettings* clientSettings = &poolSettings.clientSettings;
+    clientSettings->memory = &memory.tagAllocator.info;
+    clientSettings->blobMemory = &memory.slabAllocator.info;
+    clientSettings->arena = 0;
+    clientSettings->arenaOctetCount = 0;
+    clientSettings->maximumSingleParticipantStepOctetCount = 8;
+    clientSettings->maximumNumberOfParticipants = 1;
+    clientSettings->maximumGameStateOctetCount = POOL_TEST_GAME_STATE_OCTET_COUNT;
+    clientSettings->applicationVersion.major = 0x10;
+    clientSettings->applicationVersion.minor = 0x20;
+    clientSettings->applicationVersion.patch = 0x30;
+    clientSettings->wantsDebugStreams = false;
+    clientSettings->log.config = &g_clog;
+    clientSettings->log.constantPrefix = "client";
+
+    NimbleClientPool pool;
+    NIMBLE_TEST_ASSERT(nimbleClientPoolInit(&pool, &poolSettings) == 0)
+
+    NimbleSerializeJoinGameRequest joinGameRequest;
+    tc_mem_clear_type(&joinGameRequest);
+    joinGameRequest.playerCount = 1;
+    joinGameRequest.players[0].localIndex = 0xca;
+
+    NimbleClientRealize* clients[POOL_TEST_CLIENT_COUNT];
+    for (size_t i = 0; i < POOL_TEST_CLIENT_COUNT; ++i) {
+        clients[i] = nimbleClientPoolAdd(&pool, 0);
+        NIMBLE_TEST_ASSERT(clients[i] != 0)
+        nimbleClientSetClock(&clients[i]->client, virtualClock);
+        nimbleClientRealizeReInit(clients[i], &clients[i]->settings);
+        nimbleClientRealizeJoinGame(clients[i], joinGameRequest);
+    }
+
+    size_t tick = 0;
+    size_t syncedTicks = 0;
+    size_t stepsReceived[POOL_TEST_CLIENT_COUNT];
+    tc_mem_clear_type_n(stepsReceived, POOL_TEST_CLIENT_COUNT);
+
+    while (syncedTicks < POOL_TEST_SYNCED_TICK_COUNT && tick < BENCH_MAX_TICKS_TO_SYNC) {
+        tick++;
+        now = (MonotonicTimeMs) (tick * BENCH_TICK_DURATION_MS);
+
+        for (size_t i = 0; i < POOL_TEST_CLIENT_COUNT; ++i) {
+            nimbleLoopbackServerUpdate(&servers[i], now);
+            if (clients[i]->client.state == NimbleClientStateSynced) {
+                nimbleBenchWritePredictedStep(&clients[i]->client);
+            }
+        }
+
+        NIMBLE_TEST_ASSERT(nimbleClientPoolUpdate(&pool, now) == 0)
+
+        for (size_t i = 0; i < POOL_TEST_CLIENT_COUNT; ++i) {
+            stepsReceived[i] += nimbleBenchReadAuthoritativeSteps(&clients[i]->client);
+        }
+
+        if (allClientsAreSynced(clients, POOL_TEST_CLIENT_COUNT)) {
+            syncedTicks++;
+        }
+    }
+
+    NIMBLE_TEST_ASSERT(syncedTicks == POOL_TEST_SYNCED_TICK_COUNT)
+    for (size_t i = 0; i < POOL_TEST_CLIENT_COUNT; ++i) {
+        // Each server only heard from its own client, so each client joined with the first participant id
+        NIMBLE_TEST_ASSERT(servers[i].participantCount == 1)
+        NIMBLE_TEST_ASSERT(clients[i]->client.localParticipantCount == 1)
+        NIMBLE_TEST_ASSERT(stepsReceived[i] > 0)
+    }
+    NIMBLE_TEST_ASSERT(sharedTransport.stats.droppedDatagramCount == 0)
+    NIMBLE_TEST_ASSERT(pool.stats.droppedDatagramCount == 0)
+    NIMBLE_TEST_ASSERT(sharedTransport.stats.datagramsToClients == pool.stats.receivedDatagramCount)
+
+    nimbleClientPoolDestroy(&pool);
+    for (size_t i = 0; i < POOL_TEST_CLIENT_COUNT; ++i) {
+        nimbleLoopbackServerDestroy(&servers[i]);
+    }
+    imprintDefaultSetupDestroy(&memory);
+
+    return 0;
+}
+
+/// The connection id in front of a datagram must be one that a server has been set up for
+static int testSharedTransportDropsUnknownConnections(void)
+{
+    NimbleLoopbackSharedTransport sharedTransport;
+    nimbleLoopbackSharedTransportInit(&sharedTransport, 0, 0);
+    DatagramTransport transport = nimbleLoopbackSharedTransportTransport(&sharedTransport);
+
+    const uint8_t unknownConnection[] = {0x00, 0x01, 0x42};
+    NIMBLE_TEST_ASSERT(datagramTransportSend(&transport, unknownConnection, sizeof(unknownConnection)) >= 0)
+
+    const uint8_t onlyHeader[] = {0x00, 0x01};
+    datagramTransportSend(&transport, onlyHeader, sizeof(onlyHeader));
+    NIMBLE_TEST_ASSERT(sharedTransport.stats.droppedDatagramCount == 2)
+
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    NIMBLE_TEST_ASSERT(datagramTransportReceive(&transport, buf, sizeof(buf)) == 0)
+
+    return 0;
+}
+
+int main(void)
+{
+    int failedCount = 0;
+
+    NIMBLE_TEST_RUN(testPoolClientsSyncOnSharedTransport, failedCount)
+    NIMBLE_TEST_RUN(testSharedTransportDropsUnknownConnections, failedCount)
+
+    return failedCount == 0 ? 0 : 1;
+}
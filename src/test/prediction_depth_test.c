@@ -0,0 +1,133 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "test.h"
+#include <clog/clog.h>
+#include <nimble-client/prediction_depth.h>
+
+clog_config g_clog;
+
+#define TEST_TICK_DURATION_US (16000)
+
+static void addRtts(NimbleClientPredictionDepth* depth, MonotonicTimeMs rttMs, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        nimbleClientPredictionDepthAddRtt(depth, rttMs);
+    }
+}
+
+static void initDepth(NimbleClientPredictionDepth* depth, NimbleClientPredictionDepthWindow* window)
+{
+    nimbleClientPredictionDepthInit(depth, window, TEST_TICK_DURATION_US,
+                                    NIMBLE_CLIENT_PREDICTION_DEPTH_DEFAULT_PERCENTILE,
+                                    NIMBLE_CLIENT_PREDICTION_DEPTH_DEFAULT_SAFETY_MARGIN_MS);
+}
+
+static int testSteadyRoundTripTime(void)
+{
+    NimbleClientPredictionDepthWindow window;
+    NimbleClientPredictionDepth depth;
+    initDepth(&depth, &window);
+    NIMBLE_TEST_ASSERT(!depth.hasTarget)
+
+    // Half of 40 ms plus the 2 ms margin is 22 ms, rounded up to two ticks, plus the step the server composes next
+    addRtts(&depth, 40, NIMBLE_CLIENT_PREDICTION_DEPTH_SAMPLE_COUNT);
+    NIMBLE_TEST_ASSERT(depth.hasTarget)
+    NIMBLE_TEST_ASSERT(depth.oneWayDelayPercentileMs == 20)
+    NIMBLE_TEST_ASSERT(depth.requiredTickCount == 3)
+    NIMBLE_TEST_ASSERT(depth.targetTickCount == 3)
+
+    return 0;
+}
+
+static int testRaisesRightAwayAndLowersSlowly(void)
+{
+    NimbleClientPredictionDepthWindow window;
+    NimbleClientPredictionDepth depth;
+    initDepth(&depth, &window);
+    addRtts(&depth, 40, NIMBLE_CLIENT_PREDICTION_DEPTH_SAMPLE_COUNT);
+
+    // The 95th percentile of a 64 sample window is the 60th lowest, so it takes five spikes to move it
+    addRtts(&depth, 100, 4);
+    NIMBLE_TEST_ASSERT(depth.targetTickCount == 3)
+    addRtts(&depth, 100, 1);
+    // 20 ms + 60 ms jitter + 2 ms margin
+    NIMBLE_TEST_ASSERT(depth.oneWayDelayPercentileMs == 80)
+    NIMBLE_TEST_ASSERT(depth.targetTickCount == 7)
+
+    // The spikes stay in the window for 59 more samples, after that the required depth is back at three
+    addRtts(&depth, 40, 59);
+    NIMBLE_TEST_ASSERT(depth.requiredTickCount == 7)
+    addRtts(&depth, 40, 1);
+    NIMBLE_TEST_ASSERT(depth.requiredTickCount == 3)
+    NIMBLE_TEST_ASSERT(depth.targetTickCount == 7)
+
+    // Lowered one tick after it has been too high for the whole hysteresis period
+    addRtts(&depth, 40, NIMBLE_CLIENT_PREDICTION_DEPTH_LOWER_AFTER_SAMPLE_COUNT - 2);
+    NIMBLE_TEST_ASSERT(depth.targetTickCount == 7)
+    addRtts(&depth, 40, 1);
+    NIMBLE_TEST_ASSERT(depth.targetTickCount == 6)
+
+    addRtts(&depth, 40, 3 * NIMBLE_CLIENT_PREDICTION_DEPTH_LOWER_AFTER_SAMPLE_COUNT);
+    NIMBLE_TEST_ASSERT(depth.targetTickCount == 3)
+    addRtts(&depth, 40, NIMBLE_CLIENT_PREDICTION_DEPTH_LOWER_AFTER_SAMPLE_COUNT);
+    NIMBLE_TEST_ASSERT(depth.targetTickCount == 3)
+
+    return 0;
+}
+
+static int testLateStepsRaiseTheDepth(void)
+{
+    NimbleClientPredictionDepthWindow window;
+    NimbleClientPredictionDepth depth;
+    initDepth(&depth, &window);
+
+    // Ignored until there is a target
+    nimbleClientPredictionDepthAddBufferDelta(&depth, -2);
+    NIMBLE_TEST_ASSERT(!depth.hasTarget)
+
+    addRtts(&depth, 40, NIMBLE_CLIENT_PREDICTION_DEPTH_SAMPLE_COUNT);
+    nimbleClientPredictionDepthAddBufferDelta(&depth, 3);
+    NIMBLE_TEST_ASSERT(depth.targetTickCount == 3)
+
+    nimbleClientPredictionDepthAddBufferDelta(&depth, -2);
+    NIMBLE_TEST_ASSERT(depth.targetTickCount == 5)
+
+    // Relative to the required depth, so repeated reports do not add up
+    nimbleClientPredictionDepthAddBufferDelta(&depth, -2);
+    NIMBLE_TEST_ASSERT(depth.targetTickCount == 5)
+
+    nimbleClientPredictionDepthAddBufferDelta(&depth, -100);
+    NIMBLE_TEST_ASSERT(depth.targetTickCount == 3 + NIMBLE_CLIENT_PREDICTION_DEPTH_MAXIMUM_LATE_TICK_COUNT)
+
+    return 0;
+}
+
+static int testResetKeepsSettings(void)
+{
+    NimbleClientPredictionDepthWindow window;
+    NimbleClientPredictionDepth depth;
+    initDepth(&depth, &window);
+    addRtts(&depth, 40, 10);
+
+    nimbleClientPredictionDepthReset(&depth);
+    NIMBLE_TEST_ASSERT(!depth.hasTarget)
+    NIMBLE_TEST_ASSERT(window.sampleCount == 0)
+    NIMBLE_TEST_ASSERT(depth.tickDurationUs == TEST_TICK_DURATION_US)
+    NIMBLE_TEST_ASSERT(depth.percentile == NIMBLE_CLIENT_PREDICTION_DEPTH_DEFAULT_PERCENTILE)
+
+    return 0;
+}
+
+int main(void)
+{
+    int failedCount = 0;
+
+    NIMBLE_TEST_RUN(testSteadyRoundTripTime, failedCount)
+    NIMBLE_TEST_RUN(testRaisesRightAwayAndLowersSlowly, failedCount)
+    NIMBLE_TEST_RUN(testLateStepsRaiseTheDepth, failedCount)
+    NIMBLE_TEST_RUN(testResetKeepsSettings, failedCount)
+
+    return failedCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "test.h"
+#include <clog/clog.h>
+#include <nimble-client/retransmit.h>
+
+clog_config g_clog;
+
+static int testInitialRto(void)
+{
+    NimbleClientRto rto;
+    nimbleClientRtoInit(&rto, 1);
+
+    NIMBLE_TEST_ASSERT(!rto.hasSample)
+    NIMBLE_TEST_ASSERT(rto.rtoMs == NIMBLE_CLIENT_RTO_INITIAL_MS)
+
+    return 0;
+}
+
+static int testRtoFollowsSamples(void)
+{
+    NimbleClientRto rto;
+    nimbleClientRtoInit(&rto, 1);
+
+    // The first sample sets the variation to half of it, RTO = SRTT + 4 * RTTVAR
+    nimbleClientRtoAddSample(&rto, 50);
+    NIMBLE_TEST_ASSERT(rto.smoothedRttMs == 50)
+    NIMBLE_TEST_ASSERT(rto.rttVariationMs == 25)
+    NIMBLE_TEST_ASSERT(rto.rtoMs == 150)
+
+    // A steady round trip time makes the variation decay
+    for (size_t i = 0; i < 100; ++i) {
+        nimbleClientRtoAddSample(&rto, 50);
+    }
+    NIMBLE_TEST_ASSERT(rto.smoothedRttMs == 50)
+    NIMBLE_TEST_ASSERT(rto.rttVariationMs == 0)
+    NIMBLE_TEST_ASSERT(rto.rtoMs == 50)
+
+    return 0;
+}
+
+static int testRtoIsClamped(void)
+{
+    NimbleClientRto rto;
+    nimbleClientRtoInit(&rto, 1);
+
+    for (size_t i = 0; i < 100; ++i) {
+        nimbleClientRtoAddSample(&rto, 1);
+    }
+    NIMBLE_TEST_ASSERT(rto.rtoMs == NIMBLE_CLIENT_RTO_MINIMUM_MS)
+
+    nimbleClientRtoAddSample(&rto, 60000);
+    NIMBLE_TEST_ASSERT(rto.rtoMs == NIMBLE_CLIENT_RTO_MAXIMUM_MS)
+
+    return 0;
+}
+
+static int testRequestTimerIsDueUntilSent(void)
+{
+    NimbleClientRequestTimer timer;
+    nimbleClientRequestTimerReset(&timer);
+
+    NIMBLE_TEST_ASSERT(nimbleClientRequestTimerIsDue(&timer, 0))
+    NIMBLE_TEST_ASSERT(nimbleClientRequestTimerDeadline(&timer, 1234) == 1234)
+
+    return 0;
+}
+
+static int testRequestTimerBacksOff(void)
+{
+    NimbleClientRto rto;
+    nimbleClientRtoInit(&rto, 0x5eed);
+    NimbleClientRequestTimer timer;
+    nimbleClientRequestTimerReset(&timer);
+
+    MonotonicTimeMs now = 1000;
+    MonotonicTimeMs expectedTimeoutMs = NIMBLE_CLIENT_RTO_INITIAL_MS;
+
+    for (size_t i = 0; i < 8; ++i) {
+        nimbleClientRequestTimerSent(&timer, &rto, now);
+
+        // The timeout doubles on every resend, with up to a quarter of jitter on top
+        MonotonicTimeMs timeoutMs = timer.resendAt - now;
+        NIMBLE_TEST_ASSERT(timeoutMs >= expectedTimeoutMs)
+        NIMBLE_TEST_ASSERT(timeoutMs <= expectedTimeoutMs + expectedTimeoutMs / 4)
+
+        NIMBLE_TEST_ASSERT(!nimbleClientRequestTimerIsDue(&timer, timer.resendAt - 1))
+        NIMBLE_TEST_ASSERT(nimbleClientRequestTimerIsDue(&timer, timer.resendAt))
+        NIMBLE_TEST_ASSERT(nimbleClientRequestTimerDeadline(&timer, now) == timer.resendAt)
+
+        now = timer.resendAt;
+        expectedTimeoutMs *= 2;
+        if (expectedTimeoutMs > NIMBLE_CLIENT_RTO_MAXIMUM_MS) {
+            expectedTimeoutMs = NIMBLE_CLIENT_RTO_MAXIMUM_MS;
+        }
+    }
+
+    // A new request starts from the estimate again
+    nimbleClientRequestTimerReset(&timer);
+    nimbleClientRequestTimerSent(&timer, &rto, now);
+    NIMBLE_TEST_ASSERT(timer.resendAt - now <= NIMBLE_CLIENT_RTO_INITIAL_MS + NIMBLE_CLIENT_RTO_INITIAL_MS / 4)
+
+    return 0;
+}
+
+int main(void)
+{
+    int failedCount = 0;
+
+    NIMBLE_TEST_RUN(testInitialRto, failedCount)
+    NIMBLE_TEST_RUN(testRtoFollowsSamples, failedCount)
+    NIMBLE_TEST_RUN(testRtoIsClamped, failedCount)
+    NIMBLE_TEST_RUN(testRequestTimerIsDueUntilSent, failedCount)
+    NIMBLE_TEST_RUN(testRequestTimerBacksOff, failedCount)
+
+    return failedCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "test.h"
+#include <clog/clog.h>
+#include <imprint/default_setup.h>
+#include <nimble-client/step_queue.h>
+
+#if !defined _WIN32
+#include <pthread.h>
+#endif
+
+clog_config g_clog;
+
+static ImprintDefaultSetup g_memory;
+
+#define TEST_MAX_OCTET_COUNT (32)
+
+static int testCapacityMustBePowerOfTwo(void)
+{
+    NimbleClientStepQueue queue;
+
+    NIMBLE_TEST_ASSERT(nimbleClientStepQueueInit(&queue, &g_memory.tagAllocator.info, 0, TEST_MAX_OCTET_COUNT) < 0)
+    NIMBLE_TEST_ASSERT(nimbleClientStepQueueInit(&queue, &g_memory.tagAllocator.info, 12, TEST_MAX_OCTET_COUNT) < 0)
+    NIMBLE_TEST_ASSERT(nimbleClientStepQueueInit(&queue, &g_memory.tagAllocator.info, 16, TEST_MAX_OCTET_COUNT) == 0)
+
+    return 0;
+}
+
+static int testWriteAndRead(void)
+{
+    NimbleClientStepQueue queue;
+    nimbleClientStepQueueInit(&queue, &g_memory.tagAllocator.info, 4, TEST_MAX_OCTET_COUNT);
+
+    uint8_t target[TEST_MAX_OCTET_COUNT];
+    StepId stepId;
+    NIMBLE_TEST_ASSERT(nimbleClientStepQueueRead(&queue, &stepId, target, sizeof(target)) == 0)
+
+    // Wraps around the slots a few times
+    for (StepId i = 0; i < 10; ++i) {
+        uint8_t payload[3] = {(uint8_t) i, 0xca, 0xfe};
+        NIMBLE_TEST_ASSERT(nimbleClientStepQueueWrite(&queue, 100 + i, payload, sizeof(payload)) == 0)
+        NIMBLE_TEST_ASSERT(nimbleClientStepQueueCount(&queue) == 1)
+
+        NIMBLE_TEST_ASSERT(nimbleClientStepQueueRead(&queue, &stepId, target, sizeof(target)) == 3)
+        NIMBLE_TEST_ASSERT(stepId == 100 + i)
+        NIMBLE_TEST_ASSERT(target[0] == (uint8_t) i && target[1] == 0xca && target[2] == 0xfe)
+        NIMBLE_TEST_ASSERT(nimbleClientStepQueueCount(&queue) == 0)
+    }
+
+    return 0;
+}
+
+static int testFullAndTooLarge(void)
+{
+    NimbleClientStepQueue queue;
+    nimbleClientStepQueueInit(&queue, &g_memory.tagAllocator.info, 4, TEST_MAX_OCTET_COUNT);
+
+    uint8_t payload[TEST_MAX_OCTET_COUNT + 1] = {0};
+    NIMBLE_TEST_ASSERT(nimbleClientStepQueueWrite(&queue, 1, payload, sizeof(payload)) == -2)
+
+    for (StepId i = 0; i < 4; ++i) {
+        NIMBLE_TEST_ASSERT(nimbleClientStepQueueWrite(&queue, i, payload, 1) == 0)
+    }
+    NIMBLE_TEST_ASSERT(nimbleClientStepQueueFreeCount(&queue) == 0)
+    NIMBLE_TEST_ASSERT(nimbleClientStepQueueWrite(&queue, 4, payload, 1) == -1)
+
+    // The step stays in the queue if the target is too small
+    StepId stepId;
+    uint8_t target[1];
+    NIMBLE_TEST_ASSERT(nimbleClientStepQueueRead(&queue, &stepId, target, 0) == -2)
+    NIMBLE_TEST_ASSERT(nimbleClientStepQueueCount(&queue) == 4)
+    NIMBLE_TEST_ASSERT(nimbleClientStepQueueRead(&queue, &stepId, target, sizeof(target)) == 1)
+    NIMBLE_TEST_ASSERT(stepId == 0)
+
+    return 0;
+}
+
+#if !defined _WIN32
+
+#define TEST_THREADED_STEP_COUNT (200000)
+
+static void* produceSteps(void* arg)
+{
+    NimbleClientStepQueue* queue = (NimbleClientStepQueue*) arg;
+
+    for (StepId stepId = 0; stepId < TEST_THREADED_STEP_COUNT;) {
+        uint8_t payload[4] = {(uint8_t) stepId, (uint8_t) (stepId >> 8), (uint8_t) (stepId >> 16),
+                              (uint8_t) (stepId >> 24)};
+        if (nimbleClientStepQueueWrite(queue, stepId, payload, (stepId % 4) + 1) == 0) {
+            stepId++;
+        }
+    }
+
+    return 0;
+}
+
+static int testProducerAndConsumerThreads(void)
+{
+    NimbleClientStepQueue queue;
+    nimbleClientStepQueueInit(&queue, &g_memory.tagAllocator.info, 64, TEST_MAX_OCTET_COUNT);
+
+    pthread_t producer;
+    NIMBLE_TEST_ASSERT(pthread_create(&producer, 0, produceSteps, &queue) == 0)
+
+    // Every step must arrive once, in order and with the payload that was written for it
+    StepId expectedStepId = 0;
+    int result = 0;
+    while (expectedStepId < TEST_THREADED_STEP_COUNT) {
+        uint8_t target[TEST_MAX_OCTET_COUNT];
+        StepId stepId;
+        int octetCount = nimbleClientStepQueueRead(&queue, &stepId, target, sizeof(target));
+        if (octetCount == 0) {
+            continue;
+        }
+        if (stepId != expectedStepId || octetCount != (int) (stepId % 4) + 1 || target[0] != (uint8_t) stepId) {
+            result = -1;
+            break;
+        }
+        expectedStepId++;
+    }
+
+    pthread_join(producer, 0);
+    NIMBLE_TEST_ASSERT(result == 0)
+
+    return 0;
+}
+
+#endif
+
+int main(void)
+{
+    int failedCount = 0;
+
+    imprintDefaultSetupInit(&g_memory, 1024 * 1024);
+
+    NIMBLE_TEST_RUN(testCapacityMustBePowerOfTwo, failedCount)
+    NIMBLE_TEST_RUN(testWriteAndRead, failedCount)
+    NIMBLE_TEST_RUN(testFullAndTooLarge, failedCount)
+#if !defined _WIN32
+    NIMBLE_TEST_RUN(testProducerAndConsumerThreads, failedCount)
+#endif
+
+    imprintDefaultSetupDestroy(&g_memory);
+
+    return failedCount == 0 ? 0 : 1;
+}
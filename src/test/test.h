@@ -0,0 +1,24 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef NIMBLE_CLIENT_TEST_H
+#define NIMBLE_CLIENT_TEST_H
+
+#include <stdio.h>
+
+/// Fails the current test function if the condition is false
+#define NIMBLE_TEST_ASSERT(condition)                                                                                  \
+    if (!(condition)) {                                                                                                \
+        fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition);                                        \
+        return -1;                                                                                                     \
+    }
+
+/// Runs a test function and counts it in failedCount if it fails
+#define NIMBLE_TEST_RUN(testFunction, failedCount)                                                                     \
+    if ((testFunction)() < 0) {                                                                                        \
+        fprintf(stderr, "%s failed\n", #testFunction);                                                                 \
+        (failedCount)++;                                                                                               \
+    }
+
+#endif
@@ -0,0 +1,97 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/nimble-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "test.h"
+#include <clog/clog.h>
+#include <nimble-client/time_dilation.h>
+
+clog_config g_clog;
+
+static int testNoCorrectionWithoutSamples(void)
+{
+    NimbleClientTimeDilation dilation;
+    nimbleClientTimeDilationInit(&dilation, NIMBLE_CLIENT_TIME_DILATION_DEFAULT_TARGET_BUFFER_DELTA);
+
+    NIMBLE_TEST_ASSERT(dilation.rateAdjustPpm == 0)
+    NIMBLE_TEST_ASSERT(!(nimbleClientTimeDilationMultiplier(&dilation) < 1.f))
+    NIMBLE_TEST_ASSERT(!(nimbleClientTimeDilationMultiplier(&dilation) > 1.f))
+
+    return 0;
+}
+
+static int testDeadBandAroundTarget(void)
+{
+    NimbleClientTimeDilation dilation;
+    nimbleClientTimeDilationInit(&dilation, 2);
+
+    nimbleClientTimeDilationAddBufferDelta(&dilation, 2);
+    NIMBLE_TEST_ASSERT(dilation.rateAdjustPpm == 0)
+
+    // A single spike is smoothed to half a step, which is still inside the dead band
+    nimbleClientTimeDilationAddBufferDelta(&dilation, 10);
+    NIMBLE_TEST_ASSERT(dilation.filteredBufferDeltaMilliSteps == 2500)
+    NIMBLE_TEST_ASSERT(dilation.rateAdjustPpm == 0)
+    NIMBLE_TEST_ASSERT(!(nimbleClientTimeDilationMultiplier(&dilation) < 1.f))
+    NIMBLE_TEST_ASSERT(!(nimbleClientTimeDilationMultiplier(&dilation) > 1.f))
+
+    return 0;
+}
+
+static int testTooCloseSpeedsUp(void)
+{
+    NimbleClientTimeDilation dilation;
+    nimbleClientTimeDilationInit(&dilation, 2);
+
+    // Two steps below the target, minus the half step dead band
+    nimbleClientTimeDilationAddBufferDelta(&dilation, 0);
+    NIMBLE_TEST_ASSERT(dilation.rateAdjustPpm == 15000)
+    NIMBLE_TEST_ASSERT(nimbleClientTimeDilationMultiplier(&dilation) > 1.f)
+
+    return 0;
+}
+
+static int testTooFarAheadSlowsDownAndIsClamped(void)
+{
+    NimbleClientTimeDilation dilation;
+    nimbleClientTimeDilationInit(&dilation, 2);
+
+    nimbleClientTimeDilationAddBufferDelta(&dilation, 20);
+    NIMBLE_TEST_ASSERT(dilation.rateAdjustPpm == -NIMBLE_CLIENT_TIME_DILATION_MAXIMUM_PPM)
+    NIMBLE_TEST_ASSERT(nimbleClientTimeDilationMultiplier(&dilation) < 1.f)
+
+    return 0;
+}
+
+static int testConvergesToTheBufferDelta(void)
+{
+    NimbleClientTimeDilation dilation;
+    nimbleClientTimeDilationInit(&dilation, 2);
+
+    nimbleClientTimeDilationAddBufferDelta(&dilation, 2);
+    for (size_t i = 0; i < 200; ++i) {
+        nimbleClientTimeDilationAddBufferDelta(&dilation, 4);
+    }
+    NIMBLE_TEST_ASSERT(dilation.filteredBufferDeltaMilliSteps > 3900)
+    NIMBLE_TEST_ASSERT(dilation.rateAdjustPpm < 0)
+
+    nimbleClientTimeDilationReset(&dilation);
+    NIMBLE_TEST_ASSERT(!dilation.hasSample)
+    NIMBLE_TEST_ASSERT(dilation.rateAdjustPpm == 0)
+    NIMBLE_TEST_ASSERT(dilation.targetBufferDelta == 2)
+
+    return 0;
+}
+
+int main(void)
+{
+    int failedCount = 0;
+
+    NIMBLE_TEST_RUN(testNoCorrectionWithoutSamples, failedCount)
+    NIMBLE_TEST_RUN(testDeadBandAroundTarget, failedCount)
+    NIMBLE_TEST_RUN(testTooCloseSpeedsUp, failedCount)
+    NIMBLE_TEST_RUN(testTooFarAheadSlowsDownAndIsClamped, failedCount)
+    NIMBLE_TEST_RUN(testConvergesToTheBufferDelta, failedCount)
+
+    return failedCount == 0 ? 0 : 1;
+}